@@ -0,0 +1,625 @@
+/*
+ * Analyze the fast-import streams produced by svn-fast-export and
+ * hg-fast-export.
+ *
+ * Reports what the target repository is going to consist of: the commits
+ * per branch, the sizes of the blobs, the blobs that were sent more than
+ * once, the biggest commits, the tags and resets, and the paths and
+ * directories that take the most space.  Useful when deciding how to split
+ * the layout, or why a repository is bigger than expected.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "error.hxx"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/// Blob size histogram; every bucket is 4 times bigger than the previous one.
+static const int bucket_count = 11;
+static const char* bucket_names[bucket_count] = { "0 B", "< 1 KB", "< 4 KB", "< 16 KB", "< 64 KB", "< 256 KB", "< 1 MB", "< 4 MB", "< 16 MB", "< 64 MB", ">= 64 MB" };
+
+static int bucket( size_t size_ )
+{
+    if ( size_ == 0 )
+        return 0;
+
+    int result = 1;
+    for ( size_t limit = 1024; size_ >= limit && result < bucket_count - 1; limit *= 4 )
+        ++result;
+
+    return result;
+}
+
+/// How many entries of the 'top' lists to print.
+static size_t top_count = 20;
+
+/// Bytes & number of changes of a path.
+struct PathStats
+{
+    unsigned long long bytes;
+    unsigned long changes;
+
+    PathStats() : bytes( 0 ), changes( 0 ) {}
+};
+
+/// A commit for the 'largest commits' list.
+struct CommitStats
+{
+    unsigned long long bytes;
+    unsigned long files;
+    unsigned long mark;
+    string_view ref;
+
+    CommitStats() : bytes( 0 ), files( 0 ), mark( 0 ) {}
+
+    bool operator>( const CommitStats& other_ ) const { return bytes > other_.bytes; }
+};
+
+/// Everything we know about one stream.
+struct Stats
+{
+    unsigned long long stream_bytes;
+
+    unsigned long commits;
+    unsigned long blobs;
+    unsigned long long blob_bytes;
+    unsigned long duplicate_blobs;
+    unsigned long long duplicate_bytes;
+
+    /// Bytes of all the file changes (a blob counts as many times as it is referenced).
+    unsigned long long referenced_bytes;
+
+    unsigned long bucket_blobs[bucket_count];
+    unsigned long long bucket_bytes[bucket_count];
+
+    /// Commits per branch (and resets per branch); sorted by name.
+    map< string_view, unsigned long > branch_commits;
+    map< string_view, unsigned long > branch_resets;
+
+    /// Tags per the branch of the commit they point to.
+    map< string_view, unsigned long > tag_branches;
+    unsigned long tags;
+    unsigned long resets;
+
+    /// The largest commits, the largest first.
+    vector< CommitStats > largest;
+
+    unordered_map< string_view, PathStats > paths;
+
+    Stats() : stream_bytes( 0 ), commits( 0 ), blobs( 0 ), blob_bytes( 0 ), duplicate_blobs( 0 ), duplicate_bytes( 0 ), referenced_bytes( 0 ), tags( 0 ), resets( 0 )
+    {
+        memset( bucket_blobs, 0, sizeof( bucket_blobs ) );
+        memset( bucket_bytes, 0, sizeof( bucket_bytes ) );
+    }
+};
+
+/// Parser of the stream; the strings point directly to the mapped file.
+class Stream
+{
+    const char* pos;
+    const char* end;
+
+    Stats& stats;
+
+    /// Size of the blobs by mark (the marks are reused, svn-fast-export starts from 1 in every commit).
+    unordered_map< unsigned long, size_t > blob_sizes;
+
+    /// Branch of the commit by mark (for the tags).
+    unordered_map< unsigned long, string_view > commit_refs;
+
+    /// Hashes of the content we have seen, with the size.
+    unordered_map< size_t, size_t > seen_blobs;
+
+public:
+    Stream( const char* data_, size_t len_, Stats& stats_ ) : pos( data_ ), end( data_ + len_ ), stats( stats_ ) {}
+
+    /// Parse it all, false if it is not a valid fast-import stream.
+    bool parse( const string& name_ );
+
+private:
+    bool readLine( string_view& line_ );
+
+    bool readData( string_view line_, string_view& data_ );
+
+    bool blob( string_view& line_ );
+    bool commit( string_view& line_, bool& have_line_ );
+    bool tag( string_view& line_ );
+    bool reset( string_view& line_, bool& have_line_ );
+
+    void addBlob( string_view data_, unsigned long mark_ );
+    void addFile( string_view line_, size_t size_, CommitStats& commit_ );
+
+    bool error( const char* what_ );
+};
+
+static bool startsWith( string_view str_, string_view prefix_ )
+{
+    return str_.compare( 0, prefix_.length(), prefix_ ) == 0;
+}
+
+/// The number from ':123', 0 if none.
+static unsigned long markNumber( string_view str_ )
+{
+    if ( str_.empty() || str_[0] != ':' )
+        return 0;
+
+    unsigned long result = 0;
+    for ( size_t i = 1; i < str_.length() && str_[i] >= '0' && str_[i] <= '9'; ++i )
+        result = result * 10 + ( str_[i] - '0' );
+
+    return result;
+}
+
+bool Stream::readLine( string_view& line_ )
+{
+    if ( pos >= end )
+        return false;
+
+    const char* eol = static_cast< const char* >( memchr( pos, '\n', end - pos ) );
+    if ( !eol )
+        eol = end;
+
+    line_ = string_view( pos, eol - pos );
+    pos = ( eol < end )? eol + 1: end;
+
+    return true;
+}
+
+bool Stream::readData( string_view line_, string_view& data_ )
+{
+    if ( !startsWith( line_, "data " ) )
+        return error( "'data' expected" );
+
+    if ( startsWith( line_, "data <<" ) )
+    {
+        // delimited format: data <<EOT\n...\nEOT\n
+        string delimiter( "\n" );
+        delimiter += line_.substr( 7 );
+        delimiter += '\n';
+
+        const char* found = search( pos - 1, end, delimiter.begin(), delimiter.end() );
+        if ( found == end )
+            return error( "missing the end of the delimited data" );
+
+        data_ = string_view( pos, ( found > pos )? found - pos: 0 );
+        pos = found + delimiter.length();
+        return true;
+    }
+
+    char* number_end;
+    const unsigned long long length = strtoull( line_.data() + 5, &number_end, 10 );
+    if ( number_end == line_.data() + 5 || length > static_cast< unsigned long long >( end - pos ) )
+        return error( "wrong data length" );
+
+    data_ = string_view( pos, length );
+    pos += length;
+
+    // optional LF after the data
+    if ( pos < end && *pos == '\n' )
+        ++pos;
+
+    return true;
+}
+
+bool Stream::error( const char* what_ )
+{
+    Error::report( string( "Not a valid fast-import stream at byte " ) + to_string( stats.stream_bytes - ( end - pos ) ) + ": " + what_ );
+    return false;
+}
+
+void Stream::addBlob( string_view data_, unsigned long mark_ )
+{
+    const size_t size = data_.length();
+
+    ++stats.blobs;
+    stats.blob_bytes += size;
+
+    const int b = bucket( size );
+    ++stats.bucket_blobs[b];
+    stats.bucket_bytes[b] += size;
+
+    // identical content sent again
+    pair< unordered_map< size_t, size_t >::iterator, bool > inserted = seen_blobs.insert( make_pair( hash< string_view >()( data_ ), size ) );
+    if ( !inserted.second && inserted.first->second == size )
+    {
+        ++stats.duplicate_blobs;
+        stats.duplicate_bytes += size;
+    }
+
+    if ( mark_ )
+        blob_sizes[mark_] = size;
+}
+
+bool Stream::blob( string_view& line_ )
+{
+    unsigned long mark = 0;
+    while ( readLine( line_ ) )
+    {
+        if ( startsWith( line_, "mark " ) )
+            mark = markNumber( line_.substr( 5 ) );
+        else if ( !startsWith( line_, "original-oid " ) )
+            break;
+    }
+
+    string_view data;
+    if ( !readData( line_, data ) )
+        return false;
+
+    addBlob( data, mark );
+
+    return true;
+}
+
+/// The <dataref> of the 'M' line (':mark', 'inline' or a sha1).
+static string_view dataRef( string_view line_ )
+{
+    const size_t mode_end = line_.find( ' ', 2 );
+    const size_t ref_end = ( mode_end == string_view::npos )? string_view::npos: line_.find( ' ', mode_end + 1 );
+    if ( ref_end == string_view::npos )
+        return string_view();
+
+    return line_.substr( mode_end + 1, ref_end - mode_end - 1 );
+}
+
+void Stream::addFile( string_view line_, size_t size_, CommitStats& commit_ )
+{
+    // M <mode> <dataref> <path>
+    const size_t mode_end = line_.find( ' ', 2 );
+    const size_t ref_end = ( mode_end == string_view::npos )? string_view::npos: line_.find( ' ', mode_end + 1 );
+    if ( ref_end == string_view::npos )
+        return;
+
+    string_view path = line_.substr( ref_end + 1 );
+    if ( path.length() >= 2 && path[0] == '"' && path[path.length() - 1] == '"' )
+        path = path.substr( 1, path.length() - 2 );
+
+    PathStats& path_stats = stats.paths[path];
+    path_stats.bytes += size_;
+    ++path_stats.changes;
+
+    stats.referenced_bytes += size_;
+
+    commit_.bytes += size_;
+    ++commit_.files;
+}
+
+bool Stream::commit( string_view& line_, bool& have_line_ )
+{
+    CommitStats commit;
+    commit.ref = line_.substr( 7 );
+
+    ++stats.commits;
+    ++stats.branch_commits[commit.ref];
+
+    // header
+    while ( true )
+    {
+        if ( !readLine( line_ ) )
+            return error( "unexpected end of the commit" );
+
+        if ( startsWith( line_, "mark " ) )
+            commit.mark = markNumber( line_.substr( 5 ) );
+        else if ( startsWith( line_, "data " ) )
+            break;
+        else if ( !startsWith( line_, "author " ) && !startsWith( line_, "committer " ) &&
+                  !startsWith( line_, "original-oid " ) && !startsWith( line_, "encoding " ) )
+            return error( "unexpected line in the commit header" );
+    }
+
+    string_view message;
+    if ( !readData( line_, message ) )
+        return false;
+
+    // parents & file changes, till an empty line or the next command
+    have_line_ = false;
+    while ( readLine( line_ ) )
+    {
+        if ( line_.empty() )
+            break;
+        else if ( startsWith( line_, "M " ) )
+        {
+            const string_view modify = line_;
+            const string_view ref = dataRef( modify );
+            size_t size = 0;
+
+            if ( ref == "inline" )
+            {
+                string_view data;
+                if ( !readLine( line_ ) || !readData( line_, data ) )
+                    return false;
+
+                addBlob( data, 0 );
+                size = data.length();
+            }
+            else
+            {
+                unordered_map< unsigned long, size_t >::const_iterator it = blob_sizes.find( markNumber( ref ) );
+                if ( it != blob_sizes.end() )
+                    size = it->second;
+            }
+
+            addFile( modify, size, commit );
+        }
+        else if ( startsWith( line_, "D " ) || startsWith( line_, "C " ) || startsWith( line_, "R " ) ||
+                  startsWith( line_, "N " ) || line_ == "deleteall" ||
+                  startsWith( line_, "from " ) || startsWith( line_, "merge " ) )
+            continue;
+        else
+        {
+            have_line_ = true;
+            break;
+        }
+    }
+
+    if ( commit.mark )
+        commit_refs[commit.mark] = commit.ref;
+
+    vector< CommitStats >& largest = stats.largest;
+    if ( largest.size() < top_count || commit.bytes > largest.back().bytes )
+    {
+        largest.insert( upper_bound( largest.begin(), largest.end(), commit, greater< CommitStats >() ), commit );
+        if ( largest.size() > top_count )
+            largest.pop_back();
+    }
+
+    return true;
+}
+
+bool Stream::tag( string_view& line_ )
+{
+    ++stats.tags;
+
+    string_view branch( "(unknown)" );
+    while ( readLine( line_ ) )
+    {
+        if ( startsWith( line_, "from " ) )
+        {
+            unordered_map< unsigned long, string_view >::const_iterator it = commit_refs.find( markNumber( line_.substr( 5 ) ) );
+            branch = ( it == commit_refs.end() )? string_view( "(outside of the stream)" ): it->second;
+        }
+        else if ( startsWith( line_, "data " ) )
+            break;
+    }
+    ++stats.tag_branches[branch];
+
+    string_view message;
+    return readData( line_, message );
+}
+
+bool Stream::reset( string_view& line_, bool& have_line_ )
+{
+    ++stats.resets;
+    ++stats.branch_resets[line_.substr( 6 )];
+
+    // optional 'from', optional LF
+    have_line_ = readLine( line_ );
+    if ( have_line_ && startsWith( line_, "from " ) )
+        have_line_ = readLine( line_ );
+    if ( have_line_ && line_.empty() )
+        have_line_ = false;
+
+    return true;
+}
+
+bool Stream::parse( const string& name_ )
+{
+    string_view line;
+    bool have_line = false;
+
+    while ( have_line || readLine( line ) )
+    {
+        have_line = false;
+
+        if ( line.empty() || line[0] == '#' )
+            continue;
+        else if ( line == "blob" )
+        {
+            if ( !blob( line ) )
+                return false;
+        }
+        else if ( startsWith( line, "commit " ) )
+        {
+            if ( !commit( line, have_line ) )
+                return false;
+        }
+        else if ( startsWith( line, "tag " ) )
+        {
+            if ( !tag( line ) )
+                return false;
+        }
+        else if ( startsWith( line, "reset " ) )
+            reset( line, have_line );
+        else if ( !startsWith( line, "progress " ) && line != "checkpoint" && line != "done" &&
+                  !startsWith( line, "feature " ) && !startsWith( line, "option " ) &&
+                  !startsWith( line, "get-mark " ) && !startsWith( line, "cat-blob " ) && !startsWith( line, "ls " ) )
+        {
+            Error::report( "Unknown command in '" + name_ + "': " + string( line.substr( 0, 80 ) ) );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static double mb( unsigned long long bytes_ )
+{
+    return bytes_ / ( 1024.0 * 1024.0 );
+}
+
+static double percent( unsigned long long part_, unsigned long long whole_ )
+{
+    return whole_? 100.0 * part_ / whole_: 0.0;
+}
+
+/// Print the top entries of the path -> stats map.
+static void printTopPaths( const char* title_, const unordered_map< string_view, PathStats >& paths_, unsigned long long total_ )
+{
+    vector< pair< unsigned long long, string_view > > sorted;
+    sorted.reserve( paths_.size() );
+    for ( unordered_map< string_view, PathStats >::const_iterator it = paths_.begin(); it != paths_.end(); ++it )
+        sorted.push_back( make_pair( it->second.bytes, it->first ) );
+
+    const size_t count = min( top_count, sorted.size() );
+    partial_sort( sorted.begin(), sorted.begin() + count, sorted.end(), greater< pair< unsigned long long, string_view > >() );
+
+    printf( "\n%s:\n", title_ );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const PathStats& stats = paths_.find( sorted[i].second )->second;
+        printf( "  %10.1f MB %5.1f %% %8lu changes  %.*s\n", mb( stats.bytes ), percent( stats.bytes, total_ ), stats.changes,
+                static_cast< int >( sorted[i].second.length() ), sorted[i].second.data() );
+    }
+}
+
+static void printCounts( const char* title_, const map< string_view, unsigned long >& counts_ )
+{
+    if ( counts_.empty() )
+        return;
+
+    printf( "\n%s:\n", title_ );
+    for ( map< string_view, unsigned long >::const_iterator it = counts_.begin(); it != counts_.end(); ++it )
+        printf( "  %10lu  %.*s\n", it->second, static_cast< int >( it->first.length() ), it->first.data() );
+}
+
+static void report( const string& name_, const Stats& stats_ )
+{
+    printf( "=== %s: %.1f MB ===\n", name_.c_str(), mb( stats_.stream_bytes ) );
+    printf( "commits: %lu, branches: %lu, tags: %lu, resets: %lu\n",
+            stats_.commits, static_cast< unsigned long >( stats_.branch_commits.size() ), stats_.tags, stats_.resets );
+    printf( "blobs: %lu, %.1f MB\n", stats_.blobs, mb( stats_.blob_bytes ) );
+    printf( "duplicate blobs: %lu, %.1f MB (%.1f %% of the blob bytes)\n",
+            stats_.duplicate_blobs, mb( stats_.duplicate_bytes ), percent( stats_.duplicate_bytes, stats_.blob_bytes ) );
+
+    printf( "\nBlob sizes:\n" );
+    for ( int i = 0; i < bucket_count; ++i )
+        printf( "  %-9s %10lu blobs %10.1f MB %5.1f %%\n", bucket_names[i], stats_.bucket_blobs[i],
+                mb( stats_.bucket_bytes[i] ), percent( stats_.bucket_bytes[i], stats_.blob_bytes ) );
+
+    printCounts( "Commits per branch", stats_.branch_commits );
+    printCounts( "Resets per branch", stats_.branch_resets );
+    printCounts( "Tags per branch of the tagged commit", stats_.tag_branches );
+
+    printf( "\nLargest commits:\n" );
+    for ( vector< CommitStats >::const_iterator it = stats_.largest.begin(); it != stats_.largest.end(); ++it )
+    {
+        char mark[32] = "-";
+        if ( it->mark )
+            snprintf( mark, sizeof( mark ), ":%lu", it->mark );
+
+        printf( "  %10.1f MB %8lu files  mark %-8s  %.*s\n", mb( it->bytes ), it->files, mark,
+                static_cast< int >( it->ref.length() ), it->ref.data() );
+    }
+
+    // the top-level directories are what the layout rules usually split on
+    unordered_map< string_view, PathStats > dirs;
+    for ( unordered_map< string_view, PathStats >::const_iterator it = stats_.paths.begin(); it != stats_.paths.end(); ++it )
+    {
+        const size_t slash = it->first.find( '/' );
+        PathStats& dir = dirs[( slash == string_view::npos )? string_view( "(top-level files)" ): it->first.substr( 0, slash )];
+        dir.bytes += it->second.bytes;
+        dir.changes += it->second.changes;
+    }
+
+    // relative to what the file changes reference, a blob can be used more times
+    printf( "\nFile changes: %.1f MB referenced\n", mb( stats_.referenced_bytes ) );
+    printTopPaths( "Top-level directories by bytes", dirs, stats_.referenced_bytes );
+    printTopPaths( "Paths by bytes", stats_.paths, stats_.referenced_bytes );
+    printf( "\n" );
+}
+
+static bool analyze( const char* fname_ )
+{
+    int fd = open( fname_, O_RDONLY );
+    if ( fd < 0 )
+    {
+        Error::report( string( "Cannot open '" ) + fname_ + "': " + strerror( errno ) );
+        return false;
+    }
+
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) )
+    {
+        Error::report( string( "'" ) + fname_ + "' is not a regular file (cannot analyze pipes)." );
+        close( fd );
+        return false;
+    }
+
+    Stats stats;
+    stats.stream_bytes = st.st_size;
+
+    if ( st.st_size == 0 )
+    {
+        close( fd );
+        report( fname_, stats );
+        return true;
+    }
+
+    void* mapped = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( mapped == MAP_FAILED )
+    {
+        Error::report( string( "Cannot mmap '" ) + fname_ + "': " + strerror( errno ) );
+        return false;
+    }
+    madvise( mapped, st.st_size, MADV_SEQUENTIAL );
+
+    Stream stream( static_cast< const char* >( mapped ), st.st_size, stats );
+    const bool result = stream.parse( fname_ );
+    if ( result )
+        report( fname_, stats );
+
+    munmap( mapped, st.st_size );
+
+    return result;
+}
+
+int main( int argc, char *argv[] )
+{
+    int arg = 1;
+    for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; ++arg )
+    {
+        if ( strncmp( argv[arg], "--top=", 6 ) == 0 )
+        {
+            char* end;
+            const long top = strtol( argv[arg] + 6, &end, 10 );
+            top_count = ( *end == 0 && top > 0 )? top: 0;
+        }
+        else
+        {
+            Error::report( string( "Unknown option '" ) + argv[arg] + "'." );
+            return Error::returnValue();
+        }
+    }
+
+    if ( arg >= argc || top_count < 1 )
+    {
+        Error::report( string( "usage: " ) + argv[0] + " [--top=N] REPO.dump...\n" );
+        return Error::returnValue();
+    }
+
+    for ( ; arg < argc; ++arg )
+        analyze( argv[arg] );
+
+    return Error::returnValue();
+}
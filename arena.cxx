@@ -0,0 +1,78 @@
+/*
+ * Memory for the text that lives just until the end of the revision.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "arena.hxx"
+
+using namespace std;
+
+static const size_t min_chunk_size = 64 * 1024;
+
+Arena::Arena()
+    : current( 0 ),
+      used( 0 )
+{
+}
+
+Arena::~Arena()
+{
+    for ( vector< Chunk >::iterator it = chunks.begin(); it != chunks.end(); ++it )
+        delete[] it->data;
+}
+
+void Arena::nextChunk( size_t len_ )
+{
+    // try the chunks we already have (from the previous revisions)
+    if ( current < chunks.size() )
+    {
+        while ( ++current < chunks.size() )
+        {
+            if ( len_ <= chunks[current].size )
+            {
+                used = 0;
+                return;
+            }
+        }
+    }
+
+    // we need a new one; make it bigger each time, so that we do not end up
+    // with too many of them
+    size_t size = chunks.empty()? min_chunk_size: 2 * chunks.back().size;
+    if ( size < len_ )
+        size = len_;
+
+    Chunk chunk = { new char[size], size };
+    chunks.push_back( chunk );
+
+    current = chunks.size() - 1;
+    used = 0;
+}
+
+std::string_view Arena::copy( std::string_view str_ )
+{
+    char* result = allocate( str_.length() + 1 );
+
+    *appendString( result, str_ ) = 0;
+
+    return string_view( result, str_.length() );
+}
+
+std::string_view Arena::concat( std::string_view first_, std::string_view second_, std::string_view third_ )
+{
+    const size_t length = first_.length() + second_.length() + third_.length();
+    char* result = allocate( length + 1 );
+
+    *appendString( appendString( appendString( result, first_ ), second_ ), third_ ) = 0;
+
+    return string_view( result, length );
+}
+
+Arena& Arena::revision()
+{
+    static Arena arena;
+
+    return arena;
+}
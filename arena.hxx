@@ -0,0 +1,92 @@
+/*
+ * Memory for the text that lives just until the end of the revision.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#ifndef _ARENA_HXX_
+#define _ARENA_HXX_
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+/** Bump allocator for the command text and the paths of one revision.
+
+    All the pieces are freed at once by reset(); the chunks are kept for
+    the next revision, so that once warmed up, it does not allocate at all.
+*/
+class Arena
+{
+    struct Chunk
+    {
+        char* data;
+        size_t size;
+    };
+
+    /// All the chunks we have allocated so far.
+    std::vector< Chunk > chunks;
+
+    /// The chunk we are allocating from.
+    size_t current;
+
+    /// How much of the current chunk is used.
+    size_t used;
+
+public:
+    Arena();
+
+    ~Arena();
+
+    /// Memory for len_ bytes, valid till the next reset().
+    char* allocate( size_t len_ )
+    {
+        if ( current >= chunks.size() || used + len_ > chunks[current].size )
+            nextChunk( len_ );
+
+        char* result = chunks[current].data + used;
+        used += len_;
+
+        return result;
+    }
+
+    /// Start a piece of at most max_len_ bytes; it has to be finished by end().
+    char* begin( size_t max_len_ ) { char* result = allocate( max_len_ ); used -= max_len_; return result; }
+
+    /// Finish the piece started by begin(), the unused rest is given back.
+    std::string_view end( const char* begin_, const char* end_ ) { used += end_ - begin_; return std::string_view( begin_, end_ - begin_ ); }
+
+    /// Copy of the string (\0-terminated, the \0 is not part of the result).
+    std::string_view copy( std::string_view str_ );
+
+    /// Concatenation of the strings (\0-terminated, the \0 is not part of the result).
+    std::string_view concat( std::string_view first_, std::string_view second_, std::string_view third_ = std::string_view() );
+
+    /// Forget everything allocated so far.
+    void reset() { current = 0; used = 0; }
+
+    /// The arena for everything that is needed until the end of the current revision (changeset).
+    static Arena& revision();
+
+private:
+    /// Switch to the next chunk that can hold len_ bytes.
+    void nextChunk( size_t len_ );
+};
+
+/// Append the string to dest_, return the new end.
+inline char* appendString( char* dest_, std::string_view str_ )
+{
+    memcpy( dest_, str_.data(), str_.length() );
+    return dest_ + str_.length();
+}
+
+/// Append the decimal number to dest_ (that has to have space for 20 chars), return the new end.
+inline char* appendNumber( char* dest_, unsigned long number_ )
+{
+    return std::to_chars( dest_, dest_ + 20, number_ ).ptr;
+}
+
+#endif // _ARENA_HXX_
@@ -0,0 +1,532 @@
+/*
+ * Correctness test and benchmark of the tabs -> spaces filters.
+ *
+ * Generates a corpus of the typical (and less typical) files - tab
+ * indentation, mixed indentation, DOS line ends, trailing whitespace, no
+ * newline at the end, binary data - and compares the output of Filter for
+ * every FilterType with a frozen copy of the original char-by-char filters,
+ * byte for byte, with various chunk sizes.  Then reports the throughput for
+ * every FilterType and chunk size.
+ *
+ * Returns non-zero when the output differs.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "error.hxx"
+#include "filter.hxx"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+using namespace std;
+
+/** The filters as they were before they were optimized, do not change.
+
+    They handle the data char by char; the output of Filter has to be the
+    same, whatever it does internally.
+*/
+namespace Reference
+{
+
+/// The old way of tabs -> spaces: Just the leading whitespace, tab stop is always the same, regardless of the position
+inline void addDataLoopOld( char*& dest, char what, int& column, int& spaces_to_write, bool& nonspace_appeared, int no_spaces )
+{
+    if ( what == '\t' && !nonspace_appeared )
+    {
+        column += no_spaces;
+        spaces_to_write += no_spaces;
+    }
+    else if ( what == ' ' )
+    {
+        ++column;
+        ++spaces_to_write;
+    }
+    else if ( what == '\n' )
+    {
+        // write out any spaces that we need
+        for ( int i = 0; i < spaces_to_write; ++i )
+            *dest++ = ' ';
+
+        *dest++ = what;
+        column = 0;
+        spaces_to_write = 0;
+        nonspace_appeared = false;
+    }
+    else
+    {
+        nonspace_appeared = true;
+
+        // write out any spaces that we need
+        for ( int i = 0; i < spaces_to_write; ++i )
+            *dest++ = ' ';
+
+        *dest++ = what;
+        ++column;
+        spaces_to_write = 0;
+    }
+}
+
+/// Combine the 'old' way of tabs -> spaces with all (as if the old is applied first, and then the new one on top of that)
+inline void addDataLoopCombined( char*& dest, char what, int& column, int& spaces_to_write, bool& nonspace_appeared, int no_spaces )
+{
+    if ( what == '\t' )
+    {
+        if ( nonspace_appeared )
+        {
+            // new behavior
+            const int tab_size = no_spaces - ( column % no_spaces );
+            column += tab_size;
+            spaces_to_write += tab_size;
+        }
+        else
+        {
+            // old one
+            column += no_spaces;
+            spaces_to_write += no_spaces;
+        }
+    }
+    else if ( what == ' ' )
+    {
+        ++column;
+        ++spaces_to_write;
+    }
+    else if ( what == '\n' )
+    {
+        *dest++ = what;
+        column = 0;
+        spaces_to_write = 0;
+        nonspace_appeared = false;
+    }
+    else
+    {
+        nonspace_appeared = true;
+
+        // write out any spaces that we need
+        for ( int i = 0; i < spaces_to_write; ++i )
+            *dest++ = ' ';
+
+        *dest++ = what;
+        ++column;
+        spaces_to_write = 0;
+    }
+}
+
+/// Combine the 'old' way of tabs -> spaces with all + convert to DOS line ends
+inline void addDataLoopCombinedDos( char*& dest, char what, int& column, int& spaces_to_write, bool& nonspace_appeared, int no_spaces )
+{
+    if ( what == '\t' )
+    {
+        if ( nonspace_appeared )
+        {
+            // new behavior
+            const int tab_size = no_spaces - ( column % no_spaces );
+            column += tab_size;
+            spaces_to_write += tab_size;
+        }
+        else
+        {
+            // old one
+            column += no_spaces;
+            spaces_to_write += no_spaces;
+        }
+    }
+    else if ( what == ' ' )
+    {
+        ++column;
+        ++spaces_to_write;
+    }
+    else if ( what == '\n' )
+    {
+        // write out any spaces that we need
+        for ( int i = 0; i < spaces_to_write; ++i )
+            *dest++ = ' ';
+
+        *dest++ = '\r';
+        *dest++ = what;
+        column = 0;
+        spaces_to_write = 0;
+        nonspace_appeared = false;
+    }
+    else
+    {
+        nonspace_appeared = true;
+
+        // write out any spaces that we need
+        for ( int i = 0; i < spaces_to_write; ++i )
+            *dest++ = ' ';
+
+        *dest++ = what;
+        ++column;
+        spaces_to_write = 0;
+    }
+}
+
+/// The best tabs -> spaces: converts all, strips trailing whitespace, strips \r
+inline void addDataLoopTabs( char*& dest, char what, int& column, int& spaces_to_write, bool& nonspace_appeared, int no_spaces )
+{
+    if ( what == '\t' )
+    {
+        const int tab_size = no_spaces - ( column % no_spaces );
+        column += tab_size;
+        spaces_to_write += tab_size;
+    }
+    else if ( what == ' ' )
+    {
+        ++column;
+        ++spaces_to_write;
+    }
+    else if ( what == '\n' )
+    {
+        *dest++ = what;
+        column = 0;
+        spaces_to_write = 0;
+    }
+    else if ( what == '\r' )
+    {
+        // just ignore
+    }
+    else
+    {
+        // write out any spaces that we need
+        for ( int i = 0; i < spaces_to_write; ++i )
+            *dest++ = ' ';
+
+        *dest++ = what;
+        ++column;
+        spaces_to_write = 0;
+    }
+}
+
+/// Just convert Unx line ends to DOS ones
+inline void addDataLoopDos( char*& dest, char what, int& column, int& spaces_to_write, bool& nonspace_appeared, int no_spaces )
+{
+    if ( what == '\n' )
+        *dest++ = '\r';
+
+    *dest++ = what;
+}
+
+/// Just convert DOS line ends to Unx ones
+inline void addDataLoopUnx( char*& dest, char what, int& column, int& spaces_to_write, bool& nonspace_appeared, int no_spaces )
+{
+    if ( what == '\r' )
+        return;
+
+    *dest++ = what;
+}
+
+/// Filter the entire file the original way, the result is what Filter::write() outputs.
+static string filter( FilterType type_, int spaces_, const string& data_ )
+{
+    int column = 0;
+    int spaces_to_write = 0;
+    bool nonspace_appeared = false;
+
+    // the pending spaces can be written with the first character
+    string result( ( ( spaces_ < 2 )? 2: spaces_ ) * data_.size() + 1, '\0' );
+    char* tmp = &result[0];
+    char* dest = tmp;
+
+    for ( string::const_iterator it = data_.begin(); it != data_.end(); ++it )
+    {
+        switch ( type_ )
+        {
+            case FILTER_OLD:
+                addDataLoopOld( dest, *it, column, spaces_to_write, nonspace_appeared, spaces_ );
+                break;
+            case FILTER_COMBINED:
+            case FILTER_COMBINED_HACK:
+                addDataLoopCombined( dest, *it, column, spaces_to_write, nonspace_appeared, spaces_ );
+                break;
+            case FILTER_COMBINED_DOS:
+                addDataLoopCombinedDos( dest, *it, column, spaces_to_write, nonspace_appeared, spaces_ );
+                break;
+            case FILTER_TABS:
+                addDataLoopTabs( dest, *it, column, spaces_to_write, nonspace_appeared, spaces_ );
+                break;
+            case FILTER_DOS:
+                addDataLoopDos( dest, *it, column, spaces_to_write, nonspace_appeared, spaces_ );
+                break;
+            case FILTER_UNX:
+                addDataLoopUnx( dest, *it, column, spaces_to_write, nonspace_appeared, spaces_ );
+                break;
+            case NO_FILTER:
+                *dest++ = *it;
+                break;
+        }
+    }
+    result.resize( dest - tmp );
+
+    if ( type_ == FILTER_COMBINED_HACK )
+    {
+        // write out any spaces that we need
+        for ( int i = 0; i < spaces_to_write; ++i )
+            result += ' ';
+    }
+
+    ostringstream out;
+    out << "data " << result.size() << endl
+        << result << endl;
+
+    return out.str();
+}
+
+}
+
+static const char* type_names[] = { "none", "old", "combined", "combined-dos", "combined-hack", "tabs", "dos", "unx" };
+static const int type_count = sizeof( type_names ) / sizeof( type_names[0] );
+
+static const int spaces_list[] = { 1, 2, 4, 8 };
+static const int spaces_count = sizeof( spaces_list ) / sizeof( spaces_list[0] );
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/// Simple deterministic random generator, so that the corpus is always the same.
+static unsigned int random_state = 12345;
+
+static unsigned int rnd( unsigned int max_ )
+{
+    random_state = random_state * 1103515245 + 12345;
+    return ( random_state >> 8 ) % max_;
+}
+
+/// Some code-like line (without the indentation and the line end).
+static void appendCode( string& out_ )
+{
+    static const char* words[] = { "if", "(", ")", "return", "nValue", "=", "0;", "{", "}", "//", "pImpl->", "const", "sal_Int32", "+=", "\"x\"" };
+    const int count = rnd( 8 );
+    for ( int i = 0; i < count; ++i )
+    {
+        if ( i > 0 )
+            out_ += rnd( 10 ) == 0? '\t': ' ';
+        out_ += words[rnd( sizeof( words ) / sizeof( words[0] ) )];
+    }
+}
+
+enum CorpusKind { CORPUS_TABS, CORPUS_MIXED, CORPUS_CRLF, CORPUS_TRAILING, CORPUS_NO_NEWLINE, CORPUS_BINARY, CORPUS_KINDS };
+
+static const char* kind_names[] = { "tabs", "mixed", "crlf", "trailing", "no-newline", "binary" };
+
+/// Generate a file of the given kind, approximately of size_ bytes.
+static string generate( CorpusKind kind_, size_t size_ )
+{
+    string out;
+    out.reserve( size_ + 200 );
+
+    if ( kind_ == CORPUS_BINARY )
+    {
+        while ( out.size() < size_ )
+            out += rnd( 8 ) == 0? '\0': static_cast< char >( rnd( 256 ) );
+        return out;
+    }
+
+    while ( out.size() < size_ )
+    {
+        const int indent = rnd( 5 );
+        for ( int i = 0; i < indent; ++i )
+        {
+            switch ( kind_ )
+            {
+                case CORPUS_MIXED:    out += rnd( 2 )? "\t": ( rnd( 2 )? "    ": "  \t" ); break;
+                case CORPUS_TRAILING: out += rnd( 3 )? "\t": " "; break;
+                default:              out += '\t'; break;
+            }
+        }
+
+        appendCode( out );
+
+        if ( kind_ == CORPUS_TRAILING || ( kind_ == CORPUS_MIXED && rnd( 4 ) == 0 ) )
+            out += rnd( 2 )? "  ": " \t ";
+
+        out += ( kind_ == CORPUS_CRLF )? "\r\n": "\n";
+    }
+
+    if ( kind_ == CORPUS_NO_NEWLINE )
+    {
+        // the last line without '\n', ending with whitespace (FILTER_COMBINED_HACK keeps that)
+        out += "\tlast line";
+        out += " \t  ";
+    }
+
+    return out;
+}
+
+/// Name of the file that gets the filter of the given type and spaces (see addTabsToSpaces()).
+static string fileName( int type_, int spaces_ )
+{
+    char name[50];
+    snprintf( name, sizeof( name ), "bench/%s-%d.txt", type_names[type_], spaces_ );
+    return name;
+}
+
+/// Run the data through Filter in the chunks of the given size.
+static string runFilter( const string& fname_, const string& data_, size_t chunk_, bool stream_ )
+{
+    ostringstream out;
+    Filter filter( fname_ );
+
+    if ( stream_ )
+    {
+        if ( filter.wantsCount( data_.size() ) )
+            for ( size_t pos = 0; pos < data_.size(); pos += chunk_ )
+                filter.count( data_.data() + pos, min( chunk_, data_.size() - pos ) );
+
+        filter.stream( out, data_.size() );
+    }
+
+    for ( size_t pos = 0; pos < data_.size(); pos += chunk_ )
+        filter.addData( data_.data() + pos, min( chunk_, data_.size() - pos ) );
+    filter.addData( data_.data(), 0 );
+
+    filter.write( out );
+
+    return out.str();
+}
+
+/// Compare Filter with the reference on all the corpus; returns the number of failures.
+static int test( const vector< string >& corpus_ )
+{
+    static const size_t chunks[] = { 1, 3, 17, 8192, 1 << 30 };
+    int failures = 0;
+    int cases = 0;
+
+    for ( int type = 0; type < type_count; ++type )
+        for ( int s = 0; s < spaces_count; ++s )
+            for ( int kind = 0; kind < CORPUS_KINDS; ++kind )
+            {
+                const string& data = corpus_[kind];
+
+                // binary files are never filtered
+                const string expected = Reference::filter( kind == CORPUS_BINARY? NO_FILTER: FilterType( type ), spaces_list[s], data );
+
+                for ( size_t c = 0; c < sizeof( chunks ) / sizeof( chunks[0] ); ++c )
+                    for ( int stream = 0; stream < 2; ++stream )
+                    {
+                        // only the first chunk is checked for the binary data
+                        if ( kind == CORPUS_BINARY && chunks[c] < 8192 )
+                            continue;
+
+                        ++cases;
+                        const string result = runFilter( fileName( type, spaces_list[s] ), data, chunks[c], stream );
+                        if ( result == expected )
+                            continue;
+
+                        size_t diff = 0;
+                        while ( diff < result.size() && diff < expected.size() && result[diff] == expected[diff] )
+                            ++diff;
+
+                        fprintf( stderr, "FAIL: %s, %d spaces, %s, chunk %lu%s: differs at byte %lu (got %lu bytes, expected %lu)\n",
+                                type_names[type], spaces_list[s], kind_names[kind],
+                                static_cast< unsigned long >( min( chunks[c], data.size() ) ), stream? ", streamed": "",
+                                static_cast< unsigned long >( diff ),
+                                static_cast< unsigned long >( result.size() ), static_cast< unsigned long >( expected.size() ) );
+                        ++failures;
+                    }
+            }
+
+    printf( "%d cases, %d failures\n", cases, failures );
+
+    return failures;
+}
+
+/// The files over Filter::large_file go through other code paths.
+static int testLarge()
+{
+    const string data = generate( CORPUS_TRAILING, Filter::large_file + 12345 );
+    int failures = 0;
+
+    for ( int type = 0; type < type_count; ++type )
+    {
+        if ( runFilter( fileName( type, 4 ), data, 8192, true ) != Reference::filter( FilterType( type ), 4, data ) )
+        {
+            fprintf( stderr, "FAIL: %s, 4 spaces, large file, streamed\n", type_names[type] );
+            ++failures;
+        }
+    }
+
+    printf( "large files: %d failures\n", failures );
+
+    return failures;
+}
+
+static void bench( const string& data_, int iterations_ )
+{
+    static const size_t chunks[] = { 256, 8192, 65536 };
+
+    printf( "%-16s", "type \\ chunk" );
+    for ( size_t c = 0; c < sizeof( chunks ) / sizeof( chunks[0] ); ++c )
+        printf( " %10lu B", static_cast< unsigned long >( chunks[c] ) );
+    printf( "\n" );
+
+    for ( int type = 0; type < type_count; ++type )
+    {
+        printf( "%-16s", type_names[type] );
+        for ( size_t c = 0; c < sizeof( chunks ) / sizeof( chunks[0] ); ++c )
+        {
+            const string fname = fileName( type, 4 );
+
+            // warm up
+            runFilter( fname, data_, chunks[c], false );
+
+            const double start = now();
+            for ( int i = 0; i < iterations_; ++i )
+                runFilter( fname, data_, chunks[c], false );
+            const double elapsed = now() - start;
+
+            printf( " %7.1f MB/s", data_.size() * static_cast< double >( iterations_ ) / elapsed / ( 1024 * 1024 ) );
+        }
+        printf( "\n" );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    int iterations = 20;
+    if ( argc > 1 )
+    {
+        char* end;
+        iterations = strtol( argv[1], &end, 10 );
+        if ( *end != 0 )
+            iterations = 0;
+    }
+
+    if ( argc > 2 || iterations < 1 )
+    {
+        Error::report( string( "usage: " ) + argv[0] + " [ITERATIONS]\n" );
+        return Error::returnValue();
+    }
+
+    for ( int type = 0; type < type_count; ++type )
+        for ( int s = 0; s < spaces_count; ++s )
+            Filter::addTabsToSpaces( spaces_list[s], FilterType( type ), "^" + fileName( type, spaces_list[s] ) + "$" );
+
+    vector< string > corpus;
+    for ( int kind = 0; kind < CORPUS_KINDS; ++kind )
+        corpus.push_back( generate( CorpusKind( kind ), 20000 ) );
+
+    int failures = test( corpus );
+    failures += testLarge();
+
+    // the text files, 1MB each
+    string text;
+    for ( int kind = 0; kind < CORPUS_BINARY; ++kind )
+        text += generate( CorpusKind( kind ), 1024 * 1024 );
+
+    printf( "\nthroughput of %lu bytes of text, 4 spaces:\n", static_cast< unsigned long >( text.size() ) );
+    bench( text, iterations );
+
+    return failures? 1: 0;
+}
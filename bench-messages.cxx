@@ -0,0 +1,75 @@
+/*
+ * Microbenchmark for the conversion of the commit messages.
+ *
+ * Converts several kinds of logs (ChangeLog-like ones, plain ones, and a
+ * huge one) many times, and reports the time per message and the throughput.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "messages.hxx"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/time.h>
+
+using namespace std;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/// ChangeLog-like entry with the given amount of the '* file: change' lines.
+static string changelog( int entries_ )
+{
+    string log( "2008-02-12  The Name  <the@address.com>\n\n" );
+    for ( int i = 0; i < entries_; ++i )
+    {
+        char line[200];
+        snprintf( line, sizeof( line ), "        * sw/source/core/file%d.cxx: Changed this to that,\n\t  and also the other thing %d.\n", i, i );
+        log += line;
+    }
+
+    return log;
+}
+
+static void bench( const char* name_, const string& log_, int iterations_ )
+{
+    string result;
+
+    // warm up
+    CommitMessages::convert( log_, result );
+
+    const double start = now();
+    for ( int i = 0; i < iterations_; ++i )
+        CommitMessages::convert( log_, result );
+    const double elapsed = now() - start;
+
+    printf( "%-24s %10lu bytes %10.0f ns/message %10.1f MB/s\n",
+            name_, static_cast< unsigned long >( log_.length() ),
+            elapsed * 1e9 / iterations_,
+            log_.length() * static_cast< double >( iterations_ ) / elapsed / ( 1024 * 1024 ) );
+}
+
+int main( int argc, char *argv[] )
+{
+    int iterations = 100000;
+    if ( argc > 1 )
+        iterations = atoi( argv[1] );
+
+    CommitMessages::setConvert( true );
+
+    bench( "plain", "  Fix the crash when loading an empty document.\n\n  Long description follows here.\n", iterations );
+    bench( "asterisk", "* sw/source/core/doc.cxx: Fix the crash.\n* sw/inc/doc.hxx: Dtto.\n", iterations );
+    bench( "changelog-small", changelog( 3 ), iterations );
+    bench( "changelog-large", changelog( 200 ), iterations / 100 + 1 );
+    bench( "changelog-huge", changelog( 50000 ), iterations / 10000 + 1 );
+
+    return 0;
+}
@@ -0,0 +1,323 @@
+/*
+ * Generate a synthetic Subversion repository to benchmark svn-fast-export.
+ *
+ * Creates a local FSFS repository with the usual trunk/branches/tags
+ * structure and the kinds of changes we see in the real history: commits
+ * to trunk and to the CWS branches, branch and tag copies, big directory
+ * copies, deletes, and ChangeLog-like commit messages.  The content is
+ * deterministic, so that the runs can be compared.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "error.hxx"
+
+#include <apr_general.h>
+
+#include <svn_fs.h>
+#include <svn_pools.h>
+#include <svn_repos.h>
+#include <svn_types.h>
+
+using namespace std;
+
+/// Top-level directories of trunk (as the modules in OOo).
+static const char* modules[] = { "sc", "sw", "sd", "chart2", "solenv", "l10n", "vcl", "sal", "tools", "svx" };
+static const int module_count = sizeof( modules ) / sizeof( modules[0] );
+
+static const char* extensions[] = { ".cxx", ".hxx", ".mk", ".java", ".xml", ".bat", ".sdf", ".png" };
+static const int extension_count = sizeof( extensions ) / sizeof( extensions[0] );
+
+static const char* authors[] = { "kendy", "mmeeks", "rengelhard", "thorsten", "pmladek" };
+static const int author_count = sizeof( authors ) / sizeof( authors[0] );
+
+/// Simple deterministic random generator.
+static unsigned int random_state = 1;
+
+static unsigned int rnd( unsigned int max_ )
+{
+    random_state = random_state * 1103515245 + 12345;
+    return ( random_state >> 8 ) % max_;
+}
+
+/// Where we commit to, and what files it has (relative to it).
+struct Branch
+{
+    string path;
+    vector< string > files;
+
+    Branch( const string& path_ ) : path( path_ ) {}
+};
+
+static vector< Branch > branches;
+
+/// Directories copied in trunk, to be deleted later.
+static vector< string > copied_dirs;
+
+/// Content of a file; source code with tab indentation, sometimes DOS line ends.
+static string content( const string& fname_ )
+{
+    string result;
+
+    if ( fname_.compare( fname_.length() - 4, 4, ".png" ) == 0 )
+    {
+        // binary
+        const unsigned int size = 1000 + rnd( 20000 );
+        result.reserve( size );
+        for ( unsigned int i = 0; i < size; ++i )
+            result += static_cast< char >( rnd( 256 ) );
+        return result;
+    }
+
+    const bool dos = ( fname_.compare( fname_.length() - 4, 4, ".bat" ) == 0 );
+    const int lines = 20 + rnd( 400 );
+    for ( int i = 0; i < lines; ++i )
+    {
+        const int indent = rnd( 4 );
+        for ( int j = 0; j < indent; ++j )
+            result += rnd( 5 )? "\t": "    ";
+
+        char line[100];
+        snprintf( line, sizeof( line ), "nValue%u = aFunction( %u, \"text\" );%s", rnd( 1000 ), rnd( 100 ), rnd( 10 )? "": "  " );
+        result += line;
+        result += dos? "\r\n": "\n";
+    }
+
+    return result;
+}
+
+static svn_error_t* write_file( svn_fs_root_t* root_, const string& path_, apr_pool_t* pool_ )
+{
+    const string data( content( path_ ) );
+
+    svn_stream_t* stream;
+    SVN_ERR( svn_fs_apply_text( &stream, root_, path_.c_str(), NULL, pool_ ) );
+
+    apr_size_t len = data.length();
+    SVN_ERR( svn_stream_write( stream, data.data(), &len ) );
+
+    return svn_stream_close( stream );
+}
+
+/// ChangeLog-like commit message.
+static string changelog( const char* author_, const vector< string >& files_ )
+{
+    string log( "2009-01-01  " );
+    log += author_;
+    log += "  <";
+    log += author_;
+    log += "@openoffice.org>\n\n";
+
+    for ( size_t i = 0; i < files_.size(); ++i )
+        log += "\t* " + files_[i] + ": Fixed the issue #" + to_string( rnd( 100000 ) ) + ",\n\t  and also the other thing.\n";
+
+    if ( files_.empty() )
+        log += "\t* Branched / tagged.\n";
+
+    return log;
+}
+
+/// The initial tree of trunk.
+static svn_error_t* create_trunk( svn_fs_root_t* root_, int dirs_, int files_, vector< string >& names_, apr_pool_t* pool_ )
+{
+    SVN_ERR( svn_fs_make_dir( root_, "/trunk", pool_ ) );
+    SVN_ERR( svn_fs_make_dir( root_, "/branches", pool_ ) );
+    SVN_ERR( svn_fs_make_dir( root_, "/tags", pool_ ) );
+
+    for ( int m = 0; m < module_count; ++m )
+    {
+        const string module = string( "/trunk/" ) + modules[m];
+        SVN_ERR( svn_fs_make_dir( root_, module.c_str(), pool_ ) );
+
+        for ( int d = 0; d < dirs_; ++d )
+        {
+            const string dir = string( modules[m] ) + "/source" + to_string( d );
+            SVN_ERR( svn_fs_make_dir( root_, ( "/trunk/" + dir ).c_str(), pool_ ) );
+
+            for ( int f = 0; f < files_; ++f )
+            {
+                const string fname = dir + "/file" + to_string( f ) + extensions[rnd( extension_count )];
+                SVN_ERR( svn_fs_make_file( root_, ( "/trunk/" + fname ).c_str(), pool_ ) );
+                SVN_ERR( write_file( root_, "/trunk/" + fname, pool_ ) );
+
+                names_.push_back( fname );
+            }
+        }
+    }
+
+    return SVN_NO_ERROR;
+}
+
+/// Create one revision of a random kind.
+static svn_error_t* create_revision( svn_repos_t* repos_, svn_revnum_t rev_, int dirs_, int files_, apr_pool_t* pool_ )
+{
+    svn_fs_t* fs = svn_repos_fs( repos_ );
+    const char* author = authors[rnd( author_count )];
+    const unsigned int kind = rnd( 100 );
+
+    // decide what to do first, the log is needed for the transaction
+    enum { COMMIT, BRANCH, TAG, COPY_DIR, DELETE_DIR } action = COMMIT;
+    if ( rev_ == 1 )
+        action = COMMIT;
+    else if ( kind < 3 )
+        action = BRANCH;
+    else if ( kind < 5 )
+        action = TAG;
+    else if ( kind < 6 )
+        action = COPY_DIR;
+    else if ( kind < 8 && !copied_dirs.empty() )
+        action = DELETE_DIR;
+
+    Branch& branch = branches[( rev_ > 1 && rnd( 10 ) < 3 )? rnd( branches.size() ): 0];
+
+    vector< string > changed;
+    if ( rev_ > 1 && action == COMMIT )
+    {
+        const int count = 1 + rnd( 5 );
+        for ( int i = 0; i < count && !branch.files.empty(); ++i )
+            changed.push_back( branch.files[rnd( branch.files.size() )] );
+    }
+
+    svn_fs_txn_t* txn;
+    SVN_ERR( svn_repos_fs_begin_txn_for_commit( &txn, repos_, rev_ - 1, author, changelog( author, changed ).c_str(), pool_ ) );
+
+    svn_fs_root_t* root;
+    SVN_ERR( svn_fs_txn_root( &root, txn, pool_ ) );
+
+    svn_fs_root_t* prev_root = NULL;
+    if ( rev_ > 1 )
+        SVN_ERR( svn_fs_revision_root( &prev_root, fs, rev_ - 1, pool_ ) );
+
+    switch ( action )
+    {
+        case COMMIT:
+            if ( rev_ == 1 )
+            {
+                SVN_ERR( create_trunk( root, dirs_, files_, branch.files, pool_ ) );
+                break;
+            }
+
+            for ( size_t i = 0; i < changed.size(); ++i )
+            {
+                const string path = branch.path + "/" + changed[i];
+                const unsigned int what = rnd( 20 );
+
+                svn_node_kind_t node_kind;
+                SVN_ERR( svn_fs_check_path( &node_kind, root, path.c_str(), pool_ ) );
+                if ( node_kind != svn_node_file )
+                    continue;
+
+                if ( what == 0 )
+                {
+                    SVN_ERR( svn_fs_delete( root, path.c_str(), pool_ ) );
+                }
+                else if ( what == 1 )
+                {
+                    // add a new file next to it
+                    const string fname = changed[i] + ".new" + to_string( rev_ ) + extensions[rnd( extension_count )];
+                    SVN_ERR( svn_fs_make_file( root, ( branch.path + "/" + fname ).c_str(), pool_ ) );
+                    SVN_ERR( write_file( root, branch.path + "/" + fname, pool_ ) );
+                    branch.files.push_back( fname );
+                }
+                else
+                    SVN_ERR( write_file( root, path, pool_ ) );
+            }
+            break;
+        case BRANCH:
+        {
+            // CWS branched from trunk
+            const string path = "/branches/cws" + to_string( rev_ );
+            SVN_ERR( svn_fs_copy( prev_root, "/trunk", root, path.c_str(), pool_ ) );
+
+            branches.push_back( Branch( path ) );
+            branches.back().files = branches[0].files;
+            break;
+        }
+        case TAG:
+        {
+            // tag of trunk or of a branch
+            const Branch& from = branches[rnd( branches.size() )];
+            const string path = "/tags/TAG_" + to_string( rev_ );
+            SVN_ERR( svn_fs_copy( prev_root, from.path.c_str(), root, path.c_str(), pool_ ) );
+            break;
+        }
+        case COPY_DIR:
+        {
+            // copy of an entire module in trunk
+            const string path = string( "/trunk/" ) + modules[rnd( module_count )] + "_copy" + to_string( rev_ );
+            const string from = path.substr( 0, path.find( "_copy" ) );
+            SVN_ERR( svn_fs_copy( prev_root, from.c_str(), root, path.c_str(), pool_ ) );
+
+            copied_dirs.push_back( path );
+            break;
+        }
+        case DELETE_DIR:
+        {
+            SVN_ERR( svn_fs_delete( root, copied_dirs.back().c_str(), pool_ ) );
+            copied_dirs.pop_back();
+            break;
+        }
+    }
+
+    const char* conflict;
+    svn_revnum_t new_rev;
+    SVN_ERR( svn_repos_fs_commit_txn( &conflict, repos_, &new_rev, txn, pool_ ) );
+
+    return SVN_NO_ERROR;
+}
+
+int main( int argc, char *argv[] )
+{
+    if ( argc < 2 || argc > 5 )
+    {
+        Error::report( string( "usage: " ) + argv[0] + " REPOS_PATH [REVISIONS [DIRS_PER_MODULE [FILES_PER_DIR]]]\n" );
+        return Error::returnValue();
+    }
+
+    const int revisions = ( argc > 2 )? atoi( argv[2] ): 2000;
+    const int dirs = ( argc > 3 )? atoi( argv[3] ): 5;
+    const int files = ( argc > 4 )? atoi( argv[4] ): 20;
+
+    if ( apr_initialize() != APR_SUCCESS )
+    {
+        Error::report( "You lose at apr_initialize()." );
+        return Error::returnValue();
+    }
+
+    apr_pool_t* pool = svn_pool_create( NULL );
+    apr_pool_t* subpool = svn_pool_create( pool );
+
+    svn_repos_t* repos;
+    svn_error_t* err = svn_repos_create( &repos, argv[1], NULL, NULL, NULL, NULL, pool );
+
+    branches.push_back( Branch( "/trunk" ) );
+
+    for ( svn_revnum_t rev = 1; !err && rev <= revisions; ++rev )
+    {
+        svn_pool_clear( subpool );
+        err = create_revision( repos, rev, dirs, files, subpool );
+
+        if ( rev % 100 == 0 )
+            fprintf( stderr, "Created revision %ld.\n", rev );
+    }
+
+    if ( err )
+    {
+        Error::report( string( "Cannot create the repository: " ) + ( err->message? err->message: "unknown error" ) );
+        svn_error_clear( err );
+    }
+
+    svn_pool_destroy( pool );
+
+    apr_terminate();
+
+    return Error::returnValue();
+}
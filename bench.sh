@@ -0,0 +1,85 @@
+#!/bin/bash
+
+# End-to-end benchmark of svn-fast-export on a synthetic repository.
+#
+# Use like:
+# make bench
+# REVISIONS=10000 SINK=git ./bench.sh
+#
+# Prints the result as JSON on the last line, so that the builds can be
+# compared.
+
+REVISIONS="${REVISIONS:-2000}"
+SINK="${SINK:-null}"
+WORK="${WORK:-bench.tmp}"
+
+WD=`pwd`
+
+case "$SINK" in
+    null|git) ;;
+    *)
+        echo "SINK has to be 'null' (the output is thrown away) or 'git' (git fast-import)" 1>&2
+        exit 1
+        ;;
+esac
+
+# the repository is expensive to create, reuse it when it is of the same size
+if [ ! -f "$WORK/svn-$REVISIONS/format" ] ; then
+    rm -rf "$WORK"
+    mkdir -p "$WORK"
+    "$WD"/bench-svn-repo "$WORK/svn-$REVISIONS" "$REVISIONS" || exit 1
+fi
+
+cd "$WORK"
+rm -rf git *.dump
+
+cat > committers.txt <<EOF
+@openoffice.org
+kendy|Jan Holesovsky|kendy@suse.cz
+mmeeks|Michael Meeks|michael@novell.com
+EOF
+
+cat > layout.txt <<EOF
+:set convert_commit_messages
+:set filter=4,tabs,\.(cxx|hxx|java|mk)$
+:set filter=-1,dos,\.bat$
+:set filter=4,combined,\.xml$
+l10n=(^l10n|\.sdf$)
+calc=^(sc|chart2)\>
+writer=^(sw)\>
+impress=^(sd)\>
+bootstrap=^(solenv)\>
+libs=^(vcl|sal|tools|svx)\>
+rest=.*
+EOF
+
+REPOS=`sed -e 's/^[#:].*//' -e 's/=.*//' layout.txt | grep -v '^$'`
+
+# the readers of the fifos
+for I in $REPOS ; do
+    mkfifo $I.dump
+    if [ "$SINK" = "git" ] ; then
+        mkdir -p git/$I
+        ( cd git/$I ; git init -q ; git fast-import --quiet < ../../$I.dump ) &
+    else
+        cat $I.dump > /dev/null &
+    fi
+done
+
+START=`date +%s.%N`
+"$WD"/svn-fast-export --metrics=0 "svn-$REVISIONS" committers.txt layout.txt 2> export.log
+RETURN_VALUE=$?
+wait
+END=`date +%s.%N`
+
+METRICS=`grep '^METRICS ' export.log | tail -n 1`
+BYTES=`echo "$METRICS" | sed 's/.*"write":{[^}]*"bytes":\([0-9]*\)}.*/\1/'`
+RSS=`echo "$METRICS" | sed 's/.*"peak_rss_mb":\([0-9.]*\).*/\1/'`
+
+awk -v revs="$REVISIONS" -v start="$START" -v end="$END" -v bytes="$BYTES" -v rss="$RSS" -v sink="$SINK" 'BEGIN {
+    secs = end - start;
+    printf( "{\"revisions\":%d,\"seconds\":%.3f,\"rev_per_sec\":%.1f,\"mb\":%.1f,\"mb_per_sec\":%.2f,\"peak_rss_mb\":%s,\"sink\":\"%s\"}\n",
+            revs, secs, revs / secs, bytes / 1048576, bytes / 1048576 / secs, rss, sink );
+}'
+
+exit $RETURN_VALUE
@@ -7,19 +7,35 @@
 
 #include "committers.hxx"
 #include "error.hxx"
+#include "interned.hxx"
 
 #include <cstring>
+#include <deque>
 #include <fstream>
 #include <string>
 
 using namespace std;
 
-typedef std::map< string, Committer > CommittersMap;
+/// Logins (or whatever we get as the author) -> index to committers_list + 1.
+static StringTable committers;
 
-static CommittersMap committers;
+/// The records themselves; deque so that the references stay valid.
+static deque< Committer > committers_list;
 
 static string default_address( "@localhost" );
 
+/// Add or replace the committer.
+static const Committer& store( const string& login, const Committer& committer )
+{
+    unsigned int id = committers.insert( login );
+    if ( id <= committers_list.size() )
+        committers_list[id - 1] = committer;
+    else
+        committers_list.push_back( committer );
+
+    return committers_list[id - 1];
+}
+
 void Committers::load( const char *fname )
 {
     ifstream input( fname, ifstream::in );
@@ -52,22 +68,25 @@ void Committers::load( const char *fname )
 
         // store the data
         string login = line.substr( 0, delim1 );
-        committers[login] = Committer( line.substr( delim1 + 1, delim2 - delim1 - 1 ),
-                                       line.substr( delim2 + 1 ) );
+        store( login, Committer( line.substr( delim1 + 1, delim2 - delim1 - 1 ),
+                                 line.substr( delim2 + 1 ) ) );
     }
 }
 
 const Committer& Committers::getAuthor( const char* name )
 {
+    unsigned int id = committers.find( name, strlen( name ) );
+    if ( id != 0 )
+        return committers_list[id - 1];
+
     return getAuthor( string( name ) );
 }
 
 const Committer& Committers::getAuthor( const string& name )
 {
-    CommittersMap::iterator it( committers.find( name ) );
-
-    if ( it != committers.end() )
-        return it->second;
+    unsigned int id = committers.find( name.data(), name.length() );
+    if ( id != 0 )
+        return committers_list[id - 1];
 
     // name + email
     size_t addr = name.rfind( " <" );
@@ -79,7 +98,7 @@ const Committer& Committers::getAuthor( const string& name )
             size_t end = name.find( ">", at );
             if ( end != string::npos )
             {
-                return ( committers[name] = Committer( name.substr( 0, addr ) , name.substr( addr + 2, end - addr - 2 ) ) );
+                return store( name, Committer( name.substr( 0, addr ) , name.substr( addr + 2, end - addr - 2 ) ) );
             }
         }
     }
@@ -88,9 +107,9 @@ const Committer& Committers::getAuthor( const string& name )
     size_t at = name.find( "@" );
     if ( at != string::npos )
     {
-        return ( committers[name] = Committer( name.substr( 0, at ) , name ) );
+        return store( name, Committer( name.substr( 0, at ) , name ) );
     }
 
     Error::report( string( "Author '" ) + name + "' is missing, adding as '" + name + default_address + "'" );
-    return ( committers[name] = Committer( name, name + default_address ) );
+    return store( name, Committer( name, name + default_address ) );
 }
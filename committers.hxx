@@ -8,7 +8,6 @@
 #ifndef _COMMITTERS_HXX_
 #define _COMMITTERS_HXX_
 
-#include <map>
 #include <string>
 
 struct Committer
@@ -16,9 +15,18 @@ struct Committer
     std::string name;
     std::string email;
 
-    Committer() : name(), email() {}
+    /// Preformatted 'committer name <email> ' for the fast-import stream.
+    std::string committer_prefix;
 
-    Committer( const std::string& name_, const std::string& email_ ) : name( name_ ), email( email_ ) {};
+    /// Preformatted 'tagger name <email> ' for the fast-import stream.
+    std::string tagger_prefix;
+
+    Committer( const std::string& name_, const std::string& email_ )
+        : name( name_ ),
+          email( email_ ),
+          committer_prefix( "committer " + name_ + " <" + email_ + "> " ),
+          tagger_prefix( "tagger " + name_ + " <" + email_ + "> " )
+    {}
 };
 
 namespace Committers
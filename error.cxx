@@ -7,11 +7,13 @@
 
 #include "error.hxx"
 
+#include <atomic>
 #include <iostream>
 
 using namespace std;
 
-static int return_value = 0;
+/// Can be set from more threads.
+static atomic< int > return_value( 0 );
 
 void Error::report( const string& message_ )
 {
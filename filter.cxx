@@ -7,52 +7,100 @@
 
 #include "error.hxx"
 #include "filter.hxx"
+#include "metrics.hxx"
+#include "pathmatch.hxx"
 
-#include <regex.h>
-
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <cstdio>
 #include <iostream>
 #include <vector>
 
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 struct Tabs {
     int spaces;
     FilterType type;
     FilePermission perm;
-    regex_t regex;
 
-    Tabs( int spaces_, FilterType type_, FilePermission perm_ ) : spaces( spaces_ ), type( type_ ), perm( perm_ ) {}
-    ~Tabs() { regfree( &regex ); }
+    /// Statistics: files that matched, and how many of them were binary.
+    std::atomic< unsigned long > files, binary_files;
+
+    /// Statistics: bytes that went through the filter, and that were just copied.
+    std::atomic< unsigned long long > filtered, passed;
 
-    bool matches( const string& fname_ ) { return regexec( &regex, fname_.c_str(), 0, NULL, 0 ) == 0; }
+    Tabs( int spaces_, FilterType type_, FilePermission perm_ )
+        : spaces( spaces_ ), type( type_ ), perm( perm_ ), files( 0 ), binary_files( 0 ), filtered( 0 ), passed( 0 ) {}
 };
 
 static std::vector< Tabs* > tabs_vector;
 
-Filter::Filter( const string& fname_ )
+/// The regexes of tabs_vector (the same order), the 1st that matches wins.
+static PatternSet tabs_patterns;
+
+/// Files larger than this are not collected in memory (when we know their size in advance).
+const size_t Filter::large_file = 16 * 1024 * 1024;
+
+/// When spilling to the temporary file, write it in pieces of this size.
+static const size_t spill_chunk = 1024 * 1024;
+
+/// Buffer of the last destroyed Filter, so that we do not have to allocate for every file.
+///
+/// Per thread, the Filters can be used in more threads (but the constructor
+/// has to be serialized, the rules are matched in a shared PatternSet).
+static thread_local string spare_data;
+
+Filter::Filter( string_view fname_ )
     : spaces( 0 ),
       column( 0 ),
       spaces_to_write( 0 ),
       nonspace_appeared( false ),
       type( NO_FILTER ),
-      perm( PERMISSION_NO_CHANGE )
+      perm( PERMISSION_NO_CHANGE ),
+      rule( -1 ),
+      sniffed( false ),
+      counted( false ),
+      counted_length( 0 ),
+      out( NULL ),
+      length( 0 ),
+      started( false ),
+      output( OUTPUT_MEMORY ),
+      written_length( 0 ),
+      written( 0 ),
+      spill( NULL )
 {
-    data.reserve( 16384 );
+    data.swap( spare_data );
+    data.clear();
+    if ( data.capacity() < 16384 )
+        data.reserve( 16384 );
 
-    for ( std::vector< Tabs* >::const_iterator it = tabs_vector.begin(); it != tabs_vector.end(); ++it )
+    int index = tabs_patterns.find( fname_ );
+    if ( index >= 0 )
     {
-        if ( (*it)->matches( fname_.c_str() ) )
-        {
-            spaces = (*it)->spaces;
-            type = (*it)->type;
-            perm = (*it)->perm;
-            break; // 1st wins
-        }
+        Tabs* tabs = tabs_vector[index];
+        spaces = tabs->spaces;
+        type = tabs->type;
+        perm = tabs->perm;
+
+        rule = index;
+        ++tabs->files;
     }
 }
 
+Filter::~Filter()
+{
+    if ( spill )
+        fclose( spill );
+
+    if ( data.capacity() > spare_data.capacity() )
+        spare_data.swap( data );
+}
+
 /// The old way of tabs -> spaces: Just the leading whitespace, tab stop is always the same, regardless of the position
 inline void addDataLoopOld( char*& dest, char what, int& column, int& spaces_to_write, bool& nonspace_appeared, int no_spaces )
 {
@@ -240,55 +288,382 @@ inline void addDataLoopUnx( char*& dest, char what, int& column, int& spaces_to_
     *dest++ = what;
 }
 
-void Filter::addData( const char* data_, size_t len_ )
+// Scanning for the characters that need some action, 16 or 32 bytes at a time.
+//
+// The SIMD versions are used when the compiler targets SSE2 (always on
+// x86-64) or AVX2 (-mavx2 or -march=native in CXXFLAGS); the scalar loops
+// do the rest.
+
+/// Bitmask of the bytes of the block equal to c1_ or c2_ (bit i = byte i).
+#if defined( __AVX2__ )
+static const size_t block_size = 32;
+
+inline unsigned int blockMask( const char* block_, char c1_, char c2_ )
+{
+    __m256i v = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( block_ ) );
+    __m256i m = _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( c1_ ) ), _mm256_cmpeq_epi8( v, _mm256_set1_epi8( c2_ ) ) );
+    return _mm256_movemask_epi8( m );
+}
+
+/// Bitmask of the ' ' directly followed by '\n' (bit i = the '\n' at byte i).
+inline unsigned int blockSpaceNewline( const char* block_ )
+{
+    __m256i v = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( block_ ) );
+    __m256i prev = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( block_ - 1 ) );
+    __m256i m = _mm256_and_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\n' ) ), _mm256_cmpeq_epi8( prev, _mm256_set1_epi8( ' ' ) ) );
+    return _mm256_movemask_epi8( m );
+}
+#elif defined( __SSE2__ )
+static const size_t block_size = 16;
+
+inline unsigned int blockMask( const char* block_, char c1_, char c2_ )
+{
+    __m128i v = _mm_loadu_si128( reinterpret_cast< const __m128i* >( block_ ) );
+    __m128i m = _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( c1_ ) ), _mm_cmpeq_epi8( v, _mm_set1_epi8( c2_ ) ) );
+    return _mm_movemask_epi8( m );
+}
+
+inline unsigned int blockSpaceNewline( const char* block_ )
+{
+    __m128i v = _mm_loadu_si128( reinterpret_cast< const __m128i* >( block_ ) );
+    __m128i prev = _mm_loadu_si128( reinterpret_cast< const __m128i* >( block_ - 1 ) );
+    __m128i m = _mm_and_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '\n' ) ), _mm_cmpeq_epi8( prev, _mm_set1_epi8( ' ' ) ) );
+    return _mm_movemask_epi8( m );
+}
+#endif
+
+/// The first occurrence of c1_, c2_ or c3_ (they can repeat) in [begin_, end_), end_ if none.
+inline const char* findAny( const char* begin_, const char* end_, char c1_, char c2_, char c3_ )
 {
-    if ( type == NO_FILTER )
+    const char* it = begin_;
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+    for ( ; it + block_size <= end_; it += block_size )
     {
-        data.append( data_, len_ );
-        return;
+        unsigned int mask = blockMask( it, c1_, c2_ ) | blockMask( it, c3_, c3_ );
+        if ( mask )
+            return it + __builtin_ctz( mask );
+    }
+#endif
+
+    for ( ; it < end_; ++it )
+        if ( *it == c1_ || *it == c2_ || *it == c3_ )
+            return it;
+
+    return end_;
+}
+
+/// No c1_ and c2_ in [begin_, end_), and if space_newline_, no ' ' followed by '\n' either.
+inline bool isClean( const char* begin_, const char* end_, char c1_, char c2_, bool space_newline_ )
+{
+    if ( begin_ == end_ )
+        return true;
+
+    if ( *begin_ == c1_ || *begin_ == c2_ )
+        return false;
+
+    // from the 2nd character, so that we can look at the previous one
+    const char* it = begin_ + 1;
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+    for ( ; it + block_size <= end_; it += block_size )
+    {
+        if ( blockMask( it, c1_, c2_ ) )
+            return false;
+        if ( space_newline_ && blockSpaceNewline( it ) )
+            return false;
+    }
+#endif
+
+    for ( ; it < end_; ++it )
+    {
+        if ( *it == c1_ || *it == c2_ )
+            return false;
+        if ( space_newline_ && *it == '\n' && it[-1] == ' ' )
+            return false;
     }
 
-    // create big enough buffer
-    const int size = ( spaces < 2 )? 2*len_: spaces*len_;
-    char *tmp = new char[size];
-    char *dest = tmp;
+    return true;
+}
+
+bool Filter::passThrough( const char* data_, size_t len_ )
+{
+    if ( spaces_to_write != 0 || len_ == 0 )
+        return false;
 
-    // convert the tabs to spaces (according to spaces)
     switch ( type )
     {
         case FILTER_OLD:
-            for ( const char* it = data_; it < data_ + len_; ++it )
-                addDataLoopOld( dest, *it, column, spaces_to_write, nonspace_appeared, spaces );
+            // trailing spaces would have to wait in spaces_to_write
+            if ( data_[len_ - 1] == ' ' || !isClean( data_, data_ + len_, '\t', '\t', false ) )
+                return false;
             break;
         case FILTER_COMBINED:
         case FILTER_COMBINED_HACK:
-            for ( const char* it = data_; it < data_ + len_; ++it )
-                addDataLoopCombined( dest, *it, column, spaces_to_write, nonspace_appeared, spaces );
+            if ( data_[len_ - 1] == ' ' || !isClean( data_, data_ + len_, '\t', '\t', true ) )
+                return false;
             break;
         case FILTER_COMBINED_DOS:
-            for ( const char* it = data_; it < data_ + len_; ++it )
-                addDataLoopCombinedDos( dest, *it, column, spaces_to_write, nonspace_appeared, spaces );
+            if ( data_[len_ - 1] == ' ' || !isClean( data_, data_ + len_, '\t', '\n', false ) )
+                return false;
             break;
         case FILTER_TABS:
-            for ( const char* it = data_; it < data_ + len_; ++it )
-                addDataLoopTabs( dest, *it, column, spaces_to_write, nonspace_appeared, spaces );
+            if ( data_[len_ - 1] == ' ' || !isClean( data_, data_ + len_, '\t', '\r', true ) )
+                return false;
             break;
         case FILTER_DOS:
-            for ( const char* it = data_; it < data_ + len_; ++it )
-                addDataLoopDos( dest, *it, column, spaces_to_write, nonspace_appeared, spaces );
-            break;
+            // the line ends are all that changes
+            return isClean( data_, data_ + len_, '\n', '\n', false );
         case FILTER_UNX:
-            for ( const char* it = data_; it < data_ + len_; ++it )
-                addDataLoopUnx( dest, *it, column, spaces_to_write, nonspace_appeared, spaces );
-            break;
+            return isClean( data_, data_ + len_, '\r', '\r', false );
         case NO_FILTER:
-            // NO_FILTER already handled
-            break;
+            return true;
+    }
+
+    // the state is as if we went through it char by char
+    const char* it = data_ + len_;
+    while ( it > data_ && it[-1] != '\n' )
+        --it;
+
+    if ( it == data_ )
+        column += len_;
+    else
+        column = data_ + len_ - it;
+
+    nonspace_appeared = ( data_[len_ - 1] != '\n' );
+
+    return true;
+}
+
+/// Does the beginning of the file look like a binary (or UTF-16) one?
+static bool isBinary( const char* data_, size_t len_ )
+{
+    // UTF-16 BOM, either endianness
+    if ( len_ >= 2 &&
+         ( ( data_[0] == '\xff' && data_[1] == '\xfe' ) || ( data_[0] == '\xfe' && data_[1] == '\xff' ) ) )
+        return true;
+
+    // the same heuristics as git uses
+    return memchr( data_, 0, min( len_, size_t( 8000 ) ) ) != NULL;
+}
+
+void Filter::sniff( const char* data_, size_t len_ )
+{
+    sniffed = true;
+
+    // the tabs and line ends make no sense in the binary files
+    if ( type != NO_FILTER && isBinary( data_, len_ ) )
+    {
+        type = NO_FILTER;
+        ++tabs_vector[rule]->binary_files;
     }
+}
 
-    data.append( tmp, dest - tmp );
+bool Filter::wantsCount( size_t length_ ) const
+{
+    return length_ > large_file && ( type == FILTER_DOS || type == FILTER_UNX );
+}
+
+void Filter::count( const char* data_, size_t len_ )
+{
+    Metrics::Timer timer( Metrics::PHASE_FILTER, len_ );
 
-    delete[] tmp;
+    if ( !sniffed && len_ > 0 )
+        sniff( data_, len_ );
+
+    counted = true;
+    switch ( type )
+    {
+        case FILTER_DOS: counted_length += len_ + std::count( data_, data_ + len_, '\n' ); break;
+        case FILTER_UNX: counted_length += len_ - std::count( data_, data_ + len_, '\r' ); break;
+        default:         counted_length += len_; break;
+    }
+}
+
+void Filter::stream( std::ostream& out_, size_t length_ )
+{
+    out = &out_;
+    length = length_;
+}
+
+void Filter::start()
+{
+    started = true;
+
+    if ( type == NO_FILTER || counted )
+    {
+        // we know the size, write it as it comes
+        written_length = ( type == NO_FILTER )? length: counted_length;
+        *out << "data " << written_length << endl;
+        output = OUTPUT_DIRECT;
+    }
+    else if ( length > large_file )
+    {
+        // we know the size only at the end, keep it aside
+        spill = tmpfile();
+        if ( spill )
+            output = OUTPUT_SPILL;
+        else
+            Error::report( "Cannot create a temporary file, keeping the file in memory." );
+    }
+}
+
+void Filter::flush( bool all_ )
+{
+    if ( output == OUTPUT_DIRECT )
+    {
+        out->write( data.data(), data.size() );
+        written += data.size();
+        data.clear();
+    }
+    else if ( output == OUTPUT_SPILL && ( all_ || data.size() >= spill_chunk ) )
+    {
+        if ( fwrite( data.data(), 1, data.size(), spill ) != data.size() )
+            Error::report( "Cannot write to the temporary file, the output is broken." );
+        written += data.size();
+        data.clear();
+    }
+}
+
+void Filter::addData( const char* data_, size_t len_ )
+{
+    Metrics::Timer timer( Metrics::PHASE_FILTER, len_ );
+
+    if ( len_ > 0 )
+    {
+        if ( !sniffed )
+            sniff( data_, len_ );
+
+        if ( out && !started )
+            start();
+    }
+
+    // most of the files need no change at all
+    if ( type == NO_FILTER || passThrough( data_, len_ ) )
+    {
+        if ( rule >= 0 )
+            tabs_vector[rule]->passed += len_;
+
+        if ( output == OUTPUT_DIRECT )
+        {
+            out->write( data_, len_ );
+            written += len_;
+        }
+        else
+        {
+            data.append( data_, len_ );
+            flush( false );
+        }
+        return;
+    }
+
+    tabs_vector[rule]->filtered += len_;
+
+    // characters that need handling one by one, the runs of other
+    // characters (and spaces) between them are copied at once
+    char c1, c2, c3;
+    switch ( type )
+    {
+        case FILTER_TABS:  c1 = '\t'; c2 = '\n'; c3 = '\r'; break;
+        case FILTER_DOS:   c1 = c2 = c3 = '\n'; break;
+        case FILTER_UNX:   c1 = c2 = c3 = '\r'; break;
+        default:           c1 = c3 = '\t'; c2 = '\n'; break;
+    }
+    const bool tabs = ( type != FILTER_DOS && type != FILTER_UNX );
+
+    size_t used = data.size();
+    const char* end = data_ + len_;
+    for ( const char* it = data_; it < end; )
+    {
+        const char* special = findAny( it, end, c1, c2, c3 );
+
+        if ( special > it )
+        {
+            // in the tabs filters, only the trailing spaces of the run wait
+            // in spaces_to_write, the rest goes as it is
+            const char* last = special;
+            if ( tabs )
+            {
+                while ( last > it && last[-1] == ' ' )
+                    --last;
+            }
+
+            if ( last > it )
+            {
+                // spaces_to_write can be negative with a negative amount
+                // of spaces per tab; then the leading spaces of the run
+                // just make it up
+                const char* first = it;
+                int balance = spaces_to_write;
+                while ( balance < 0 && *first == ' ' )
+                {
+                    ++balance;
+                    ++first;
+                }
+
+                const size_t pending = max( balance, 0 );
+                const size_t run = last - first;
+                if ( data.size() < used + pending + run )
+                    data.resize( used + pending + ( end - first ) + 2 );
+
+                char* dest = &data[used];
+                memset( dest, ' ', pending );
+                memcpy( dest + pending, first, run );
+
+                used += pending + run;
+                spaces_to_write = 0;
+                if ( tabs )
+                    nonspace_appeared = true;
+            }
+
+            if ( tabs )
+            {
+                column += special - it;
+                spaces_to_write += special - last;
+            }
+        }
+
+        if ( special == end )
+            break;
+
+        // each character can produce the spaces we have not written yet + 2
+        if ( data.size() < used + max( spaces_to_write, 0 ) + 2 )
+            data.resize( used + max( spaces_to_write, 0 ) + ( end - special ) + 2 );
+
+        char* start = &data[used];
+        char* dest = start;
+        switch ( type )
+        {
+            case FILTER_OLD:
+                addDataLoopOld( dest, *special, column, spaces_to_write, nonspace_appeared, spaces );
+                break;
+            case FILTER_COMBINED:
+            case FILTER_COMBINED_HACK:
+                addDataLoopCombined( dest, *special, column, spaces_to_write, nonspace_appeared, spaces );
+                break;
+            case FILTER_COMBINED_DOS:
+                addDataLoopCombinedDos( dest, *special, column, spaces_to_write, nonspace_appeared, spaces );
+                break;
+            case FILTER_TABS:
+                addDataLoopTabs( dest, *special, column, spaces_to_write, nonspace_appeared, spaces );
+                break;
+            case FILTER_DOS:
+                addDataLoopDos( dest, *special, column, spaces_to_write, nonspace_appeared, spaces );
+                break;
+            case FILTER_UNX:
+                addDataLoopUnx( dest, *special, column, spaces_to_write, nonspace_appeared, spaces );
+                break;
+            case NO_FILTER:
+                // NO_FILTER already handled
+                break;
+        }
+        used += dest - start;
+
+        it = special + 1;
+    }
+
+    data.resize( used );
+    flush( false );
 }
 
 void Filter::addData( const string& data_ )
@@ -305,20 +680,61 @@ void Filter::write( std::ostream& out_ )
             data += ' ';
     }
 
-    out_ << "data " << data.size() << endl
-         << data << endl;
+    switch ( output )
+    {
+        case OUTPUT_MEMORY:
+            out_ << "data " << data.size() << endl
+                 << data << endl;
+            break;
+        case OUTPUT_DIRECT:
+            flush( true );
+            if ( written != written_length )
+                Error::report( "The file changed its size while being written, the output is broken." );
+
+            out_ << endl;
+            break;
+        case OUTPUT_SPILL:
+            flush( true );
+            out_ << "data " << written << endl;
+
+            // copy it back, using data as the buffer
+            rewind( spill );
+            data.resize( spill_chunk );
+            for ( size_t len; ( len = fread( &data[0], 1, spill_chunk, spill ) ) > 0; )
+                out_.write( data.data(), len );
+            data.clear();
+
+            if ( ferror( spill ) )
+                Error::report( "Cannot read the temporary file, the output is broken." );
+
+            out_ << endl;
+            break;
+    }
+}
+
+void Filter::printStats()
+{
+    for ( size_t i = 0; i < tabs_vector.size(); ++i )
+    {
+        const Tabs* tabs = tabs_vector[i];
+        if ( tabs->files == 0 )
+            continue;
+
+        fprintf( stderr, "Filter rule %lu: %lu files (%lu binary), %llu bytes filtered, %llu bytes passed through\n",
+                static_cast< unsigned long >( i + 1 ), tabs->files.load(), tabs->binary_files.load(), tabs->filtered.load(), tabs->passed.load() );
+    }
+}
+
+PatternSet& Filter::patterns()
+{
+    return tabs_patterns;
 }
 
 void Filter::addTabsToSpaces( int how_many_spaces_, FilterType type_, const std::string& files_regex_, FilePermission perm_ )
 {
-    Tabs* tabs = new Tabs( how_many_spaces_, type_, perm_ );
+    // even when the regex is wrong, so that the indexes stay the same
+    tabs_vector.push_back( new Tabs( how_many_spaces_, type_, perm_ ) );
 
-    int status = regcomp( &tabs->regex, files_regex_.c_str(), REG_EXTENDED | REG_NOSUB );
-    if ( status == 0 )
-        tabs_vector.push_back( tabs );
-    else
-    {
+    if ( !tabs_patterns.add( files_regex_ ) )
         Error::report( "Cannot create regex '" + files_regex_ + "' (for tabs_to_spaces_files)." );
-        delete tabs;
-    }
 }
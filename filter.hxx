@@ -8,9 +8,13 @@
 #ifndef _FILTER_HXX_
 #define _FILTER_HXX_
 
+#include <cstdio>
 #include <string>
+#include <string_view>
 #include <ostream>
 
+class PatternSet;
+
 enum FilterType {
     NO_FILTER,           ///< No filtering at all
     FILTER_OLD,          ///< Old way of filtering - each tab is exactly <n> spaces, no filtering after 1st non-tab, non-space character
@@ -48,8 +52,62 @@ class Filter
 
     FilePermission perm;
 
+    /// Index of the tabs_to_spaces_files rule that matched, -1 if none.
+    int rule;
+
+    /// We have seen the first data already (and checked whether it is a binary file).
+    bool sniffed;
+
+    /// count() has seen all the data, counted_length is the size after filtering.
+    bool counted;
+    size_t counted_length;
+
+    /// Where to write the data directly when possible, or NULL.
+    std::ostream* out;
+
+    /// The size of the file as announced to stream().
+    size_t length;
+
+    /// The way of the output is decided (with the first data).
+    bool started;
+
+    /// Where the filtered data go.
+    enum Output {
+        OUTPUT_MEMORY, ///< Collect them in 'data', write() writes them
+        OUTPUT_DIRECT, ///< The size is known, they go to 'out' as they come
+        OUTPUT_SPILL,  ///< Too big to keep in memory, they go to 'spill'
+    } output;
+
+    /// The size we wrote to the 'data <size>' header.
+    size_t written_length;
+
+    /// How much went to 'out' or to 'spill' so far.
+    size_t written;
+
+    /// Temporary file for the big files.
+    FILE* spill;
+
 public:
-    Filter( const std::string& fname_ );
+    Filter( std::string_view fname_ );
+
+    ~Filter();
+
+    /// Files larger than this are not collected in memory.
+    static const size_t large_file;
+
+    /// Should the caller pass the data to count() first (when the file is big, and we can count its size after filtering)?
+    bool wantsCount( size_t length_ ) const;
+
+    /// Pre-pass over the data that come to addData() later, just to know the size after filtering.
+    void count( const char* data_, size_t len_ );
+
+    /// We know the size of the file in advance; call before the first addData().
+    ///
+    /// When the data need no filtering (no rule, or a binary file), or when
+    /// count() has seen them, they are written to out_ as they come instead
+    /// of collecting them; big files that we cannot count go to a temporary
+    /// file.  write() has to be called with the same out_.
+    void stream( std::ostream& out_, size_t length_ );
 
     void addData( const char* data_, size_t len_ );
 
@@ -59,7 +117,26 @@ public:
 
     FilePermission getPermission() { return perm; }
 
+    /// Print how many bytes were filtered and passed through, per rule.
+    static void printStats();
+
     static void addTabsToSpaces( int how_many_spaces_, FilterType type_, const std::string& files_regex_, FilePermission perm_ = PERMISSION_NO_CHANGE );
+
+    /// The compiled regexes of the addTabsToSpaces() calls (so that they can be cached).
+    static PatternSet& patterns();
+
+private:
+    /// Check the first data whether the file is binary; if yes, it is not filtered.
+    void sniff( const char* data_, size_t len_ );
+
+    /// Decide where the output goes, and write the header when we know the size.
+    void start();
+
+    /// Move the filtered data to the output (or to the temporary file when there is enough of them, or when all_).
+    void flush( bool all_ );
+
+    /// When the data need no change, update the state and return true (the data are then just appended).
+    bool passThrough( const char* data_, size_t len_ );
 };
 
 #endif // _FILTER_HXX_
@@ -10,20 +10,36 @@
  */
 
 #define _XOPEN_SOURCE
+#include <sys/stat.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
 
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <ostream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "arena.hxx"
 #include "committers.hxx"
 #include "error.hxx"
 #include "filter.hxx"
+#include "messages.hxx"
+#include "metrics.hxx"
 #include "repository.hxx"
+#include "revlog.hxx"
+#include "trace.hxx"
 
 #include <boost/python/dict.hpp>
 #include <boost/python/extract.hpp>
@@ -35,25 +51,72 @@
 using namespace std;
 using namespace boost;
 
-static int dump_blob( const python::object& filectx, const string &target_name )
+/// The mode of the file according to the Mercurial flags.
+static const char* file_mode( const string& flags )
 {
-    string flags = python::extract< string >( filectx.attr( "flags" )() );
-
-    const char* mode = "644";
     if ( flags == "x" )
-        mode = "755";
+        return "755";
     else if ( flags == "l" )
-        mode = "120000";
+        return "120000";
     else if ( flags != "" )
         Error::report( "Got an unknown flag '" + flags + "'." );
 
+    return "644";
+}
+
+/// Filter the file content and write it to the right repository.
+static void write_blob( const char* data, size_t length, const char* mode, const string &target_name )
+{
     // prepare the stream
     ostream& out = Repositories::modifyFile( target_name, mode );
 
-    // dump the content of the file
     Filter filter( target_name );
-    filter.addData( python::extract< string >( filectx.attr( "data" )() ) );
-    filter.write( out );
+    if ( filter.wantsCount( length ) )
+    {
+        Trace::Span count_span( "Filter::count", target_name );
+        filter.count( data, length );
+    }
+    filter.stream( out, length );
+    {
+        Trace::Span filter_span( "Filter::addData", target_name );
+        filter.addData( data, length );
+    }
+    {
+        Trace::Span write_span( "Filter::write", target_name );
+        filter.write( out );
+    }
+}
+
+static int dump_blob( const python::object& filectx, const string &target_name )
+{
+    Trace::Span span( "dump_blob", target_name );
+
+    string flags;
+    {
+        Metrics::Timer timer( Metrics::PHASE_PROPS );
+        flags = python::extract< string >( filectx.attr( "flags" )() );
+    }
+
+    const char* mode = file_mode( flags );
+
+    // dump the content of the file
+    // use the data directly, without copying them to a std::string
+    python::object data_object;
+    char* data;
+    Py_ssize_t length;
+    {
+        Metrics::Timer timer( Metrics::PHASE_CONTENT );
+        data_object = filectx.attr( "data" )();
+        if ( PyBytes_AsStringAndSize( data_object.ptr(), &data, &length ) < 0 )
+            python::throw_error_already_set();
+        timer.addBytes( length );
+    }
+
+    // data_object keeps the data alive, Python can do something else
+    // meanwhile
+    PyThreadState* thread_state = PyEval_SaveThread();
+    write_blob( data, length, mode, target_name );
+    PyEval_RestoreThread( thread_state );
 
     return 0;
 }
@@ -79,6 +142,65 @@ static string mercurial_node( const string& nodestr )
     return node;
 }
 
+typedef map< string, string > TagMap;
+
+/// Parse the .hgtags content (tag name -> node as hex).
+static void read_tags( const string& hgtags, TagMap& tags )
+{
+    istringstream istr( hgtags );
+
+    while ( !istr.eof() )
+    {
+        string id, name;
+        istr >> id >> name;
+
+        if ( id.empty() || name.empty() )
+            continue;
+
+        // Mercurial's handling of tags is soooo broken :-(
+        // We need to get rid of the duplicates - the last one wins
+        tags[name] = id;
+    }
+}
+
+/// Tags from the last .hgtags we have processed (name -> node as hex).
+static TagMap last_tags;
+
+/// Revisions of the tagged changesets (node as hex -> revision, -1 when unknown).
+static unordered_map< string, int > tag_revisions;
+
+/** Create or move the tags that changed since the last processed .hgtags.
+
+    The other ones were written already (or they could not be), so there is
+    no need to look them up again.  The revisions that are not in
+    tag_revisions yet are resolved by resolve.
+*/
+static void update_tags( const TagMap& tags, const std::function< int( const string& ) >& resolve,
+        const string& author, const Time& epoch, const string& message )
+{
+    for ( TagMap::const_iterator it = tags.begin(); it != tags.end(); ++it )
+    {
+        TagMap::const_iterator last = last_tags.find( it->first );
+        if ( last != last_tags.end() && last->second == it->second )
+            continue;
+
+        unordered_map< string, int >::const_iterator rev = tag_revisions.find( it->second );
+        if ( rev == tag_revisions.end() )
+            rev = tag_revisions.insert( make_pair( it->second, resolve( it->second ) ) ).first;
+
+        if ( rev->second < 0 )
+        {
+            Error::report( "Tag '" + it->first + "' points to an unknown changeset " + it->second + "." );
+            continue;
+        }
+
+        Repositories::updateMercurialTag( it->first, rev->second,
+                Committers::getAuthor( author ), epoch, message );
+    }
+
+    last_tags = tags;
+}
+
 inline void dump_file( const python::object& file, const string& path,
         const python::object& context, const python::object& repo,
         const string& author, const Time& epoch,
@@ -103,34 +225,16 @@ inline void dump_file( const python::object& file, const string& path,
             dump_blob( filectx, path );
         else
         {
-            string hgtags = python::extract< string >( filectx.attr( "data" )() );
-            istringstream istr( hgtags );
-
-            typedef map< string, string > TagMap;
             TagMap tags;
+            read_tags( python::extract< string >( filectx.attr( "data" )() ), tags );
 
-            while ( !istr.eof() )
-            {
-                string id, name;
-                istr >> id >> name;
-
-                if ( id.empty() || name.empty() )
-                    continue;
-
-                // Mercurial's handling of tags is soooo broken :-(
-                // We need to get rid of the duplicates - the last one wins
-                tags[name] = id;
-            }
-
-            for ( TagMap::const_iterator it = tags.begin(); it != tags.end(); ++it )
-            {
-                python::object node( mercurial_node( it->second ) );
-                python::object ctx = repo[node];
-                int tag_rev = python::extract< int >( ctx.attr( "rev" )() );
-
-                Repositories::updateMercurialTag( it->first, tag_rev,
-                        Committers::getAuthor( author ), epoch, message );
-            }
+            update_tags( tags, [&repo]( const string& id )
+                    {
+                        python::object node( mercurial_node( id ) );
+                        python::object ctx = repo[node];
+                        return python::extract< int >( ctx.attr( "rev" )() )();
+                    },
+                    author, epoch, message );
         }
     }
     else
@@ -195,6 +299,48 @@ void changed_during_merge( python::object& files,
     files = files_list;
 }
 
+/** Native version of changed_during_merge().
+
+    Both manifests are sorted by the path, so we just walk them side by
+    side and compare the node ids directly.  The changed and added files
+    come first, then the deleted ones, the same as in the Python version.
+*/
+static void changed_during_merge( vector< string >& files,
+        const HgManifest& context_man, const HgManifest& parent_man )
+{
+    files.clear();
+    vector< string > deleted;
+
+    vector< HgManifestEntry >::const_iterator child = context_man.entries.begin();
+    vector< HgManifestEntry >::const_iterator parent = parent_man.entries.begin();
+    const vector< HgManifestEntry >::const_iterator child_end = context_man.entries.end();
+    const vector< HgManifestEntry >::const_iterator parent_end = parent_man.entries.end();
+
+    while ( child != child_end || parent != parent_end )
+    {
+        if ( parent == parent_end || ( child != child_end && child->path < parent->path ) )
+        {
+            // added
+            files.push_back( string( child->path ) );
+            ++child;
+        }
+        else if ( child == child_end || parent->path < child->path )
+        {
+            deleted.push_back( string( parent->path ) );
+            ++parent;
+        }
+        else
+        {
+            if ( child->node != parent->node )
+                files.push_back( string( child->path ) );
+            ++child;
+            ++parent;
+        }
+    }
+
+    files.insert( files.end(), deleted.begin(), deleted.end() );
+}
+
 static int export_changeset( const python::object& repo, const python::object& context )
 {
     int rev = python::extract< int >( context.attr( "rev" )() );
@@ -234,21 +380,29 @@ static int export_changeset( const python::object& repo, const python::object& c
     python::object date = context.attr( "date" )();
     Time epoch( static_cast< double >( python::extract< double >( date[0] ) ), python::extract< int >( date[1] ) );
 
-    // commit message
+    // commit message (the tags use the original one)
     string message = python::extract< string >( context.attr( "description" )() );
+    string log;
+    {
+        Metrics::Timer timer( Metrics::PHASE_MESSAGES, message.length() );
+        CommitMessages::convert( message, log );
+    }
 
     // files
     python::object files;
-    if ( python::len( parents ) == 1 )
-    {
-        files = context.attr( "files" )();
-    }
-    else if ( python::len( parents ) > 1 )
     {
-        changed_during_merge( files,
-                python::extract< python::dict >( context.attr( "manifest" )() ),
-                python::extract< python::dict >( parents[0].attr( "manifest" )() ) );
+        Metrics::Timer timer( Metrics::PHASE_PATHS );
+        if ( python::len( parents ) == 1 )
+        {
+            files = context.attr( "files" )();
+        }
+        else if ( python::len( parents ) > 1 )
+        {
+            changed_during_merge( files,
+                    python::extract< python::dict >( context.attr( "manifest" )() ),
+                    python::extract< python::dict >( parents[0].attr( "manifest" )() ) );
 
+        }
     }
 
     // output
@@ -263,15 +417,306 @@ static int export_changeset( const python::object& repo, const python::object& c
     Repositories::commit( Committers::getAuthor( author ),
             "master", rev,
             epoch,
-            message,
+            log,
+            merges );
+
+    // everything from this changeset is written now
+    Arena::revision().reset();
+
+    fprintf( stderr, "done!\n" );
+
+    return 0;
+}
+
+/// One file of the changeset, as read by the ChangesetReader.
+struct HgFile
+{
+    string path;
+
+    /// Not in the manifest any more.
+    bool deleted;
+
+    char flag;
+    string data;
+
+    /// For .hgtags: the tags, and the revisions of the nodes that were not
+    /// in the previous .hgtags (-1 when unknown).
+    TagMap tags;
+    vector< pair< string, int > > tag_revisions;
+};
+
+/// Everything needed to export the changeset.
+struct HgPrepared
+{
+    HgChangeset changeset;
+    vector< HgFile > files;
+
+    /// Size of the data of all the files.
+    size_t bytes;
+
+    /// Everything was read (errors were reported otherwise).
+    bool ok;
+};
+
+/** Reads the changesets ahead, in a separate thread.
+
+    The reading (decompression, applying the deltas, the merge diffs) runs
+    in parallel with the filtering and writing of the previous changesets
+    in the main thread.  HgRepository is used only from the reader thread.
+*/
+class ChangesetReader
+{
+    HgRepository& repo;
+
+    /// What to read, in this order.
+    vector< int > revs;
+
+    mutex queue_mutex;
+    condition_variable queue_changed;
+    deque< unique_ptr< HgPrepared > > queue;
+    size_t queued_bytes;
+    bool stop;
+
+    thread reader;
+
+    /// Tags from the last .hgtags we have read.
+    TagMap last_tags;
+
+    /// Manifest of the last changeset we have read (the entries point to
+    /// its text, so it is never copied).
+    unique_ptr< HgManifest > previous_manifest;
+    int previous_rev;
+
+    /// How far ahead we read.
+    static const size_t max_queued = 16;
+    static const size_t max_queued_bytes = 64 * 1024 * 1024;
+
+public:
+    ChangesetReader( HgRepository& repo_, const vector< int >& revs_ )
+        : repo( repo_ ), revs( revs_ ), queued_bytes( 0 ), stop( false ), previous_rev( -1 )
+    {
+        reader = thread( &ChangesetReader::run, this );
+    }
+
+    ~ChangesetReader()
+    {
+        {
+            lock_guard< mutex > lock( queue_mutex );
+            stop = true;
+        }
+        queue_changed.notify_all();
+        reader.join();
+    }
+
+    /// The next changeset (in the order of revs).
+    unique_ptr< HgPrepared > next()
+    {
+        unique_lock< mutex > lock( queue_mutex );
+        queue_changed.wait( lock, [this] { return !queue.empty(); } );
+
+        unique_ptr< HgPrepared > prepared( move( queue.front() ) );
+        queue.pop_front();
+        queued_bytes -= prepared->bytes;
+
+        lock.unlock();
+        queue_changed.notify_all();
+
+        return prepared;
+    }
+
+private:
+    void run()
+    {
+        for ( vector< int >::const_iterator it = revs.begin(); it != revs.end(); ++it )
+        {
+            unique_ptr< HgPrepared > prepared( new HgPrepared );
+            prepared->ok = read( *it, *prepared );
+
+            unique_lock< mutex > lock( queue_mutex );
+            // always let at least one in, even when it is too big
+            queue_changed.wait( lock, [this] { return stop || queue.empty() || ( queue.size() < max_queued && queued_bytes < max_queued_bytes ); } );
+            if ( stop )
+                return;
+
+            queued_bytes += prepared->bytes;
+            queue.push_back( move( prepared ) );
+
+            lock.unlock();
+            queue_changed.notify_all();
+        }
+    }
+
+    bool read( int rev_, HgPrepared& prepared_ )
+    {
+        HgChangeset& changeset = prepared_.changeset;
+        prepared_.bytes = 0;
+
+        {
+            Metrics::Timer timer( Metrics::PHASE_PROPS );
+            if ( !repo.changeset( rev_, changeset ) )
+                return false;
+        }
+
+        unique_ptr< HgManifest > manifest( new HgManifest );
+        vector< string > merge_files;
+        {
+            Metrics::Timer timer( Metrics::PHASE_PATHS );
+            if ( !repo.manifest( changeset.manifest, *manifest ) )
+                return false;
+
+            if ( changeset.p2 >= 0 )
+            {
+                // the first parent is usually the previous changeset; a null
+                // first parent has an empty manifest
+                const bool use_previous = previous_manifest && changeset.p1 >= 0 && changeset.p1 == previous_rev;
+                HgManifest parent_manifest;
+                if ( !use_previous && changeset.p1 >= 0 )
+                {
+                    HgChangeset parent;
+                    if ( !repo.changeset( changeset.p1, parent ) || !repo.manifest( parent.manifest, parent_manifest ) )
+                        return false;
+                }
+
+                changed_during_merge( merge_files, *manifest, use_previous? *previous_manifest: parent_manifest );
+            }
+        }
+        const vector< string >& files = ( changeset.p2 >= 0 )? merge_files: changeset.files;
+
+        Metrics::Timer timer( Metrics::PHASE_CONTENT );
+
+        prepared_.files.resize( files.size() );
+        for ( size_t i = 0; i < files.size(); ++i )
+        {
+            HgFile& file = prepared_.files[i];
+            file.path = files[i];
+
+            const HgManifestEntry* entry = manifest->find( file.path );
+            file.deleted = !entry;
+            if ( !entry )
+                continue;
+
+            file.flag = entry->flag;
+            if ( !repo.fileData( file.path, entry->node, file.data ) )
+                return false;
+
+            prepared_.bytes += file.data.length();
+
+            if ( file.path == ".hgtags" )
+            {
+                // resolve just what changed since the last .hgtags
+                read_tags( file.data, file.tags );
+
+                for ( TagMap::const_iterator it = file.tags.begin(); it != file.tags.end(); ++it )
+                {
+                    TagMap::const_iterator last = last_tags.find( it->first );
+                    if ( last != last_tags.end() && last->second == it->second )
+                        continue;
+
+                    HgNode node;
+                    file.tag_revisions.push_back( make_pair( it->second, node.fromHex( it->second )? repo.rev( node ): -1 ) );
+                }
+
+                last_tags = file.tags;
+            }
+        }
+        timer.addBytes( prepared_.bytes );
+
+        previous_manifest = move( manifest );
+        previous_rev = rev_;
+
+        return true;
+    }
+};
+
+/// Native version of dump_file(), the content was read by the ChangesetReader.
+static void dump_file( const HgFile& file,
+        const string& author, const Time& epoch,
+        const string& message, bool dbg_out )
+{
+    if ( dbg_out )
+        fprintf( stderr, "path: %s... ", file.path.c_str() );
+
+    if ( file.deleted )
+    {
+        Repositories::deleteFile( file.path );
+        return;
+    }
+
+    if ( file.path != ".hgtags" )
+    {
+        Trace::Span span( "dump_blob", file.path );
+
+        const char* mode = file_mode( file.flag? string( 1, file.flag ): string() );
+        write_blob( file.data.data(), file.data.length(), mode, file.path );
+        return;
+    }
+
+    // all the changed tags were resolved by the ChangesetReader
+    update_tags( file.tags, []( const string& ) { return -1; }, author, epoch, message );
+}
+
+/// Native version of export_changeset(), with the data from the ChangesetReader.
+static int export_changeset( const HgPrepared& prepared )
+{
+    if ( !prepared.ok )
+        return 1;
+
+    const HgChangeset& changeset = prepared.changeset;
+
+    // remember the tagged revisions even when we ignore the changeset, the
+    // reader will not resolve them again
+    for ( vector< HgFile >::const_iterator it = prepared.files.begin(); it != prepared.files.end(); ++it )
+        tag_revisions.insert( it->tag_revisions.begin(), it->tag_revisions.end() );
+
+    fprintf( stderr, "Exporting revision %d (%s)... ", changeset.rev, changeset.node.hex().c_str() );
+
+    // merges (the same as context.parents(), the first one even when null)
+    vector< int > merges;
+    merges.push_back( changeset.p1 );
+    if ( changeset.p2 >= 0 )
+        merges.push_back( changeset.p2 );
+
+    if ( !Repositories::hasParent( merges[0] ) )
+    {
+        Error::report( "ignored, no parent." );
+        return 0;
+    }
+
+    const string& author = changeset.user;
+    Time epoch( changeset.time, changeset.tz );
+
+    // commit message (the tags use the original one)
+    const string& message = changeset.description;
+    string log;
+    {
+        Metrics::Timer timer( Metrics::PHASE_MESSAGES, message.length() );
+        CommitMessages::convert( message, log );
+    }
+
+    // output
+    bool first = true;
+    for ( vector< HgFile >::const_iterator it = prepared.files.begin(); it != prepared.files.end(); ++it )
+    {
+        dump_file( *it, author, epoch, message, first );
+        first = false;
+    }
+
+    Repositories::commit( Committers::getAuthor( author ),
+            "master", changeset.rev,
+            epoch,
+            log,
             merges );
 
+    // everything from this changeset is written now
+    Arena::revision().reset();
+
     fprintf( stderr, "done!\n" );
 
     return 0;
 }
 
-int crawl_revisions( const char *repos_path, const char* repos_config )
+/// Export the changesets through Mercurial's Python code (slow, but it understands all the repository formats).
+static int crawl_revisions_python( const char *repos_path, const char* repos_config )
 {
     python::object module_ui = python::import( "mercurial.ui" );
     python::object module_hg = python::import( "mercurial.hg" );
@@ -288,7 +733,7 @@ int crawl_revisions( const char *repos_path, const char* repos_config )
     int max_rev = python::len( changelog );
 
     string dummy1, dummy2, dummy3, dummy4;
-    if ( !Repositories::load( repos_config, max_rev, min_rev, dummy1, dummy2, dummy3, dummy4 ) )
+    if ( !Repositories::load( repos_config, min_rev, dummy1, dummy2, dummy3, dummy4 ) )
     {
         Error::report( "Must have at least one valid repository definition." );
         return 1;
@@ -296,29 +741,339 @@ int crawl_revisions( const char *repos_path, const char* repos_config )
 
     // dump all the data
     for ( int rev = min_rev; rev < max_rev; rev++ )
+    {
+        Trace::beginRevision( "export_changeset", rev );
         export_changeset( repo, repo[rev] );
+        Trace::endRevision();
+        Metrics::revisionDone( rev );
+    }
+
+    return 0;
+}
+
+/// The last component of the path.
+static string base_name( const string& path )
+{
+    string name( path, 0, path.find_last_not_of( '/' ) + 1 );
+
+    return name.substr( name.rfind( '/' ) + 1 );
+}
+
+/// Change the (clone's) revision numbers of the changeset to the numbers used for the export.
+static void renumber( HgPrepared& prepared, const vector< int >& revisions )
+{
+    HgChangeset& changeset = prepared.changeset;
+    changeset.rev = revisions[changeset.rev];
+    if ( changeset.p1 >= 0 )
+        changeset.p1 = revisions[changeset.p1];
+    if ( changeset.p2 >= 0 )
+        changeset.p2 = revisions[changeset.p2];
+
+    for ( vector< HgFile >::iterator file = prepared.files.begin(); file != prepared.files.end(); ++file )
+        for ( vector< pair< string, int > >::iterator it = file->tag_revisions.begin(); it != file->tag_revisions.end(); ++it )
+            if ( it->second >= 0 )
+                it->second = revisions[it->second];
+}
+
+/** Export the changesets reading the revlogs directly; falls back to Python if the repository format is not supported.
+
+    With several clones of the same repository, the changesets are
+    identified by their node id, and each of them is exported just once.
+    The first clone keeps its revision numbers (so the layout and the
+    commit mapping is the same as when converting it alone), the changesets
+    that are only in the next clones get the following numbers.  The tip of
+    the first clone ends up in 'master', the tips of the other ones in the
+    branches named after their directories.
+*/
+int crawl_revisions( const vector< string >& repos_paths, const char* repos_config, bool use_python )
+{
+    vector< unique_ptr< HgRepository > > repos;
+    for ( vector< string >::const_iterator it = repos_paths.begin(); it != repos_paths.end(); ++it )
+    {
+        repos.emplace_back( new HgRepository );
+        if ( !use_python && repos.back()->open( *it ) )
+            continue;
+
+        if ( repos_paths.size() > 1 )
+        {
+            Error::report( "Several clones can be converted only when their revlogs can be read directly." );
+            return 1;
+        }
+
+        if ( !use_python )
+            fprintf( stderr, "Falling back to reading the repository through Mercurial.\n" );
+
+        Py_Initialize();
+        int result = crawl_revisions_python( it->c_str(), repos_config );
+        Py_Finalize();
+
+        return result;
+    }
+
+    int min_rev = 0;
+
+    string dummy1, dummy2, dummy3, dummy4;
+    if ( !Repositories::load( repos_config, min_rev, dummy1, dummy2, dummy3, dummy4 ) )
+    {
+        Error::report( "Must have at least one valid repository definition." );
+        return 1;
+    }
+
+    // node -> revision number of the changesets seen so far
+    unordered_map< HgNode, int, HgNodeHash > known;
+    int next_revision = 0;
+
+    // revision numbers of the tips of the clones
+    vector< int > tips;
+
+    for ( size_t i = 0; i < repos.size(); ++i )
+    {
+        HgRepository& repo = *repos[i];
+
+        // revision numbers of the clone's changesets, and what we have not seen yet
+        vector< int > revisions( repo.count() );
+        vector< int > revs;
+        for ( int rev = 0; rev < repo.count(); ++rev )
+        {
+            unordered_map< HgNode, int, HgNodeHash >::const_iterator it = known.find( repo.node( rev ) );
+            if ( it != known.end() )
+            {
+                revisions[rev] = it->second;
+                continue;
+            }
+
+            revisions[rev] = next_revision;
+            known.insert( make_pair( repo.node( rev ), next_revision ) );
+            ++next_revision;
+
+            if ( i > 0 || rev >= min_rev )
+                revs.push_back( rev );
+        }
+
+        if ( repos.size() > 1 )
+            fprintf( stderr, "Clone '%s': %d changesets, %lu of them new.\n", repos_paths[i].c_str(), repo.count(), static_cast< unsigned long >( revs.size() ) );
+
+        tips.push_back( repo.count() > 0? revisions.back(): -1 );
+
+        // dump all the data, while the next changesets are being read
+        ChangesetReader reader( repo, revs );
+        for ( vector< int >::const_iterator it = revs.begin(); it != revs.end(); ++it )
+        {
+            unique_ptr< HgPrepared > prepared( reader.next() );
+            if ( prepared->ok )
+                renumber( *prepared, revisions );
+
+            const int rev = revisions[*it];
+
+            Trace::beginRevision( "export_changeset", rev );
+            export_changeset( *prepared );
+            Trace::endRevision();
+            Metrics::revisionDone( rev );
+        }
+    }
+
+    // all the commits went to 'master', point the branches to the tips
+    if ( repos.size() > 1 )
+    {
+        for ( size_t i = 0; i < repos.size(); ++i )
+            Repositories::resetBranch( ( i == 0 )? string( "master" ): base_name( repos_paths[i] ), tips[i] );
+    }
+
+    return 0;
+}
+
+/// The git tags that were converted from the hg ones have this prefix.
+static const string git_tag_prefix = "ooo/";
+
+/// The hg tags (name -> revision) through Mercurial's Python code.
+static void read_hg_tags_python( const char* repos_path, unordered_map< string, int >& tags )
+{
+    python::object module_ui = python::import( "mercurial.ui" );
+    python::object module_hg = python::import( "mercurial.hg" );
+    python::object module_node = python::import( "mercurial.node" );
+
+    python::object ui = module_ui.attr( "ui" )();
+    ui.attr( "setconfig" )( "ui", "interactive", "off" );
+
+    python::object repo = module_hg.attr( "repository" )( ui, repos_path );
+
+    python::list items = python::dict( repo.attr( "tags" )() ).items();
+    for ( int i = 0; i < python::len( items ); ++i )
+    {
+        string name = python::extract< string >( items[i][0] );
+        python::object ctx = repo[items[i][1]];
+
+        tags[name] = python::extract< int >( ctx.attr( "rev" )() );
+    }
+}
+
+/** The hg tags (name -> revision), like 'hg tags' lists them.
+
+    Reads .hgtags of all the heads (the newer heads win) and .hg/localtags.
+*/
+static void read_hg_tags( const char* repos_path, bool use_python, unordered_map< string, int >& tags )
+{
+    HgRepository repo;
+    if ( use_python || !repo.open( repos_path ) )
+    {
+        if ( !use_python )
+            fprintf( stderr, "Falling back to reading the repository through Mercurial.\n" );
+
+        Py_Initialize();
+        read_hg_tags_python( repos_path, tags );
+        Py_Finalize();
+
+        return;
+    }
+
+    TagMap hg_tags;
+
+    vector< int > heads;
+    repo.heads( heads );
+    for ( vector< int >::const_iterator it = heads.begin(); it != heads.end(); ++it )
+    {
+        HgChangeset changeset;
+        HgManifest manifest;
+        if ( !repo.changeset( *it, changeset ) || !repo.manifest( changeset.manifest, manifest ) )
+            continue;
+
+        const HgManifestEntry* entry = manifest.find( ".hgtags" );
+        string data;
+        if ( entry && repo.fileData( ".hgtags", entry->node, data ) )
+            read_tags( data, hg_tags );
+    }
+
+    ifstream localtags( ( string( repos_path ) + "/.hg/localtags" ).c_str() );
+    if ( localtags )
+    {
+        stringstream data;
+        data << localtags.rdbuf();
+        read_tags( data.str(), hg_tags );
+    }
+
+    for ( TagMap::const_iterator it = hg_tags.begin(); it != hg_tags.end(); ++it )
+    {
+        HgNode node;
+        int rev = node.fromHex( it->second )? repo.rev( node ): -1;
+
+        // the removed tags point to the null node
+        if ( rev >= 0 )
+            tags[it->first] = rev;
+    }
+}
+
+/** Write the ':commit map=' lines for the git repositories.
+
+    Joins the hg tags with the tags of each of the git repositories (the
+    git ones are prefixed by git_tag_prefix), so that the conversion can
+    continue from where the git repositories end.
+*/
+static int write_commit_map( const char* repos_path, bool use_python, const vector< string >& git_dirs )
+{
+    unordered_map< string, int > hg_tags;
+    read_hg_tags( repos_path, use_python, hg_tags );
+
+    for ( vector< string >::const_iterator it = git_dirs.begin(); it != git_dirs.end(); ++it )
+    {
+        // the list usually comes from a glob, skip what cannot be a repository
+        struct stat st;
+        if ( stat( it->c_str(), &st ) != 0 || !S_ISDIR( st.st_mode ) )
+            continue;
+
+        const string name( base_name( *it ) );
+
+        // annotated tags have to be peeled to get the commit
+        string command = "git -C '" + *it + "' for-each-ref --format='%(refname:strip=2) %(objectname) %(*objectname)' refs/tags";
+        FILE* git = popen( command.c_str(), "r" );
+        if ( !git )
+        {
+            Error::report( "Cannot run '" + command + "'." );
+            continue;
+        }
+
+        // the line is printed only when git succeeds
+        ostringstream mapping;
+
+        char buffer[1024];
+        while ( fgets( buffer, sizeof( buffer ), git ) )
+        {
+            istringstream line( buffer );
+            string tag, object, commit;
+            line >> tag >> object >> commit;
+            if ( commit.empty() )
+                commit = object;
+
+            if ( tag.compare( 0, git_tag_prefix.length(), git_tag_prefix ) == 0 )
+                tag.erase( 0, git_tag_prefix.length() );
+
+            unordered_map< string, int >::const_iterator hg_tag = hg_tags.find( tag );
+            if ( hg_tag != hg_tags.end() )
+                mapping << hg_tag->second << ':' << commit << ' ';
+        }
+
+        if ( pclose( git ) != 0 )
+        {
+            Error::report( "Cannot read the tags of '" + *it + "'." );
+            continue;
+        }
+
+        printf( ":commit map=%s,%s\n", name.c_str(), mapping.str().c_str() );
+    }
 
     return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 4) {
-        Error::report( string( "usage: " ) + argv[0] + " REPOS_PATH committers.txt reposlayout.txt\n" );
+    bool use_python = false;
+    bool commit_map = false;
+
+    // options
+    int arg = 1;
+    for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; ++arg )
+    {
+        if ( strncmp( argv[arg], "--metrics=", 10 ) == 0 )
+            Metrics::setInterval( atoi( argv[arg] + 10 ) );
+        else if ( strncmp( argv[arg], "--trace=", 8 ) == 0 )
+        {
+            if ( !Trace::open( argv[arg] + 8 ) )
+                return Error::returnValue();
+        }
+        else if ( strncmp( argv[arg], "--trace-sample=", 15 ) == 0 )
+            Trace::setSample( atoi( argv[arg] + 15 ) );
+        else if ( strcmp( argv[arg], "--python" ) == 0 )
+            use_python = true;
+        else if ( strcmp( argv[arg], "--commit-map" ) == 0 )
+            commit_map = true;
+        else
+        {
+            Error::report( string( "Unknown option '" ) + argv[arg] + "'." );
+            return Error::returnValue();
+        }
+    }
+
+    if ( commit_map && argc - arg >= 2 )
+    {
+        write_commit_map( argv[arg], use_python, vector< string >( argv + arg + 1, argv + argc ) );
         return Error::returnValue();
     }
 
-    // initialize Python
-    Py_Initialize();
+    if (commit_map || argc - arg < 3) {
+        Error::report( string( "usage: " ) + argv[0] + " [--python] [--metrics=SECONDS] [--trace=FILE.json [--trace-sample=N]] REPOS_PATH... committers.txt reposlayout.txt\n"
+                "       " + argv[0] + " [--python] --commit-map REPOS_PATH GIT_REPOS...\n" );
+        return Error::returnValue();
+    }
 
-    Committers::load( argv[2] );
+    Committers::load( argv[argc - 2] );
 
     // do the work
-    crawl_revisions( argv[1], argv[3] );
-
-    Py_Finalize();
+    crawl_revisions( vector< string >( argv + arg, argv + argc - 2 ), argv[argc - 1], use_python );
 
     Repositories::close();
 
+    Metrics::finish();
+
+    Trace::close();
+
     return Error::returnValue();
 }
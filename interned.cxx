@@ -0,0 +1,120 @@
+/*
+ * Intern the strings we see over and over again (branch names, committers,
+ * path components), so that we can work with small integer ids instead.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "interned.hxx"
+
+#include <cstring>
+
+using namespace std;
+
+StringTable::StringTable()
+    : table( 64, 0 )
+{
+}
+
+size_t StringTable::hash( const char* str_, size_t len_ )
+{
+    // FNV-1a
+    size_t hash = 14695981039346656037ULL;
+    for ( const char* it = str_; it < str_ + len_; ++it )
+    {
+        hash ^= static_cast< unsigned char >( *it );
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+size_t StringTable::slot( const char* str_, size_t len_, size_t hash_ ) const
+{
+    const size_t mask = table.size() - 1;
+
+    for ( size_t i = hash_ & mask; ; i = ( i + 1 ) & mask )
+    {
+        const unsigned int id = table[i];
+        if ( id == 0 )
+            return i;
+
+        const string& str = strings[id - 1];
+        if ( hashes[id - 1] == hash_ && str.length() == len_ && memcmp( str.data(), str_, len_ ) == 0 )
+            return i;
+    }
+}
+
+unsigned int StringTable::find( const char* str_, size_t len_ ) const
+{
+    return table[slot( str_, len_, hash( str_, len_ ) )];
+}
+
+unsigned int StringTable::insert( const char* str_, size_t len_ )
+{
+    const size_t h = hash( str_, len_ );
+    size_t i = slot( str_, len_, h );
+    if ( table[i] != 0 )
+        return table[i];
+
+    strings.push_back( string( str_, len_ ) );
+    hashes.push_back( h );
+
+    // keep the load factor under 1/2
+    if ( 2 * strings.size() > table.size() )
+        grow();
+    else
+        table[i] = strings.size();
+
+    return strings.size();
+}
+
+void StringTable::grow()
+{
+    table.assign( 2 * table.size(), 0 );
+
+    const size_t mask = table.size() - 1;
+    for ( unsigned int id = 1; id <= strings.size(); ++id )
+    {
+        size_t i = hashes[id - 1] & mask;
+        while ( table[i] != 0 )
+            i = ( i + 1 ) & mask;
+
+        table[i] = id;
+    }
+}
+
+static StringTable branches;
+
+static StringTable path_components;
+
+BranchId Interned::branch( const std::string& name_ )
+{
+    return branches.insert( name_ );
+}
+
+const std::string& Interned::branchName( BranchId id_ )
+{
+    return branches.get( id_ );
+}
+
+size_t Interned::branchCount()
+{
+    return branches.size();
+}
+
+PathId Interned::pathComponent( const char* name_, size_t len_ )
+{
+    return path_components.insert( name_, len_ );
+}
+
+PathId Interned::findPathComponent( const char* name_, size_t len_ )
+{
+    return path_components.find( name_, len_ );
+}
+
+const std::string& Interned::pathComponentName( PathId id_ )
+{
+    return path_components.get( id_ );
+}
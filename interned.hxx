@@ -0,0 +1,84 @@
+/*
+ * Intern the strings we see over and over again (branch names, committers,
+ * path components), so that we can work with small integer ids instead.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#ifndef _INTERNED_HXX_
+#define _INTERNED_HXX_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+typedef unsigned int BranchId;
+
+typedef unsigned int PathId;
+
+/** Hash table of strings, assigning each string a dense id.
+
+    The ids start at 1, 0 means 'not found'.  Lookups do not need to
+    construct a std::string, so that we can look up parts of the paths
+    without allocating.
+*/
+class StringTable
+{
+    /// The strings; index = id - 1.
+    std::vector< std::string > strings;
+
+    /// Hashes of the strings; index = id - 1.
+    std::vector< size_t > hashes;
+
+    /// Open addressing table of ids; size is a power of 2.
+    std::vector< unsigned int > table;
+
+public:
+    StringTable();
+
+    /// Find the id of the string, 0 if it does not exist.
+    unsigned int find( const char* str_, size_t len_ ) const;
+
+    /// Find the id of the string, add it if it does not exist.
+    unsigned int insert( const char* str_, size_t len_ );
+
+    unsigned int insert( const std::string& str_ ) { return insert( str_.data(), str_.length() ); }
+
+    /// The string with the given id.
+    const std::string& get( unsigned int id_ ) const { return strings[id_ - 1]; }
+
+    /// Number of the strings in the table.
+    size_t size() const { return strings.size(); }
+
+    static size_t hash( const char* str_, size_t len_ );
+
+private:
+    /// Slot where the string is, or where it should go.
+    size_t slot( const char* str_, size_t len_, size_t hash_ ) const;
+
+    void grow();
+};
+
+namespace Interned
+{
+    /// Id of the branch (created on demand).
+    BranchId branch( const std::string& name_ );
+
+    /// Name of the branch with the given id.
+    const std::string& branchName( BranchId id_ );
+
+    /// Number of the branches we know about (the ids are 1..branchCount()).
+    size_t branchCount();
+
+    /// Id of a path component (created on demand), like 'sc' in 'sc/source/core/foo.cxx'.
+    PathId pathComponent( const char* name_, size_t len_ );
+
+    /// Id of a path component, 0 if we have not seen it yet.
+    PathId findPathComponent( const char* name_, size_t len_ );
+
+    /// The path component with the given id.
+    const std::string& pathComponentName( PathId id_ );
+}
+
+#endif // _INTERNED_HXX_
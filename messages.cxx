@@ -0,0 +1,281 @@
+/*
+ * Convert the ChangeLog-like commit messages to git-like ones.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "messages.hxx"
+
+#include <regex.h>
+
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+static const size_t npos = string::npos;
+
+struct ChangeLogHeader
+{
+    bool convert;
+    regex_t regex;
+
+    ChangeLogHeader() : convert( false )
+    {
+        // Match a the 'header' of a ChangeLog entry, or a part starting with
+        // asterisk
+        regcomp( &regex, "^([0-9]{4}-[0-9][0-9]?-[0-9][0-9]? .*<.*@.*>|^[ \t]*\\*)", REG_EXTENDED | REG_NOSUB );
+    }
+
+    ~ChangeLogHeader()
+    {
+        regfree( &regex );
+    }
+
+    /// Does the first line of the message match?
+    bool match( const char* message_, size_t len_ )
+    {
+        const char* eol = static_cast< const char* >( memchr( message_, '\n', len_ ) );
+        const size_t first_line = eol? eol - message_: len_;
+
+        // the first line is terminated by \0 in the original message, stop there too
+        const char* nul = static_cast< const char* >( memchr( message_, '\0', first_line ) );
+        const size_t length = nul? nul - message_: first_line;
+
+#ifdef REG_STARTEND
+        regmatch_t range;
+        range.rm_so = 0;
+        range.rm_eo = length;
+
+        return ( regexec( &regex, message_, 1, &range, REG_STARTEND ) == 0 );
+#else
+        line.assign( message_, length );
+
+        return ( regexec( &regex, line.c_str(), 0, NULL, 0 ) == 0 );
+#endif
+    }
+
+#ifndef REG_STARTEND
+    /// Reused buffer for the first line.
+    string line;
+#endif
+};
+
+static ChangeLogHeader changelog_header;
+
+static inline bool isAlnum( char c )
+{
+    return ( c >= 'A' && c <= 'Z' ) || ( c >= 'a' && c <= 'z' ) || ( c >= '0' && c <= '9' );
+}
+
+static size_t findChar( const char* text_, size_t len_, char what_, size_t from_ )
+{
+    if ( from_ >= len_ )
+        return npos;
+
+    const char* found = static_cast< const char* >( memchr( text_ + from_, what_, len_ - from_ ) );
+
+    return found? found - text_: npos;
+}
+
+/** Eat whitespace to make the commit logs nicer.
+
+  Appends the result to result_; never allocates when result_ already has
+  enough capacity.
+
+  @param empty_2nd_line Make the 2nd line empty, to satisfy git way of commit logs.
+*/
+static void eatWhitespace( const char* begin_, const char* end_, string& result_, bool uppercase_first_letter = false, bool eat_eol = false, bool empty_2nd_line = false )
+{
+    // the result is never longer than the input + the empty 2nd line
+    const size_t old_length = result_.length();
+    result_.resize( old_length + ( end_ - begin_ ) + 1 );
+
+    char* const result = &result_[old_length];
+    char* it = result;
+
+    bool eat = true;
+    bool first_eol = true;
+    bool first_letter = true;
+    bool first_letter_on_line = true;
+    int line_no = 0;
+    for ( const char* i = begin_; i != end_; ++i )
+    {
+        if ( *i == '\n' )
+        {
+            eat = true;
+            ++line_no;
+            first_letter_on_line = true;
+            if ( !first_eol && !eat_eol )
+                *it++ = *i;
+            else if ( !first_eol && eat_eol )
+                *it++ = ' ';
+        }
+        else if ( !eat || ( *i != ' ' && *i != '\t' ) )
+        {
+            eat = false;
+            first_eol = false;
+
+            if ( empty_2nd_line && first_letter_on_line && ( line_no == 1 ) )
+                *it++ = '\n';
+
+            first_letter_on_line = false;
+
+            if ( uppercase_first_letter && first_letter )
+            {
+                first_letter = false;
+                if ( *i >= 'a' && *i <= 'z' )
+                    *it++ = *i - ( 'a' - 'A' );
+                else
+                    *it++ = *i;
+            }
+            else
+                *it++ = *i;
+        }
+    }
+
+    result_.resize( old_length + ( it - result ) );
+}
+
+void CommitMessages::setConvert( bool convert_ )
+{
+    changelog_header.convert = convert_;
+}
+
+void CommitMessages::convert( const char* log_, size_t len_, std::string& result_ )
+{
+    // nothing to do - not converting messages
+    if ( !changelog_header.convert )
+    {
+        result_.assign( log_, len_ );
+        return;
+    }
+
+    result_.clear();
+    const char* const end = log_ + len_;
+
+    // HACK: kill an unusable commit message in AOOi repo - I'm too lazy to do
+    // a special configuration setting for this
+    const char really_broken_message[] = "119168 - updated LICENSE and NOTICE files for binary packag119168 - updated LICENSE and NOTICE files for binary packag119168";
+    const size_t really_broken_message_len = sizeof( really_broken_message ) - 1;
+    if ( len_ >= really_broken_message_len && memcmp( log_, really_broken_message, really_broken_message_len ) == 0 )
+    {
+        result_ = "119168 - updated LICENSE file and NOTICE file for binary package";
+        return;
+    }
+
+    // It's not a ChangeLog-like entry, do just some cosmetic changes.
+    if ( !changelog_header.match( log_, len_ ) )
+    {
+        eatWhitespace( log_, end, result_, false, false, true );
+        return;
+    }
+
+    // It's a ChangeLog-like entry, try to find a sentence and use it as the
+    // first line description of the commit, eg.
+    // from
+    // |2008-02-12  The Name  <the@address.com>
+    // |
+    // |        * some/file.txt: Changed this to that.
+    // |        * some/other/file.txt: The same here.
+    // to
+    // |Changed this to that.
+    // |
+    // |* some/file.txt: Changed this to that.
+    // |* some/other/file.txt: The same here.
+    size_t start_line = 0;
+    if ( len_ > 0 && log_[0] >= '0' && log_[0] <= '9' )
+    {
+        // Let's skip the first line if it contains just the date & committer.
+        start_line = findChar( log_, len_, '\n', 0 );
+        if ( start_line == npos )
+        {
+            eatWhitespace( log_, end, result_ );
+            return;
+        }
+    }
+
+    ++start_line;
+    size_t text = npos;
+    for ( size_t i = start_line; i < len_; ++i )
+    {
+        if ( isAlnum( log_[i] ) )
+        {
+            text = i;
+            break;
+        }
+    }
+    size_t asterisk = findChar( log_, len_, '*', start_line );
+
+    if ( text == npos )
+    {
+        eatWhitespace( log_, end, result_ );
+        return;
+    }
+
+    if ( asterisk == npos )
+    {
+        eatWhitespace( log_ + start_line, end, result_ );
+        return;
+    }
+
+    if ( asterisk < text )
+    {
+        text = asterisk + 1;
+        do {
+            text = findChar( log_, len_, ':', text );
+            if ( text == npos )
+            {
+                eatWhitespace( log_, end, result_ );
+                return;
+            }
+
+            ++text;
+        } while ( text < len_ && log_[text] == '\n' );
+
+        if ( text >= len_ )
+        {
+            eatWhitespace( log_, end, result_ );
+            return;
+        }
+    }
+
+    size_t fullstop = npos;
+    for ( size_t i = text; i < len_; ++i )
+    {
+        if ( log_[i] == '*' || log_[i] == '.' )
+        {
+            fullstop = i;
+            break;
+        }
+    }
+
+    if ( fullstop != npos && log_[fullstop] == '*' )
+    {
+        // find the last character that is not "* \t", up to the fullstop
+        size_t i = fullstop + 1;
+        fullstop = npos;
+        while ( i > 0 )
+        {
+            --i;
+            if ( log_[i] != '*' && log_[i] != ' ' && log_[i] != '\t' )
+            {
+                fullstop = i;
+                break;
+            }
+        }
+    }
+
+    // the description; when the fullstop is before the text, take just everything
+    const char* description_end = end;
+    if ( fullstop != npos && fullstop + 1 >= text )
+        description_end = log_ + fullstop + 1;
+
+    eatWhitespace( log_ + text, description_end, result_, true, true );
+
+    if ( result_.length() > 0 )
+        result_ += "\n\n";
+
+    eatWhitespace( log_ + start_line, end, result_ );
+}
@@ -0,0 +1,29 @@
+/*
+ * Convert the ChangeLog-like commit messages to git-like ones.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#ifndef _MESSAGES_HXX_
+#define _MESSAGES_HXX_
+
+#include <cstddef>
+#include <string>
+
+namespace CommitMessages
+{
+    /// Should we convert the messages at all? (':set convert_commit_messages')
+    void setConvert( bool convert_ );
+
+    /** Convert the commit message (when set up to do so).
+
+        Meant to be called once per revision / changeset; the result is
+        stored to result_ so that the caller can reuse its buffer.
+    */
+    void convert( const char* log_, size_t len_, std::string& result_ );
+
+    inline void convert( const std::string& log_, std::string& result_ ) { convert( log_.data(), log_.length(), result_ ); }
+}
+
+#endif // _MESSAGES_HXX_
@@ -0,0 +1,319 @@
+/*
+ * Measure where the time goes.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "error.hxx"
+#include "metrics.hxx"
+#include "trace.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char* phase_names[Metrics::PHASE_COUNT] = { "paths", "props", "content", "filter", "routing", "messages", "write" };
+
+/// How many of the slowest revisions to report.
+static const size_t slowest_count = 10;
+
+/** The phase counters of one thread.
+
+    The Timers can run in more threads (when the Filters do); each thread
+    updates just its own counters without any locking, report() sums them.
+*/
+struct PhaseCounters
+{
+    atomic< double > seconds[Metrics::PHASE_COUNT];
+    atomic< unsigned long > calls[Metrics::PHASE_COUNT];
+    atomic< unsigned long long > bytes[Metrics::PHASE_COUNT];
+
+    PhaseCounters();
+
+    ~PhaseCounters();
+
+    /// Add to the counter; only the owning thread writes it, so load + store is enough.
+    template< typename T, typename V > static void add( atomic< T >& counter_, V value_ )
+    {
+        counter_.store( counter_.load( memory_order_relaxed ) + value_, memory_order_relaxed );
+    }
+};
+
+/// Guards the list of the threads' counters, and the counters of the finished threads.
+static mutex phase_mutex;
+
+static vector< PhaseCounters* > thread_counters;
+
+static double finished_seconds[Metrics::PHASE_COUNT];
+static unsigned long finished_calls[Metrics::PHASE_COUNT];
+static unsigned long long finished_bytes[Metrics::PHASE_COUNT];
+
+static thread_local PhaseCounters phase_counters;
+
+PhaseCounters::PhaseCounters()
+{
+    for ( int i = 0; i < Metrics::PHASE_COUNT; ++i )
+    {
+        seconds[i] = 0;
+        calls[i] = 0;
+        bytes[i] = 0;
+    }
+
+    lock_guard< mutex > lock( phase_mutex );
+    thread_counters.push_back( this );
+}
+
+PhaseCounters::~PhaseCounters()
+{
+    lock_guard< mutex > lock( phase_mutex );
+
+    for ( int i = 0; i < Metrics::PHASE_COUNT; ++i )
+    {
+        finished_seconds[i] += seconds[i];
+        finished_calls[i] += calls[i];
+        finished_bytes[i] += bytes[i];
+    }
+
+    thread_counters.erase( find( thread_counters.begin(), thread_counters.end(), this ) );
+}
+
+/// The counters of the .dump files (deque, so that the pointers stay valid).
+static deque< Metrics::Output > outputs;
+
+/// The slowest revisions (seconds, revision), the slowest first.
+static vector< pair< double, long > > slowest;
+
+static int interval = 60;
+
+static double start_time = Metrics::now();
+static double revision_start = start_time;
+static double reported_time = start_time;
+
+static unsigned long revisions = 0;
+static unsigned long reported_revisions = 0;
+
+void Metrics::setInterval( int interval_ )
+{
+    interval = interval_;
+}
+
+void Metrics::add( Phase phase_, double seconds_, unsigned long long bytes_ )
+{
+    PhaseCounters& counters = phase_counters;
+
+    PhaseCounters::add( counters.seconds[phase_], seconds_ );
+    PhaseCounters::add( counters.calls[phase_], 1 );
+    PhaseCounters::add( counters.bytes[phase_], bytes_ );
+}
+
+Metrics::Output* Metrics::output( const std::string& name_ )
+{
+    outputs.push_back( Output( name_ ) );
+    return &outputs.back();
+}
+
+/// Print the JSON line with all the counters.
+static void report( double now_ )
+{
+    const double elapsed = now_ - start_time;
+    const double since = max( now_ - reported_time, 1e-9 );
+
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+
+    fprintf( stderr, "\nMETRICS {\"elapsed\":%.3f,\"revisions\":%lu,\"rev_per_sec\":%.2f,\"peak_rss_mb\":%.1f,\"phases\":{",
+            elapsed, revisions, ( revisions - reported_revisions ) / since, usage.ru_maxrss / 1024.0 );
+
+    unique_lock< mutex > lock( phase_mutex );
+    for ( int i = 0; i < Metrics::PHASE_COUNT; ++i )
+    {
+        double seconds = finished_seconds[i];
+        unsigned long calls = finished_calls[i];
+        unsigned long long bytes = finished_bytes[i];
+        for ( vector< PhaseCounters* >::const_iterator it = thread_counters.begin(); it != thread_counters.end(); ++it )
+        {
+            seconds += ( *it )->seconds[i].load( memory_order_relaxed );
+            calls += ( *it )->calls[i].load( memory_order_relaxed );
+            bytes += ( *it )->bytes[i].load( memory_order_relaxed );
+        }
+
+        fprintf( stderr, "%s\"%s\":{\"seconds\":%.3f,\"calls\":%lu,\"bytes\":%llu}",
+                i? ",": "", phase_names[i], seconds, calls, bytes );
+    }
+    lock.unlock();
+
+    fprintf( stderr, "},\"repositories\":{" );
+    for ( deque< Metrics::Output >::iterator it = outputs.begin(); it != outputs.end(); ++it )
+    {
+        fprintf( stderr, "%s\"%s\":{\"bytes\":%llu,\"mb_per_sec\":%.2f,\"write_seconds\":%.3f}",
+                it == outputs.begin()? "": ",", it->name.c_str(), it->bytes,
+                ( it->bytes - it->reported_bytes ) / since / ( 1024 * 1024 ), it->seconds );
+        it->reported_bytes = it->bytes;
+    }
+
+    fprintf( stderr, "},\"slowest\":[" );
+    for ( size_t i = 0; i < slowest.size(); ++i )
+        fprintf( stderr, "%s{\"rev\":%ld,\"seconds\":%.3f}", i? ",": "", slowest[i].second, slowest[i].first );
+    fprintf( stderr, "]}\n" );
+
+    reported_time = now_;
+    reported_revisions = revisions;
+}
+
+void Metrics::revisionDone( long rev_ )
+{
+    const double current = now();
+    const double seconds = current - revision_start;
+    revision_start = current;
+    ++revisions;
+
+    if ( slowest.size() < slowest_count || seconds > slowest.back().first )
+    {
+        pair< double, long > entry( seconds, rev_ );
+        slowest.insert( upper_bound( slowest.begin(), slowest.end(), entry, greater< pair< double, long > >() ), entry );
+        if ( slowest.size() > slowest_count )
+            slowest.pop_back();
+    }
+
+    if ( interval > 0 && current - reported_time >= interval )
+        report( current );
+}
+
+void Metrics::finish()
+{
+    report( now() );
+}
+
+/// The innermost Timer that is running (in this thread).
+static thread_local Metrics::Timer* current_timer = NULL;
+
+Metrics::Timer::Timer( Phase phase_, unsigned long long bytes_ )
+    : phase( phase_ ),
+      start( now() ),
+      nested( 0 ),
+      bytes( bytes_ ),
+      outer( current_timer )
+{
+    current_timer = this;
+}
+
+Metrics::Timer::~Timer()
+{
+    const double elapsed = now() - start;
+    add( phase, elapsed - nested, bytes );
+
+    if ( outer )
+        outer->nested += elapsed;
+    current_timer = outer;
+}
+
+MeteredFile::MeteredFile( const std::string& fname_, const std::string& name_ )
+    : fd( fname_.empty()? -1: open( fname_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 ) ),
+      discard( fname_.empty() ),
+      metrics( Metrics::output( name_ ) )
+{
+    if ( fd < 0 && !discard )
+        Error::report( "Cannot open '" + fname_ + "' for writing: " + strerror( errno ) );
+
+    setp( buffer, buffer + sizeof( buffer ) );
+}
+
+MeteredFile::~MeteredFile()
+{
+    sync();
+
+    if ( fd >= 0 )
+        close( fd );
+}
+
+bool MeteredFile::writeAll( const char* data_, size_t len_ )
+{
+    if ( discard )
+    {
+        metrics->bytes += len_;
+        return true;
+    }
+
+    if ( fd < 0 )
+        return false;
+
+    Metrics::Timer timer( Metrics::PHASE_WRITE, len_ );
+    Trace::Span span( "write", string_view(), metrics->name );
+    const double start = Metrics::now();
+
+    while ( len_ > 0 )
+    {
+        ssize_t written = write( fd, data_, len_ );
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            Error::report( string( "Cannot write the output of '" ) + metrics->name + "': " + strerror( errno ) );
+            return false;
+        }
+        data_ += written;
+        len_ -= written;
+        metrics->bytes += written;
+    }
+
+    metrics->seconds += Metrics::now() - start;
+
+    return true;
+}
+
+int MeteredFile::overflow( int c_ )
+{
+    if ( sync() != 0 )
+        return traits_type::eof();
+
+    if ( c_ != traits_type::eof() )
+    {
+        *pptr() = c_;
+        pbump( 1 );
+    }
+
+    return traits_type::not_eof( c_ );
+}
+
+std::streamsize MeteredFile::xsputn( const char* data_, std::streamsize len_ )
+{
+    // big data go directly
+    if ( len_ > epptr() - pptr() )
+    {
+        if ( sync() != 0 || !writeAll( data_, len_ ) )
+            return 0;
+
+        return len_;
+    }
+
+    memcpy( pptr(), data_, len_ );
+    pbump( len_ );
+
+    return len_;
+}
+
+int MeteredFile::sync()
+{
+    if ( pptr() == pbase() )
+        return 0;
+
+    const bool ok = writeAll( pbase(), pptr() - pbase() );
+    setp( buffer, buffer + sizeof( buffer ) );
+
+    return ok? 0: -1;
+}
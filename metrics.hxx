@@ -0,0 +1,149 @@
+/*
+ * Measure where the time goes.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#ifndef _METRICS_HXX_
+#define _METRICS_HXX_
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+
+#include <time.h>
+
+/** Time and byte counters for the phases of the conversion.
+
+    Every now and then (and at the end), a line 'METRICS {...}' with the
+    JSON of the counters is printed to stderr, so that a slow run can be
+    explained afterwards: the revisions per second, MB per second written to
+    each repository, the peak RSS, and the slowest revisions.
+*/
+namespace Metrics
+{
+    enum Phase {
+        PHASE_PATHS,    ///< Enumerating the changed paths (and the directories)
+        PHASE_PROPS,    ///< Reading the properties (revision and file ones)
+        PHASE_CONTENT,  ///< Reading the content of the files
+        PHASE_FILTER,   ///< Filter::addData() and Filter::count()
+        PHASE_ROUTING,  ///< Repositories::get()
+        PHASE_MESSAGES, ///< CommitMessages::convert()
+        PHASE_WRITE,    ///< Writing to the .dump files (incl. waiting for the reader of the fifo)
+        PHASE_COUNT
+    };
+
+    /// The counters of one output file.
+    struct Output
+    {
+        std::string name;
+        double seconds;
+        unsigned long long bytes;
+
+        /// Bytes at the time of the last report.
+        unsigned long long reported_bytes;
+
+        Output( const std::string& name_ ) : name( name_ ), seconds( 0 ), bytes( 0 ), reported_bytes( 0 ) {}
+    };
+
+    /// Current time in seconds (monotonic).
+    inline double now()
+    {
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    /// Print the line every interval_ seconds (0 means just at the end).
+    void setInterval( int interval_ );
+
+    /// Account time, calls and bytes to the phase.
+    void add( Phase phase_, double seconds_, unsigned long long bytes_ = 0 );
+
+    /// Counters for the output file; they live till the end.
+    Output* output( const std::string& name_ );
+
+    /// The revision is done; prints the line when it is time.
+    void revisionDone( long rev_ );
+
+    /// Print the final line.
+    void finish();
+
+    /// Measures the time of its scope.
+    ///
+    /// The Timers can nest (like writing the output directly from the
+    /// Filter), the time of the inner one is not accounted to the outer one.
+    class Timer
+    {
+        Phase phase;
+        double start;
+
+        /// Time of the nested Timers.
+        double nested;
+
+        unsigned long long bytes;
+
+        Timer* outer;
+
+    public:
+        Timer( Phase phase_, unsigned long long bytes_ = 0 );
+
+        ~Timer();
+
+        /// Bytes to account when the Timer ends.
+        void addBytes( unsigned long long bytes_ ) { bytes += bytes_; }
+
+    private:
+        Timer( const Timer& );
+        Timer& operator=( const Timer& );
+    };
+}
+
+/** Output file that counts the bytes and the time of writing.
+
+    Used instead of std::filebuf for the .dump files; the time includes
+    waiting when they are fifos and git fast-import does not read fast
+    enough.
+*/
+class MeteredFile : public std::streambuf
+{
+    int fd;
+
+    /// Do not write, just count.
+    bool discard;
+
+    char buffer[65536];
+
+    Metrics::Output* metrics;
+
+public:
+    /// Opens (creates) the file, the metrics are reported under name_.
+    ///
+    /// With an empty fname_, nothing is written, the bytes are just counted.
+    MeteredFile( const std::string& fname_, const std::string& name_ );
+
+    virtual ~MeteredFile();
+
+    bool isOpen() const { return fd >= 0; }
+
+    /// How much was written (or just counted) so far, without what is in the buffer.
+    unsigned long long bytes() const { return metrics->bytes; }
+
+protected:
+    virtual int overflow( int c_ );
+
+    virtual std::streamsize xsputn( const char* data_, std::streamsize len_ );
+
+    virtual int sync();
+
+private:
+    /// Write everything to the file.
+    bool writeAll( const char* data_, size_t len_ );
+
+    MeteredFile( const MeteredFile& );
+    MeteredFile& operator=( const MeteredFile& );
+};
+
+#endif // _METRICS_HXX_
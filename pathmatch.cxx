@@ -0,0 +1,901 @@
+/*
+ * Match the paths against a set of rules (POSIX extended regexes) at once.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "error.hxx"
+#include "interned.hxx"
+#include "pathmatch.hxx"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+    enum TokenType { ATOM, AT_START, AT_END, WORD_START, WORD_END };
+
+    struct Token
+    {
+        TokenType type;
+        bitset< 256 > chars;
+        bool star;
+
+        Token( TokenType type_ ) : type( type_ ), star( false ) {}
+    };
+
+    typedef vector< Token > Sequence;
+    typedef vector< Sequence > Alternatives;
+
+    /// Groups multiply the number of the branches; more than this is not worth it.
+    const size_t max_alternatives = 65536;
+
+    inline bool isWordChar( char c_ )
+    {
+        return ( c_ >= 'a' && c_ <= 'z' ) || ( c_ >= 'A' && c_ <= 'Z' ) || ( c_ >= '0' && c_ <= '9' ) || c_ == '_';
+    }
+
+    inline void seen( size_t& seen_, size_t pos_ )
+    {
+        if ( pos_ > seen_ )
+            seen_ = pos_;
+    }
+
+    void append( Alternatives& alternatives_, const Token& token_ )
+    {
+        for ( Alternatives::iterator it = alternatives_.begin(); it != alternatives_.end(); ++it )
+            it->push_back( token_ );
+    }
+
+    /// Parse the bracket expression starting after the '['.
+    bool parseBracket( const string& regex_, size_t& pos_, bitset< 256 >& chars_ )
+    {
+        bool negate = false;
+        if ( pos_ < regex_.length() && regex_[pos_] == '^' )
+        {
+            negate = true;
+            ++pos_;
+        }
+
+        bool first = true;
+        while ( pos_ < regex_.length() && ( first || regex_[pos_] != ']' ) )
+        {
+            unsigned char from = regex_[pos_];
+
+            // character classes, equivalence classes, collating symbols
+            if ( from == '[' && pos_ + 1 < regex_.length() &&
+                    ( regex_[pos_ + 1] == ':' || regex_[pos_ + 1] == '=' || regex_[pos_ + 1] == '.' ) )
+                return false;
+
+            unsigned char to = from;
+            if ( pos_ + 2 < regex_.length() && regex_[pos_ + 1] == '-' && regex_[pos_ + 2] != ']' )
+            {
+                to = regex_[pos_ + 2];
+                pos_ += 2;
+            }
+            ++pos_;
+
+            if ( to < from )
+                return false;
+
+            for ( unsigned int c = from; c <= to; ++c )
+                chars_.set( c );
+
+            first = false;
+        }
+
+        if ( pos_ >= regex_.length() )
+            return false;
+        ++pos_;
+
+        if ( negate )
+            chars_.flip();
+        chars_.reset( 0 );
+
+        return true;
+    }
+
+    /// Parse the regex into the alternatives that contain only the simple tokens.
+    ///
+    /// Returns false when there is something we do not handle.
+    bool parse( const string& regex_, size_t& pos_, Alternatives& result_, int depth_ )
+    {
+        Alternatives current( 1 );
+
+        while ( pos_ < regex_.length() )
+        {
+            char c = regex_[pos_];
+
+            if ( c == ')' )
+                break;
+
+            switch ( c )
+            {
+                case '|':
+                    result_.insert( result_.end(), current.begin(), current.end() );
+                    current = Alternatives( 1 );
+                    ++pos_;
+                    break;
+                case '(':
+                    {
+                        ++pos_;
+                        Alternatives group;
+                        if ( !parse( regex_, pos_, group, depth_ + 1 ) || pos_ >= regex_.length() )
+                            return false;
+                        ++pos_;
+
+                        if ( pos_ < regex_.length() && strchr( "*+?{", regex_[pos_] ) )
+                            return false;
+
+                        if ( current.size() * group.size() > max_alternatives )
+                            return false;
+
+                        Alternatives product;
+                        for ( Alternatives::const_iterator it = current.begin(); it != current.end(); ++it )
+                            for ( Alternatives::const_iterator jt = group.begin(); jt != group.end(); ++jt )
+                            {
+                                product.push_back( *it );
+                                product.back().insert( product.back().end(), jt->begin(), jt->end() );
+                            }
+
+                        current.swap( product );
+                    }
+                    break;
+                case '^':
+                    append( current, Token( AT_START ) );
+                    ++pos_;
+                    break;
+                case '$':
+                    append( current, Token( AT_END ) );
+                    ++pos_;
+                    break;
+                case '*':
+                    for ( Alternatives::iterator it = current.begin(); it != current.end(); ++it )
+                    {
+                        if ( it->empty() || it->back().type != ATOM || it->back().star )
+                            return false;
+                        it->back().star = true;
+                    }
+                    ++pos_;
+                    break;
+                case '+':
+                case '?':
+                case '{':
+                case '}':
+                    return false;
+                case '.':
+                    {
+                        Token token( ATOM );
+                        token.chars.set();
+                        token.chars.reset( 0 );
+                        append( current, token );
+                        ++pos_;
+                    }
+                    break;
+                case '[':
+                    {
+                        Token token( ATOM );
+                        ++pos_;
+                        if ( !parseBracket( regex_, pos_, token.chars ) )
+                            return false;
+                        append( current, token );
+                    }
+                    break;
+                case '\\':
+                    {
+                        if ( pos_ + 1 >= regex_.length() )
+                            return false;
+
+                        char escaped = regex_[pos_ + 1];
+                        if ( escaped == '<' )
+                            append( current, Token( WORD_START ) );
+                        else if ( escaped == '>' )
+                            append( current, Token( WORD_END ) );
+                        else if ( isWordChar( escaped ) )
+                            return false; // \w, \b, back-references, ...
+                        else
+                        {
+                            Token token( ATOM );
+                            token.chars.set( static_cast< unsigned char >( escaped ) );
+                            append( current, token );
+                        }
+                        pos_ += 2;
+                    }
+                    break;
+                default:
+                    {
+                        Token token( ATOM );
+                        token.chars.set( static_cast< unsigned char >( c ) );
+                        append( current, token );
+                        ++pos_;
+                    }
+                    break;
+            }
+        }
+
+        // unbalanced parens
+        if ( ( depth_ == 0 ) != ( pos_ >= regex_.length() ) )
+            return false;
+
+        result_.insert( result_.end(), current.begin(), current.end() );
+
+        return result_.size() <= max_alternatives;
+    }
+}
+
+PatternSet::PatternSet()
+    : prefixes( 1 ),
+      suffixes( 1 ),
+      rules( 0 ),
+      loaded( false ),
+      lookups( 0 ),
+      cache_hits( 0 ),
+      rechecks( 0 ),
+      regexecs( 0 )
+{
+}
+
+PatternSet::~PatternSet()
+{
+    clear();
+}
+
+void PatternSet::clear()
+{
+    for ( vector< Branch >::iterator it = branches.begin(); it != branches.end(); ++it )
+    {
+        if ( it->regex )
+        {
+            regfree( it->regex );
+            delete it->regex;
+        }
+    }
+
+    branches.clear();
+    prefixes.assign( 1, Node() );
+    suffixes.assign( 1, Node() );
+    rules = 0;
+    rules_ok.clear();
+    loaded = false;
+    decisions.clear();
+}
+
+bool PatternSet::add( const std::string& regex_ )
+{
+    if ( loaded )
+    {
+        if ( rules >= static_cast< int >( rules_ok.size() ) )
+        {
+            Error::report( "The compiled rules do not match the layout (rule " + regex_ + ")." );
+            return false;
+        }
+        return rules_ok[rules++];
+    }
+
+    const int rule = rules++;
+    decisions.clear();
+
+    Alternatives alternatives;
+    size_t pos = 0;
+    bool simple = parse( regex_, pos, alternatives, 0 );
+
+    vector< Branch > compiled;
+    for ( Alternatives::const_iterator it = alternatives.begin(); simple && it != alternatives.end(); ++it )
+    {
+        Branch branch;
+        branch.rule = rule;
+
+        // [^] [\<] atoms [\>] [$]
+        Sequence::const_iterator token = it->begin();
+        if ( token != it->end() && token->type == AT_START )
+        {
+            branch.at_start = true;
+            ++token;
+        }
+        if ( token != it->end() && token->type == WORD_START )
+        {
+            branch.word_start = true;
+            ++token;
+        }
+        for ( ; token != it->end() && token->type == ATOM; ++token )
+        {
+            Atom atom;
+            atom.chars = token->chars;
+            atom.star = token->star;
+            branch.atoms.push_back( atom );
+        }
+        if ( token != it->end() && token->type == WORD_END )
+        {
+            branch.word_end = true;
+            ++token;
+        }
+        if ( token != it->end() && token->type == AT_END )
+        {
+            branch.at_end = true;
+            ++token;
+        }
+
+        if ( token != it->end() )
+        {
+            simple = false;
+            break;
+        }
+
+        // 'x*' at the unanchored ends can match empty, so they do not matter
+        if ( !branch.word_end && !branch.at_end )
+            while ( !branch.atoms.empty() && branch.atoms.back().star )
+                branch.atoms.pop_back();
+        if ( !branch.at_start && !branch.word_start )
+            while ( !branch.atoms.empty() && branch.atoms.front().star )
+                branch.atoms.erase( branch.atoms.begin() );
+
+        compiled.push_back( branch );
+    }
+
+    if ( simple )
+    {
+        for ( vector< Branch >::const_iterator it = compiled.begin(); it != compiled.end(); ++it )
+            if ( !insert( *it ) )
+                branches.push_back( *it );
+
+        rules_ok.push_back( true );
+        return true;
+    }
+
+    // let the regex library handle it
+    Branch branch;
+    branch.rule = rule;
+    branch.source = regex_;
+    branch.regex = new regex_t;
+    if ( regcomp( branch.regex, regex_.c_str(), REG_EXTENDED | REG_NOSUB ) != 0 )
+    {
+        delete branch.regex;
+        rules_ok.push_back( false );
+        return false;
+    }
+
+    branches.push_back( branch );
+
+    rules_ok.push_back( true );
+    return true;
+}
+
+namespace
+{
+    template< class T >
+    void put( string& buffer_, const T& value_ )
+    {
+        buffer_.append( reinterpret_cast< const char* >( &value_ ), sizeof( value_ ) );
+    }
+
+    template< class T >
+    bool get( const char*& data_, const char* end_, T& value_ )
+    {
+        if ( end_ - data_ < static_cast< ptrdiff_t >( sizeof( value_ ) ) )
+            return false;
+
+        memcpy( &value_, data_, sizeof( value_ ) );
+        data_ += sizeof( value_ );
+
+        return true;
+    }
+
+    void putString( string& buffer_, const string& str_ )
+    {
+        put( buffer_, static_cast< unsigned int >( str_.length() ) );
+        buffer_.append( str_ );
+    }
+
+    bool getString( const char*& data_, const char* end_, string& str_ )
+    {
+        unsigned int length;
+        if ( !get( data_, end_, length ) || static_cast< size_t >( end_ - data_ ) < length )
+            return false;
+
+        str_.assign( data_, length );
+        data_ += length;
+
+        return true;
+    }
+
+    /// The tries are stored as: count, and for each node: any, rules, number of children, children.
+    template< class Nodes >
+    void putNodes( string& buffer_, const Nodes& nodes_ )
+    {
+        put( buffer_, static_cast< unsigned int >( nodes_.size() ) );
+        for ( typename Nodes::const_iterator it = nodes_.begin(); it != nodes_.end(); ++it )
+        {
+            put( buffer_, it->any );
+            put( buffer_, it->rules );
+            put( buffer_, static_cast< unsigned int >( it->children.size() ) );
+            for ( size_t i = 0; i < it->children.size(); ++i )
+            {
+                put( buffer_, it->children[i].first );
+                put( buffer_, it->children[i].second );
+            }
+        }
+    }
+
+    template< class Nodes >
+    bool getNodes( const char*& data_, const char* end_, Nodes& nodes_ )
+    {
+        unsigned int count;
+        if ( !get( data_, end_, count ) || count == 0 || count > static_cast< size_t >( end_ - data_ ) )
+            return false;
+
+        nodes_.resize( count );
+        for ( typename Nodes::iterator it = nodes_.begin(); it != nodes_.end(); ++it )
+        {
+            unsigned int children;
+            if ( !get( data_, end_, it->any ) || !get( data_, end_, it->rules ) || !get( data_, end_, children ) ||
+                    it->any >= count || children > static_cast< size_t >( end_ - data_ ) )
+                return false;
+
+            it->children.resize( children );
+            for ( size_t i = 0; i < children; ++i )
+                if ( !get( data_, end_, it->children[i].first ) || !get( data_, end_, it->children[i].second ) ||
+                        it->children[i].second >= count )
+                    return false;
+        }
+
+        return true;
+    }
+}
+
+void PatternSet::save( std::string& buffer_ ) const
+{
+    put( buffer_, rules );
+    for ( int i = 0; i < rules; ++i )
+        put( buffer_, static_cast< char >( rules_ok[i] ) );
+
+    putNodes( buffer_, prefixes );
+    putNodes( buffer_, suffixes );
+
+    put( buffer_, static_cast< unsigned int >( branches.size() ) );
+    for ( vector< Branch >::const_iterator it = branches.begin(); it != branches.end(); ++it )
+    {
+        put( buffer_, it->rule );
+
+        char flags = ( it->at_start? 1: 0 ) | ( it->word_start? 2: 0 ) | ( it->word_end? 4: 0 ) | ( it->at_end? 8: 0 ) | ( it->regex? 16: 0 );
+        put( buffer_, flags );
+
+        if ( it->regex )
+            putString( buffer_, it->source );
+        else
+        {
+            put( buffer_, static_cast< unsigned int >( it->atoms.size() ) );
+            for ( vector< Atom >::const_iterator atom = it->atoms.begin(); atom != it->atoms.end(); ++atom )
+            {
+                for ( int word = 0; word < 4; ++word )
+                {
+                    unsigned long long bits = 0;
+                    for ( int bit = 0; bit < 64; ++bit )
+                        if ( atom->chars[64 * word + bit] )
+                            bits |= 1ULL << bit;
+                    put( buffer_, bits );
+                }
+                put( buffer_, static_cast< char >( atom->star ) );
+            }
+        }
+    }
+}
+
+bool PatternSet::load( const char*& data_, const char* end_ )
+{
+    clear();
+
+    bool ok = get( data_, end_, rules ) && rules >= 0 && rules <= end_ - data_;
+    for ( int i = 0; ok && i < rules; ++i )
+    {
+        char rule_ok = 0;
+        ok = get( data_, end_, rule_ok );
+        rules_ok.push_back( rule_ok != 0 );
+    }
+
+    ok = ok && getNodes( data_, end_, prefixes ) && getNodes( data_, end_, suffixes );
+
+    unsigned int count = 0;
+    ok = ok && get( data_, end_, count ) && count <= static_cast< size_t >( end_ - data_ );
+    for ( unsigned int i = 0; ok && i < count; ++i )
+    {
+        Branch branch;
+        char flags = 0;
+        ok = get( data_, end_, branch.rule ) && get( data_, end_, flags );
+        if ( !ok )
+            break;
+
+        branch.at_start = flags & 1;
+        branch.word_start = flags & 2;
+        branch.word_end = flags & 4;
+        branch.at_end = flags & 8;
+
+        if ( flags & 16 )
+        {
+            ok = getString( data_, end_, branch.source );
+            if ( ok )
+            {
+                branch.regex = new regex_t;
+                if ( regcomp( branch.regex, branch.source.c_str(), REG_EXTENDED | REG_NOSUB ) != 0 )
+                {
+                    delete branch.regex;
+                    ok = false;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            unsigned int atoms = 0;
+            ok = get( data_, end_, atoms ) && atoms <= static_cast< size_t >( end_ - data_ );
+            for ( unsigned int j = 0; ok && j < atoms; ++j )
+            {
+                Atom atom;
+                for ( int word = 0; ok && word < 4; ++word )
+                {
+                    unsigned long long bits = 0;
+                    ok = get( data_, end_, bits );
+                    for ( int bit = 0; bit < 64; ++bit )
+                        atom.chars[64 * word + bit] = ( bits >> bit ) & 1;
+                }
+
+                char star = 0;
+                ok = ok && get( data_, end_, star );
+                atom.star = star;
+
+                if ( ok )
+                    branch.atoms.push_back( atom );
+            }
+        }
+
+        if ( ok )
+            branches.push_back( branch );
+    }
+
+    if ( !ok )
+    {
+        clear();
+        return false;
+    }
+
+    // the add()s that follow just confirm the rules
+    loaded = true;
+    rules = 0;
+
+    return true;
+}
+
+bool PatternSet::insert( const Branch& branch_ )
+{
+    if ( branch_.regex )
+        return false;
+
+    // only literal characters and '.'
+    bitset< 256 > any;
+    any.set();
+    any.reset( 0 );
+
+    for ( vector< Atom >::const_iterator it = branch_.atoms.begin(); it != branch_.atoms.end(); ++it )
+        if ( it->star || ( it->chars.count() != 1 && it->chars != any ) )
+            return false;
+
+    vector< Node >* trie;
+    Terminal terminal;
+    bool reverse;
+    if ( branch_.at_start && !branch_.word_start )
+    {
+        trie = &prefixes;
+        reverse = false;
+        if ( branch_.word_end )
+            terminal = branch_.at_end? ENDS_WORD_AT_END: ENDS_WORD;
+        else
+            terminal = branch_.at_end? ENDS_AT_END: ENDS_ANYHOW;
+    }
+    else if ( !branch_.at_start && branch_.at_end && !branch_.word_end )
+    {
+        trie = &suffixes;
+        reverse = true;
+        terminal = branch_.word_start? ENDS_WORD: ENDS_ANYHOW;
+    }
+    else
+        return false;
+
+    unsigned int node = 0;
+    for ( size_t i = 0; i < branch_.atoms.size(); ++i )
+    {
+        const Atom& atom = branch_.atoms[reverse? branch_.atoms.size() - 1 - i: i];
+
+        unsigned int child;
+        if ( atom.chars == any )
+        {
+            child = (*trie)[node].any;
+            if ( child == 0 )
+            {
+                child = trie->size();
+                (*trie)[node].any = child;
+                trie->push_back( Node() );
+            }
+        }
+        else
+        {
+            unsigned char c = 0;
+            while ( !atom.chars[c] )
+                ++c;
+
+            vector< pair< unsigned char, unsigned int > >& children = (*trie)[node].children;
+            vector< pair< unsigned char, unsigned int > >::iterator it =
+                lower_bound( children.begin(), children.end(), make_pair( c, 0u ) );
+
+            if ( it != children.end() && it->first == c )
+                child = it->second;
+            else
+            {
+                child = trie->size();
+                children.insert( it, make_pair( c, child ) );
+                trie->push_back( Node() );
+            }
+        }
+
+        node = child;
+    }
+
+    // the first rule wins
+    if ( (*trie)[node].rules[terminal] < 0 )
+        (*trie)[node].rules[terminal] = branch_.rule;
+
+    return true;
+}
+
+int PatternSet::find( std::string_view path_ )
+{
+    ++lookups;
+
+    int best = INT_MAX;
+    findPrefixes( 0, path_, 0, best );
+    findSuffixes( 0, path_, 0, best );
+
+    if ( !branches.empty() )
+    {
+        // paths with the same first component (including the '/' after it)
+        // share the decision
+        size_t slash = path_.find( '/' );
+        size_t known = ( slash == string_view::npos )? path_.length() + 1: slash + 1;
+
+        PathId id = Interned::pathComponent( path_.data(), min( slash, path_.length() ) );
+        size_t index = 2 * id + ( ( slash == string_view::npos )? 0: 1 );
+        if ( index >= decisions.size() )
+            decisions.resize( index + 1 );
+
+        Decision& decision = decisions[index];
+        if ( decision.known )
+            ++cache_hits;
+        else
+            decide( decision, path_, known );
+
+        for ( vector< unsigned int >::const_iterator it = decision.recheck.begin(); it != decision.recheck.end(); ++it )
+        {
+            const Branch& branch = branches[*it];
+            if ( branch.rule >= best )
+                break;
+
+            size_t dummy = 0;
+
+            ++rechecks;
+            if ( branch.regex )
+                ++regexecs;
+
+            if ( matches( branch, path_, dummy ) )
+            {
+                best = branch.rule;
+                break;
+            }
+        }
+
+        if ( decision.rule >= 0 && decision.rule < best )
+            best = decision.rule;
+    }
+
+    return ( best == INT_MAX )? -1: best;
+}
+
+void PatternSet::findPrefixes( unsigned int node_, std::string_view path_, size_t pos_, int& best_ ) const
+{
+    const Node& node = prefixes[node_];
+
+    bool word_before = ( pos_ > 0 && isWordChar( path_[pos_ - 1] ) );
+    bool word_after = ( pos_ < path_.length() && isWordChar( path_[pos_] ) );
+
+    int matched = node.rules[ENDS_ANYHOW];
+    if ( pos_ == path_.length() && node.rules[ENDS_AT_END] >= 0 && ( matched < 0 || node.rules[ENDS_AT_END] < matched ) )
+        matched = node.rules[ENDS_AT_END];
+    if ( word_before && !word_after && node.rules[ENDS_WORD] >= 0 && ( matched < 0 || node.rules[ENDS_WORD] < matched ) )
+        matched = node.rules[ENDS_WORD];
+    if ( word_before && pos_ == path_.length() && node.rules[ENDS_WORD_AT_END] >= 0 && ( matched < 0 || node.rules[ENDS_WORD_AT_END] < matched ) )
+        matched = node.rules[ENDS_WORD_AT_END];
+
+    if ( matched >= 0 && matched < best_ )
+        best_ = matched;
+
+    if ( pos_ >= path_.length() )
+        return;
+
+    const unsigned char c = path_[pos_];
+    vector< pair< unsigned char, unsigned int > >::const_iterator it =
+        lower_bound( node.children.begin(), node.children.end(), make_pair( c, 0u ) );
+
+    if ( it != node.children.end() && it->first == c )
+        findPrefixes( it->second, path_, pos_ + 1, best_ );
+
+    if ( node.any )
+        findPrefixes( node.any, path_, pos_ + 1, best_ );
+}
+
+void PatternSet::findSuffixes( unsigned int node_, std::string_view path_, size_t matched_, int& best_ ) const
+{
+    const Node& node = suffixes[node_];
+    const size_t start = path_.length() - matched_;
+
+    int matched = node.rules[ENDS_ANYHOW];
+    if ( node.rules[ENDS_WORD] >= 0 && ( matched < 0 || node.rules[ENDS_WORD] < matched ) &&
+            matched_ > 0 && isWordChar( path_[start] ) && ( start == 0 || !isWordChar( path_[start - 1] ) ) )
+        matched = node.rules[ENDS_WORD];
+
+    if ( matched >= 0 && matched < best_ )
+        best_ = matched;
+
+    if ( start == 0 )
+        return;
+
+    const unsigned char c = path_[start - 1];
+    vector< pair< unsigned char, unsigned int > >::const_iterator it =
+        lower_bound( node.children.begin(), node.children.end(), make_pair( c, 0u ) );
+
+    if ( it != node.children.end() && it->first == c )
+        findSuffixes( it->second, path_, matched_ + 1, best_ );
+
+    if ( node.any )
+        findSuffixes( node.any, path_, matched_ + 1, best_ );
+}
+
+void PatternSet::decide( Decision& decision_, std::string_view path_, size_t known_ )
+{
+    decision_.known = true;
+    decision_.rule = -1;
+    decision_.recheck.clear();
+
+    for ( unsigned int i = 0; i < branches.size(); ++i )
+    {
+        const Branch& branch = branches[i];
+
+        if ( branch.regex )
+        {
+            decision_.recheck.push_back( i );
+            continue;
+        }
+
+        size_t furthest = 0;
+        bool matched = matches( branch, path_, furthest );
+
+        // had to look behind the first component, depends on the entire path
+        if ( furthest >= known_ )
+            decision_.recheck.push_back( i );
+        else if ( matched )
+        {
+            decision_.rule = branch.rule;
+            return;
+        }
+    }
+}
+
+namespace
+{
+    /// Backtracking match of the atoms from 'atom_' at the position 'pos_'.
+    template< class Atoms >
+    bool matchAt( const Atoms& atoms_, size_t atom_, bool word_end_, bool at_end_,
+            std::string_view path_, size_t pos_, size_t& seen_ )
+    {
+        if ( atom_ == atoms_.size() )
+        {
+            if ( word_end_ )
+            {
+                seen( seen_, pos_ );
+                if ( pos_ == 0 || !isWordChar( path_[pos_ - 1] ) )
+                    return false;
+                if ( pos_ < path_.length() && isWordChar( path_[pos_] ) )
+                    return false;
+            }
+            if ( at_end_ )
+            {
+                seen( seen_, pos_ );
+                return pos_ == path_.length();
+            }
+            return true;
+        }
+
+        const auto& atom = atoms_[atom_];
+        if ( !atom.star )
+        {
+            seen( seen_, pos_ );
+            if ( pos_ < path_.length() && atom.chars[static_cast< unsigned char >( path_[pos_] )] )
+                return matchAt( atoms_, atom_ + 1, word_end_, at_end_, path_, pos_ + 1, seen_ );
+            return false;
+        }
+
+        // greedy, then backtrack
+        size_t end = pos_;
+        for ( ; ; ++end )
+        {
+            seen( seen_, end );
+            if ( end >= path_.length() || !atom.chars[static_cast< unsigned char >( path_[end] )] )
+                break;
+        }
+
+        for ( size_t i = end + 1; i > pos_; --i )
+            if ( matchAt( atoms_, atom_ + 1, word_end_, at_end_, path_, i - 1, seen_ ) )
+                return true;
+
+        return false;
+    }
+}
+
+bool PatternSet::matches( const Branch& branch_, std::string_view path_, size_t& seen_ )
+{
+    if ( branch_.regex )
+    {
+        seen( seen_, path_.length() );
+#ifdef REG_STARTEND
+        regmatch_t range;
+        range.rm_so = 0;
+        range.rm_eo = path_.length();
+
+        return ( regexec( branch_.regex, path_.data(), 1, &range, REG_STARTEND ) == 0 );
+#else
+        return ( regexec( branch_.regex, string( path_ ).c_str(), 0, NULL, 0 ) == 0 );
+#endif
+    }
+
+    // matches anything (like '.*')
+    if ( !branch_.at_start && !branch_.word_start && !branch_.word_end && !branch_.at_end && branch_.atoms.empty() )
+        return true;
+
+    size_t first = 0;
+    size_t last = 0;
+    if ( !branch_.at_start )
+    {
+        // where we can start depends on the length of the path
+        seen( seen_, path_.length() );
+        last = path_.length();
+
+        // fixed length suffix, like '\.sdf$'
+        bool fixed = true;
+        for ( vector< Atom >::const_iterator it = branch_.atoms.begin(); it != branch_.atoms.end(); ++it )
+            fixed = fixed && !it->star;
+
+        if ( branch_.at_end && fixed )
+        {
+            if ( path_.length() < branch_.atoms.size() )
+                return false;
+            first = last = path_.length() - branch_.atoms.size();
+        }
+    }
+
+    for ( size_t start = first; start <= last; ++start )
+    {
+        if ( branch_.word_start )
+        {
+            seen( seen_, start );
+            if ( start > 0 && isWordChar( path_[start - 1] ) )
+                continue;
+            if ( start >= path_.length() || !isWordChar( path_[start] ) )
+                continue;
+        }
+
+        if ( matchAt( branch_.atoms, 0, branch_.word_end, branch_.at_end, path_, start, seen_ ) )
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,193 @@
+/*
+ * Match the paths against a set of rules (POSIX extended regexes) at once.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#ifndef _PATHMATCH_HXX_
+#define _PATHMATCH_HXX_
+
+#include <bitset>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <regex.h>
+
+/** Ordered set of rules, the first one that matches wins.
+
+    The rules we use are mostly like '^(sc|scaddins|sccomp|chart2)\>' - a
+    list of the top-level directories - or huge lists of literal paths like
+    '^(sc/inc/foo.hxx|sw/source/bar.cxx)$', or lists of suffixes like
+    '\.(c|cxx|h|hxx)$'.  Such rules are compiled into simple branches
+    (sequences of characters), and the literal ones are stored in a prefix
+    and a suffix trie, so that all of them are checked in one walk over the
+    path.
+
+    For the remaining branches, the decision is remembered per first path
+    component, so that the next file from 'sc/' does not have to try them
+    at all.  Those that look further into the path (like '[^/]*\.mk$') are
+    re-checked for every path, and whatever we do not understand is left to
+    regexec().
+*/
+class PatternSet
+{
+    /// One character (or a set of them) of the branch, possibly repeated.
+    struct Atom
+    {
+        std::bitset< 256 > chars;
+        bool star;
+
+        Atom() : star( false ) {}
+    };
+
+    /// One alternative of a rule, like '^sc\>' from '^(sc|chart2)\>'.
+    struct Branch
+    {
+        /// Index of the rule this belongs to.
+        int rule;
+
+        /// Starts with '^'.
+        bool at_start;
+
+        /// Starts with '\<'.
+        bool word_start;
+
+        /// Ends with '\>'.
+        bool word_end;
+
+        /// Ends with '$'.
+        bool at_end;
+
+        std::vector< Atom > atoms;
+
+        /// Rule we could not compile, we use regexec() instead.
+        regex_t* regex;
+
+        /// The regex, when we need regexec().
+        std::string source;
+
+        Branch() : rule( 0 ), at_start( false ), word_start( false ), word_end( false ), at_end( false ), regex( NULL ) {}
+    };
+
+    /// Node of the trie of the literal branches.
+    struct Node
+    {
+        /// Children, sorted by the character.
+        std::vector< std::pair< unsigned char, unsigned int > > children;
+
+        /// Child for '.' (any character), 0 if none.
+        unsigned int any;
+
+        /// Rules that end here, -1 if none; indexed by the Terminal.
+        int rules[4];
+
+        Node() : any( 0 ) { rules[0] = rules[1] = rules[2] = rules[3] = -1; }
+    };
+
+    /// How the branch that ended in the node continues.
+    enum Terminal
+    {
+        ENDS_ANYHOW,        ///< no anchor, it is just a prefix (suffix)
+        ENDS_AT_END,        ///< '$' - prefixes only
+        ENDS_WORD,          ///< '\>' for the prefixes, '\<' for the suffixes
+        ENDS_WORD_AT_END,   ///< '\>$' - prefixes only
+    };
+
+    /// What we know about the paths with the same first component.
+    struct Decision
+    {
+        bool known;
+
+        /// The first rule that matched based on the first component, -1 if none.
+        int rule;
+
+        /// Branches (indexes to 'branches') that have to be checked for each path before 'rule'.
+        std::vector< unsigned int > recheck;
+
+        Decision() : known( false ), rule( -1 ) {}
+    };
+
+    /// The branches that are not in the tries, in the order of the rules.
+    std::vector< Branch > branches;
+
+    /// Trie of the anchored literal branches ('^foo/bar\>'), root is [0].
+    std::vector< Node > prefixes;
+
+    /// Trie of the reversed literal suffixes ('\.cxx$'), root is [0].
+    std::vector< Node > suffixes;
+
+    /// Number of the rules.
+    int rules;
+
+    /// Result of add() for each rule.
+    std::vector< bool > rules_ok;
+
+    /// The rules come from load(), add() just checks them.
+    bool loaded;
+
+    /// Decisions indexed by 2 * PathId of the first component (+ 1 when it is a directory).
+    std::vector< Decision > decisions;
+
+    /// Statistics.
+    unsigned long lookups, cache_hits, rechecks, regexecs;
+
+public:
+    PatternSet();
+
+    ~PatternSet();
+
+    /// Add a rule; returns false when the regex is invalid (the rule then never matches).
+    bool add( const std::string& regex_ );
+
+    /// Append the compiled rules to the buffer, so that load() can use them next time.
+    void save( std::string& buffer_ ) const;
+
+    /// Use the rules stored by save() (of the same add()s); false when the data are wrong.
+    ///
+    /// The add()s have to follow as usual, they just do not compile anything.
+    bool load( const char*& data_, const char* end_ );
+
+    /// Forget all the rules.
+    void clear();
+
+    /// Index of the first rule that matches the path, -1 if none.
+    int find( std::string_view path_ );
+
+    /// Number of the rules.
+    int size() const { return rules; }
+
+    /// How many times we were asked.
+    unsigned long lookupCount() const { return lookups; }
+
+    /// How many times we had the decision for the first path component already.
+    unsigned long cacheHits() const { return cache_hits; }
+
+    /// How many branches had to be checked against the entire path.
+    unsigned long recheckCount() const { return rechecks; }
+
+    /// How many of those needed regexec().
+    unsigned long regexecCount() const { return regexecs; }
+
+private:
+    /// Try the branch on the entire path; 'seen_' is updated to the furthest index we looked at.
+    bool matches( const Branch& branch_, std::string_view path_, size_t& seen_ );
+
+    /// Store the branch in one of the tries if possible.
+    bool insert( const Branch& branch_ );
+
+    /// Walk the prefix trie, update best_ with the rules that match.
+    void findPrefixes( unsigned int node_, std::string_view path_, size_t pos_, int& best_ ) const;
+
+    /// Walk the suffix trie (from the end of the path), update best_ with the rules that match.
+    void findSuffixes( unsigned int node_, std::string_view path_, size_t matched_, int& best_ ) const;
+
+    /// Decide which of the rules match based on the first path component only.
+    void decide( Decision& decision_, std::string_view path_, size_t known_ );
+
+    PatternSet( const PatternSet& );
+    PatternSet& operator=( const PatternSet& );
+};
+
+#endif // _PATHMATCH_HXX_
@@ -116,7 +116,7 @@ done
 sleep 60
 
 for I in `sed -e 's/^[#:].*//' -e 's/^ignore-.*//' -e 's/=.*//' -e 's/:.*//' "$LAYOUT" | grep -v '^$'` ; do
-    ( cd "$GIT_BASE/$I" ; echo `pwd` ; git branch | sed 's/^\*/ /' | grep 'tag-branches/' | xargs git branch -D )
+    ( cd "$GIT_BASE/$I" ; echo `pwd` ; git branch | sed 's/^\*/ /' | grep 'tag-branches/' | xargs -r git branch -D )
     rm $I.dump
 done
 
@@ -6,210 +6,160 @@
  * License: MIT <http://www.opensource.org/licenses/mit-license.php>
  */
 
+#include "arena.hxx"
 #include "committers.hxx"
 #include "error.hxx"
 #include "filter.hxx"
+#include "interned.hxx"
+#include "messages.hxx"
+#include "pathmatch.hxx"
 #include "repository.hxx"
+#include "trace.hxx"
 
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <deque>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <set>
 #include <sstream>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 
 typedef vector< Repository* > Repos;
-typedef set< string > Branches;
+typedef deque< BranchPoint > BranchPoints;
 typedef set< unsigned int > RevisionIgnore;
-typedef set< string > TagIgnore;
-typedef vector< string > BranchIds;
-typedef vector< Tag* > Tags;
+typedef set< string, less<> > TagIgnore;
 
 static Repos repos;
-static Branches branches;
+static PatternSet repos_patterns; // the same order as repos
+static BranchPoints all_branch_points;
+static vector< const BranchPoint* > branch_points; // indexed by BranchId, the most recent one
 static RevisionIgnore revision_ignore;
 static TagIgnore tag_ignore;
-static BranchIds branch_ids; // needed in addition to 'branches' because here we create the ids on demand
-static Tags tags;
 
-struct CommitMessages
-{
-    bool convert;
-    regex_t regex;
+/// Write nothing, just count (see Repositories::setDryRun()).
+static bool dry_run = false;
 
-    CommitMessages() : convert( false )
-    {
-        // Match a the 'header' of a ChangeLog entry, or a part starting with
-        // asterisk
-        regcomp( &regex, "^([0-9]{4}-[0-9][0-9]?-[0-9][0-9]? .*<.*@.*>|^[ \t]*\\*)", REG_EXTENDED | REG_NOSUB );
-    }
+/// Dry run: changes that ended in the last (fallback) repository, per directory.
+static map< string, unsigned long, less<> > fallback_dirs;
 
-    ~CommitMessages()
-    {
-        regfree( &regex );
-    }
+static void initializeBranch( const string& branch_, const BranchPoint& point_ )
+{
+    BranchId id = Interned::branch( branch_ );
+    if ( id >= branch_points.size() )
+        branch_points.resize( id + 1, NULL );
 
-    bool match( const string& message_ )
-    {
-        string first_line;
-        size_t eol = message_.find( '\n' );
+    all_branch_points.push_back( point_ );
+    all_branch_points.back().previous = branch_points[id];
 
-        if ( eol == string::npos )
-            first_line = message_;
-        else
-            first_line = message_.substr( 0, eol );
+    branch_points[id] = &all_branch_points.back();
+}
 
-        return ( regexec( &regex, first_line.c_str(), 0, NULL, 0 ) == 0 );
-    }
-};
+static bool isBranchInitialized( const string& branch_ )
+{
+    BranchId id = Interned::branch( branch_ );
+
+    return id < branch_points.size() && branch_points[id] != NULL;
+}
 
-static CommitMessages commit_messages;
+/// Identification of the layout cache file (and of its format).
+static const char layout_cache_magic[8] = { 'L', 'A', 'Y', 'O', 'U', 'T', 'C', '1' };
 
-static BranchId branchId( const string& branch_ )
+/// FNV-1a of the layout file, to know if the cache belongs to it.
+static unsigned long long layoutHash( const string& layout_ )
 {
-    BranchId id = 1;
-    BranchIds::const_iterator it = branch_ids.begin();
+    unsigned long long hash = 14695981039346656037ULL;
+    for ( string::const_iterator it = layout_.begin(); it != layout_.end(); ++it )
+    {
+        hash ^= static_cast< unsigned char >( *it );
+        hash *= 1099511628211ULL;
+    }
 
-    for ( ; ( it != branch_ids.end() ) && ( *it != branch_ ); ++it, ++id );
+    return hash;
+}
 
-    if ( it == branch_ids.end() )
-        branch_ids.push_back( branch_ );
+/// The compiled rules are cached in the current directory, next to the .dump files.
+static string layoutCacheName( const char* fname_ )
+{
+    const char* slash = strrchr( fname_, '/' );
 
-    return id;
+    return string( slash? slash + 1: fname_ ) + ".cache";
 }
 
-/** Eat whitespace to make the commit logs nicer.
-
-  @param empty_2nd_line Make the 2nd line empty, to satisfy git way of commit logs.
-*/
-static string eatWhitespace( const string& text_, bool uppercase_first_letter = false, bool eat_eol = false, bool empty_2nd_line = false )
+/// Use the compiled repository and filter rules from the cache, if it is for this layout.
+static bool loadLayoutCache( const string& cache_name_, const string& layout_ )
 {
-    char result[text_.length()];
-    char* it = result;
+    int fd = open( cache_name_.c_str(), O_RDONLY );
+    if ( fd < 0 )
+        return false;
 
-    bool eat = true;
-    bool first_eol = true;
-    bool first_letter = true;
-    bool first_letter_on_line = true;
-    int line_no = 0;
-    for ( string::const_iterator i = text_.begin(); i != text_.end(); ++i )
-    {
-        if ( *i == '\n' )
-        {
-            eat = true;
-            ++line_no;
-            first_letter_on_line = true;
-            if ( !first_eol && !eat_eol )
-                *it++ = *i;
-            else if ( !first_eol && eat_eol )
-                *it++ = ' ';
-        }
-        else if ( !eat || ( *i != ' ' && *i != '\t' ) )
-        {
-            eat = false;
-            first_eol = false;
+    struct stat st;
+    void* mapped = MAP_FAILED;
+    if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+        mapped = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
 
-            if ( empty_2nd_line && first_letter_on_line && ( line_no == 1 ) )
-                *it++ = '\n';
+    if ( mapped == MAP_FAILED )
+        return false;
 
-            first_letter_on_line = false;
+    const char* data = static_cast< const char* >( mapped );
+    const char* end = data + st.st_size;
 
-            if ( uppercase_first_letter && first_letter )
-            {
-                first_letter = false;
-                if ( *i >= 'a' && *i <= 'z' )
-                    *it++ = *i - ( 'a' - 'A' );
-                else
-                    *it++ = *i;
-            }
-            else
-                *it++ = *i;
-        }
+    unsigned long long hash, length;
+    bool result = ( end - data >= static_cast< ptrdiff_t >( sizeof( layout_cache_magic ) + sizeof( hash ) + sizeof( length ) ) );
+    if ( result )
+    {
+        memcpy( &hash, data + sizeof( layout_cache_magic ), sizeof( hash ) );
+        memcpy( &length, data + sizeof( layout_cache_magic ) + sizeof( hash ), sizeof( length ) );
+
+        result = memcmp( data, layout_cache_magic, sizeof( layout_cache_magic ) ) == 0 &&
+            hash == layoutHash( layout_ ) && length == layout_.length();
+        data += sizeof( layout_cache_magic ) + sizeof( hash ) + sizeof( length );
     }
 
-    return string( result, it - result );
-}
-
-static string commitMessage( const string& log_ )
-{
-    // nothing to do - not converting messages
-    if ( !commit_messages.convert )
-        return log_;
-
-    // HACK: kill an unusable commit message in AOOi repo - I'm too lazy to do
-    // a special configuration setting for this
-    const char really_broken_message[] = "119168 - updated LICENSE and NOTICE files for binary packag119168 - updated LICENSE and NOTICE files for binary packag119168";
-    const int really_broken_message_len = sizeof( really_broken_message ) - 1;
-    if ( log_.substr( 0, really_broken_message_len ) == really_broken_message )
-        return "119168 - updated LICENSE file and NOTICE file for binary package";
-
-    // It's not a ChangeLog-like entry, do just some cosmetic changes.
-    if ( !commit_messages.match( log_ ) )
-        return eatWhitespace( log_, false, false, true );
-
-    // It's a ChangeLog-like entry, try to find a sentence and use it as the
-    // first line description of the commit, eg.
-    // from
-    // |2008-02-12  The Name  <the@address.com>
-    // |
-    // |        * some/file.txt: Changed this to that.
-    // |        * some/other/file.txt: The same here.
-    // to
-    // |Changed this to that.
-    // |
-    // |* some/file.txt: Changed this to that.
-    // |* some/other/file.txt: The same here.
-    size_t start_line = 0;
-    if ( log_[0] >= '0' && log_[0] <= '9' )
+    result = result && repos_patterns.load( data, end ) && Filter::patterns().load( data, end ) && data == end;
+    if ( !result )
     {
-        // Let's skip the first line if it contains just the date & committer.
-        start_line = log_.find( '\n' );
-        if ( start_line == string::npos )
-            return eatWhitespace( log_ );
+        repos_patterns.clear();
+        Filter::patterns().clear();
     }
 
-    ++start_line;
-    size_t text = log_.find_first_of( "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", start_line );
-    size_t asterisk = log_.find( '*', start_line );
-
-    if ( text == string::npos )
-        return eatWhitespace( log_ );
+    munmap( mapped, st.st_size );
 
-    if ( asterisk == string::npos )
-        return eatWhitespace( log_.substr( start_line ) );
+    return result;
+}
 
-    if ( asterisk < text )
-    {
-        text = asterisk + 1;
-        do {
-            text = log_.find( ":", text );
-            if ( text == string::npos )
-                return eatWhitespace( log_ );
-
-            ++text;
-        } while ( text < log_.length() && log_[text] == '\n' );
-        
-        if ( text >= log_.length() )
-            return eatWhitespace( log_ );
-    }
+/// Store the compiled rules for the next run; it is just a cache, so failing is OK.
+static void saveLayoutCache( const string& cache_name_, const string& layout_ )
+{
+    string buffer( layout_cache_magic, sizeof( layout_cache_magic ) );
 
-    size_t fullstop = log_.find_first_of( "*.", text );
-    if ( fullstop != string::npos && log_[fullstop] == '*' )
-        fullstop = log_.find_last_not_of( "* \t", fullstop );
+    unsigned long long hash = layoutHash( layout_ );
+    unsigned long long length = layout_.length();
+    buffer.append( reinterpret_cast< const char* >( &hash ), sizeof( hash ) );
+    buffer.append( reinterpret_cast< const char* >( &length ), sizeof( length ) );
 
-    string description;
-    if ( fullstop == string::npos )
-        description = eatWhitespace( log_.substr( text ), true, true );
-    else
-        description = eatWhitespace( log_.substr( text, fullstop - text + 1 ), true, true );
+    repos_patterns.save( buffer );
+    Filter::patterns().save( buffer );
 
-    if ( description.length() > 0 )
-        return description + "\n\n" + eatWhitespace( log_.substr( start_line ) );
+    // write it as a whole, so that nobody sees a half-written cache
+    string tmp_name = cache_name_ + ".tmp";
+    ofstream out( tmp_name.c_str(), ios::binary | ios::trunc );
+    out.write( buffer.data(), buffer.length() );
+    out.close();
 
-    return eatWhitespace( log_.substr( start_line ) );
+    if ( !out || rename( tmp_name.c_str(), cache_name_.c_str() ) != 0 )
+        unlink( tmp_name.c_str() );
 }
 
 Time::Time( double time_, int timezone_ )
@@ -217,198 +167,330 @@ Time::Time( double time_, int timezone_ )
 {
 }
 
-Tag::Tag( const Committer& committer_, const std::string& name_, Time time_, const std::string& log_ )
-    : name( name_ ), tag_branch( name_ ), committer( committer_ ), time( time_ ), log( commitMessage( log_ ) )
-{
-    const size_t tag_branches_len = strlen( TAG_TEMP_BRANCH );
-    if ( name.compare( 0, tag_branches_len, TAG_TEMP_BRANCH ) == 0 )
-        name = name.substr( tag_branches_len );
-    else
-        Error::report( "Cannot guess the branch name for '" + name_ + "'" );
-}
-
-Repository::Repository( const std::string& reponame_, const string& regex_, unsigned int max_revs_, bool cleanup_first_ )
+Repository::Repository( const std::string& reponame_, bool cleanup_first_ )
     : mark( 1 ),
-      out( ( reponame_ + ".dump" ).c_str() ),
-      commits( new BranchId[max_revs_ + 10] ),
-      parents( new string[max_revs_ + 10] ),
-      max_revs( max_revs_ ),
+      file( dry_run? string(): reponame_ + ".dump", reponame_ ),
+      out( &file ),
+      index( Revisions::addRepository() ),
       name( reponame_ ),
-      cleanup_first( cleanup_first_ )
+      cleanup_first( cleanup_first_ ),
+      commits( 0 ),
+      tags( 0 ),
+      files( 0 ),
+      estimated_bytes( 0 )
 {
-    int status = regcomp( &regex_rule, regex_.c_str(), REG_EXTENDED | REG_NOSUB );
-    if ( status != 0 )
-        Error::report( "Cannot create regex '" + regex_ + "'" );
-
-    memset( commits, 0, ( max_revs_ + 10 ) * sizeof( BranchId ) );
 }
 
 Repository::~Repository()
 {
-    regfree( &regex_rule );
-    delete[] commits;
-    delete[] parents;
-    out.close();
+    out.flush();
 }
 
-bool Repository::matches( const std::string& fname_ ) const
+void Repository::deleteFile( std::string_view fname_ )
 {
-    return ( regexec( &regex_rule, fname_.c_str(), 0, NULL, 0 ) == 0 );
-}
+    Arena& arena = Arena::revision();
 
-void Repository::deleteFile( const std::string& fname_ )
-{
-    file_changes.append( "D " );
-    file_changes.append( fname_ );
-    file_changes.append( "\n" );
+    file_changes.push_back( arena.concat( "D ", fname_, "\n" ) );
 }
 
-ostream& Repository::modifyFile( const std::string& fname_, const char* mode_ )
+ostream& Repository::modifyFile( std::string_view fname_, const char* mode_ )
 {
-    ostringstream sstr;
+    Arena& arena = Arena::revision();
+    const size_t mode_len = strlen( mode_ );
+
+    // M <mode> :<mark> <fname>\n
+    char* begin = arena.begin( 2 + mode_len + 2 + 20 + 1 + fname_.length() + 1 );
+    char* it = begin;
+
+    it = appendString( it, "M " );
+    it = appendString( it, string_view( mode_, mode_len ) );
+    it = appendString( it, " :" );
+    it = appendNumber( it, mark );
+    *it++ = ' ';
+    it = appendString( it, fname_ );
+    *it++ = '\n';
 
-    sstr << "M " << mode_ << " :" << mark << " " << fname_ << "\n";
-    
-    file_changes.append( sstr.str() );
+    file_changes.push_back( arena.end( begin, it ) );
 
     // write the file header
-    out << "blob" << endl
-        << "mark :" << mark << endl;
+    char header[32] = "blob\nmark :";
+    it = appendNumber( header + 11, mark );
+    *it++ = '\n';
+    out.write( header, it - header );
 
     ++mark;
+    ++files;
 
     return out;
 }
 
-void Repository::commit( const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_, const std::vector< int >& merges_, bool force_ )
+void Repository::estimateFile( std::string_view fname_, const char* mode_, size_t length_ )
 {
-    if ( force_ || !file_changes.empty() )
-    {
-        out << "commit refs/heads/" << name_ << "\n";
-
-        if ( commit_id_ )
-            out << "mark :" << ( 100000 + commit_id_ ) << "\n";
+    modifyFile( fname_, mode_ ) << "data " << length_ << "\n";
 
-        string log( commitMessage( log_ ) );
-
-        out << "committer " << committer_.name << " <" << committer_.email << "> " << time_ << "\n"
-            << "data " << log.length() << "\n"
-            << log << "\n";
-
-        // from & merges
-        bool first = true;
-        for ( vector< int >::const_iterator it = merges_.begin(); it != merges_.end(); ++it )
-        {
-            if ( !parents[(*it)].empty() )
-            {
-                out << ( first? "from ": "merge " ) << parents[(*it)] << "\n";
-                first = false;
-            }
-        }
+    estimated_bytes += length_;
+}
 
-        if ( cleanup_first )
-        {
-            out << "deleteall" << endl;
-            cleanup_first = false;
-        }
+void Repository::printEstimate()
+{
+    out.flush();
 
-        out << file_changes
-            << endl;
+    fprintf( stderr, "%-24s %8lu commits %6ld branches %6lu tags %9lu files %10.1f MB\n",
+            name.c_str(), commits, static_cast< long >( count( committed_branches.begin(), committed_branches.end(), true ) ),
+            tags, files, ( file.bytes() + estimated_bytes ) / ( 1024.0 * 1024.0 ) );
+}
 
-        commits[commit_id_] = branchId( name_ );
+void Repository::commit( const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_, const std::vector< int >& merges_ )
+{
+    if ( !file_changes.empty() )
+    {
+        Trace::Span span( "Repository::commit", std::string_view(), name );
 
-        ostringstream sstr;
-        sstr << ":" << ( 100000 + commit_id_ );
+        const BranchId branch = Interned::branch( name_ );
 
-        parents[commit_id_] = sstr.str();
-    }
-    else
-    {
-        // try to setup a parent chain (if we don't succeed, we have to
-        // completely initialize the missing pieces - more work)
-        if ( merges_.size() > 0 && !parents[merges_[0]].empty() )
-            parents[commit_id_] = parents[merges_[0]];
+        const bool created = writeBranch( branch, name_ );
+        writeCommit( committer_, name_, branch, commit_id_, time_, log_, merges_, file_changes, created? COMMIT_AFTER_CREATION: COMMIT_NORMAL );
     }
 
     file_changes.clear();
     mark = 1;
 }
 
-void Repository::createBranch( unsigned int from_, const std::string& from_branch_,
-        const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_ )
+bool Repository::writeBranch( BranchId branch_, const std::string& name_ )
 {
-    unsigned int from = findCommit( from_, from_branch_ );
+    const BranchPoint* point = Repositories::branchPoint( branch_ );
+    if ( !point || point->created == 0 )
+        return false;
+
+    if ( branch_ >= written_branches.size() )
+        written_branches.resize( branch_ + 1, 0 );
+    else if ( written_branches[branch_] == point->created )
+        return false;
+
+    written_branches[branch_] = point->created;
+
+    unsigned int from = findCommit( point->from, point->from_branch );
     if ( from == 0 )
-        return;
+        return false;
 
     out << "reset refs/heads/" << name_ << "\nfrom :" << 100000 + from << "\n" << endl;
 
-    commit( committer_, name_, commit_id_, time_, log_, vector< int >(), true );
+    // the tags do not have any creation commit
+    if ( point->is_tag )
+        return false;
+
+    // findCommit() resolves the branch to what it was created from until
+    // the first real commit to it
+    writeCommit( *point->committer, name_, branch_, point->created, point->time, point->log, vector< int >(), vector< string_view >(), COMMIT_CREATION );
+
+    return true;
 }
 
-void Repository::createTag( const Tag& tag_ )
+void Repository::writeCommit( const Committer& committer_, const std::string& name_, BranchId branch_, unsigned int commit_id_, Time time_, const std::string& log_,
+        const std::vector< int >& merges_, const std::vector< std::string_view >& changes_, CommitKind kind_ )
 {
-    unsigned int from = findCommit( max_revs, tag_.tag_branch );
+    out << "commit refs/heads/" << name_ << "\n";
+
+    if ( commit_id_ && kind_ != COMMIT_CREATION )
+    {
+        char mark_line[32] = "mark :";
+        char* it = appendNumber( mark_line + 6, 100000 + commit_id_ );
+        *it++ = '\n';
+        out.write( mark_line, it - mark_line );
+    }
+
+    out << committer_.committer_prefix << time_ << "\n"
+        << "data " << log_.length() << "\n"
+        << log_ << "\n";
+
+    // from & merges; without 'from', fast-import uses the tip of the branch
+    bool first = ( kind_ != COMMIT_AFTER_CREATION );
+    vector< int >::const_iterator it = merges_.begin();
+    if ( kind_ == COMMIT_AFTER_CREATION && it != merges_.end() )
+        ++it;
+    for ( ; it != merges_.end(); ++it )
+    {
+        if ( writeParent( first? "from ": "merge ", *it ) )
+            first = false;
+    }
+
+    if ( cleanup_first )
+    {
+        out << "deleteall" << endl;
+        cleanup_first = false;
+    }
+
+    for ( vector< string_view >::const_iterator it = changes_.begin(); it != changes_.end(); ++it )
+        out.write( it->data(), it->length() );
+
+    out << endl;
+
+    ++commits;
+    if ( branch_ >= committed_branches.size() )
+        committed_branches.resize( branch_ + 1, false );
+    committed_branches[branch_] = true;
+
+    if ( kind_ != COMMIT_CREATION )
+        Revisions::setCommitted( commit_id_, index, branch_ );
+}
+
+void Repository::createTag( BranchId tag_branch_, const BranchPoint& point_ )
+{
+    // the last commit to the tag, or what it was copied from
+    unsigned int from = findCommit( Revisions::last(), tag_branch_ );
     if ( from == 0 )
         return;
 
-    createTag( tag_.name, from, false, tag_.committer, tag_.time, tag_.log );
+    const string& tag_branch = Interned::branchName( tag_branch_ );
+    const size_t tag_branches_len = strlen( TAG_TEMP_BRANCH );
+
+    string name( tag_branch );
+    if ( name.compare( 0, tag_branches_len, TAG_TEMP_BRANCH ) == 0 )
+        name = name.substr( tag_branches_len );
+
+    createTag( name, from, false, *point_.committer, point_.time, point_.log );
 }
 
 void Repository::createTag( const std::string& name_, int rev_, bool lookup_in_parents_,
         const Committer& committer_, Time time_, const std::string& log_ )
 {
-    string from;
+    unsigned int from_mark = 100000 + rev_;
+    const string* from_commit = NULL;
     if ( lookup_in_parents_ )
     {
-        if ( written_tags[name_] != rev_ )
-        {
-            from = parents[rev_];
-            written_tags[name_] = rev_;
-        }
-    }
-    else
-    {
-        ostringstream ostr;
-        ostr << ':' << rev_;
-        from = ostr.str();
+        if ( written_tags[name_] == rev_ )
+            return;
+
+        written_tags[name_] = rev_;
+        if ( !Revisions::findParent( rev_, index, from_mark, from_commit ) )
+            return;
     }
 
-    if ( from.empty() || from == "ignore" )
+    if ( from_commit && *from_commit == "ignore" )
         return;
 
     out << "tag " << name_
-        << "\nfrom " << from
-        << "\ntagger " << committer_.name << " <" << committer_.email << "> " << time_
+        << "\nfrom ";
+
+    if ( from_commit )
+        out << *from_commit;
+    else
+        out << ':' << from_mark;
+
+    out << "\n" << committer_.tagger_prefix << time_
         << "\ndata " << log_.length() << "\n"
         << log_
         << endl;
+
+    ++tags;
 }
 
 void Repository::mapCommit( int rev_, const std::string& git_commit_ )
 {
-    parents[rev_] = git_commit_;
+    Revisions::mapCommit( rev_, index, git_commit_ );
+}
+
+void Repository::resetBranch( const std::string& name_, int rev_ )
+{
+    unsigned int mark;
+    const string* commit;
+
+    if ( !Revisions::findParent( rev_, index, mark, commit ) )
+        return;
+
+    if ( commit && *commit == "ignore" )
+        return;
+
+    out << "reset refs/heads/" << name_ << "\nfrom ";
+    if ( commit )
+        out << *commit;
+    else
+        out << ':' << mark;
+    out << "\n" << endl;
 }
 
 bool Repository::hasParent( int parent_ )
 {
-    return !parents[parent_].empty();
+    unsigned int mark;
+    const string* commit;
+
+    return Revisions::findParent( parent_, index, mark, commit );
 }
 
-unsigned int Repository::findCommit( unsigned int from_, const std::string& from_branch_ )
+unsigned int Repository::findCommit( unsigned int from_, BranchId from_branch_ )
 {
-    BranchId branch_id = branchId( from_branch_ );
-    unsigned int commit_no = from_;
-    
-    while ( commit_no > 0 && commits[commit_no] != branch_id )
-        --commit_no;
+    unsigned int commit = Revisions::findCommit( from_, index, from_branch_ );
+
+    // the branch as it was at from_
+    const BranchPoint* point = Repositories::branchPoint( from_branch_ );
+    while ( point && point->created > from_ )
+        point = point->previous;
 
-    return commit_no;
+    // no commits to the branch since it was (re-)created, so it is still
+    // what it was created from; the creation revision is always newer than
+    // what it was created from, so this ends
+    if ( point && point->created != 0 && commit < point->created && point->from < point->created )
+        commit = findCommit( point->from, point->from_branch );
+
+    return commit;
 }
 
-bool Repositories::load( const char* fname_, unsigned int max_revs_, int& min_rev_, std::string& trunk_base_, std::string& trunk_, std::string& branches_, std::string& tags_ )
+bool Repository::writeParent( const char* command_, unsigned int rev_ )
 {
-    ifstream input( fname_, ifstream::in );
+    unsigned int mark;
+    const string* commit;
+
+    if ( !Revisions::findParent( rev_, index, mark, commit ) )
+        return false;
+
+    out << command_;
+    if ( commit )
+        out << *commit;
+    else
+        out << ':' << mark;
+    out << "\n";
+
+    return true;
+}
+
+void Repositories::setDryRun()
+{
+    dry_run = true;
+}
+
+/// What the dry run found out.
+static void printDryRun()
+{
+    fprintf( stderr, "\nDry run (the sizes are before filtering):\n" );
+    for ( Repos::iterator it = repos.begin(); it != repos.end(); ++it )
+        (*it)->printEstimate();
+
+    if ( fallback_dirs.empty() )
+        return;
+
+    vector< pair< unsigned long, string > > sorted;
+    for ( map< string, unsigned long, less<> >::const_iterator it = fallback_dirs.begin(); it != fallback_dirs.end(); ++it )
+        sorted.push_back( make_pair( it->second, it->first ) );
+    sort( sorted.begin(), sorted.end(), greater< pair< unsigned long, string > >() );
+
+    fprintf( stderr, "\nChanges that ended in the fallback repository '%s', per directory (%lu directories):\n",
+            repos.back()->getName().c_str(), static_cast< unsigned long >( sorted.size() ) );
+    for ( size_t i = 0; i < sorted.size() && i < 50; ++i )
+        fprintf( stderr, "%10lu  %s\n", sorted[i].first, sorted[i].second.empty()? "(top-level files)": sorted[i].second.c_str() );
+}
+
+bool Repositories::load( const char* fname_, int& min_rev_, std::string& trunk_base_, std::string& trunk_, std::string& branches_, std::string& tags_ )
+{
+    ifstream file( fname_, ifstream::in );
+    ostringstream content;
+    content << file.rdbuf();
+    const string layout( content.str() );
+
+    // the regexes take long to compile, use the result of the last time if possible
+    const string cache_name( layoutCacheName( fname_ ) );
+    const bool cached = loadLayoutCache( cache_name, layout );
+
+    istringstream input( layout );
     string line;
     bool sets_min_rev = false;
     bool cleanup_first = false;
@@ -545,7 +627,7 @@ bool Repositories::load( const char* fname_, unsigned int max_revs_, int& min_re
                 }
                 else if ( line.substr( arg, equals - arg ) == "convert_commit_messages" )
                 {
-                    commit_messages.convert = true;
+                    CommitMessages::setConvert( true );
                 }
                 else if ( equals != string::npos && line.substr( arg, equals - arg ) == "trunk" )
                 {
@@ -680,59 +762,91 @@ bool Repositories::load( const char* fname_, unsigned int max_revs_, int& min_re
             continue;
         }
 
-        Repository* rep = new Repository( line.substr( 0, min( equal, colon ) ), line.substr( equal + 1 ), max_revs_, cleanup_first );
+        Repository* rep = new Repository( line.substr( 0, min( equal, colon ) ), cleanup_first );
         if ( sets_min_rev )
             rep->mapCommit( min_rev_, line.substr( colon + 1, equal - colon - 1 ) );
 
         repos.push_back( rep );
+        if ( !repos_patterns.add( line.substr( equal + 1 ) ) )
+            Error::report( "Cannot create regex '" + line.substr( equal + 1 ) + "'" );
 
         result = true;
     }
 
-    branches.insert( "master" );
+    if ( !cached )
+        saveLayoutCache( cache_name, layout );
+
+    initializeBranch( "master", BranchPoint() );
 
     return result;
 }
 
 void Repositories::close()
 {
-    // write tags for all the 'tag tracking' branches
+    // write the tags; we know only now which of them were committed to
     for ( Repos::iterator it = repos.begin(); it != repos.end(); ++it )
-        for ( Tags::const_iterator tag = tags.begin(); tag != tags.end(); ++tag )
-            (*it)->createTag( *(*tag) );
+        for ( BranchId id = 0; id < branch_points.size(); ++id )
+            if ( branch_points[id] && branch_points[id]->is_tag )
+                (*it)->createTag( id, *branch_points[id] );
+
+    if ( repos_patterns.lookupCount() > 0 )
+        fprintf( stderr, "Paths routed: %lu, decided by the first component: %lu (%.1f%%), rechecked: %lu, regexec(): %lu\n",
+                repos_patterns.lookupCount(), repos_patterns.cacheHits(),
+                100.0 * repos_patterns.cacheHits() / repos_patterns.lookupCount(),
+                repos_patterns.recheckCount(), repos_patterns.regexecCount() );
+
+    Filter::printStats();
+
+    if ( dry_run )
+        printDryRun();
 
     while ( !repos.empty() )
     {
         delete repos.back();
         repos.pop_back();
     }
-    
-    while ( !tags.empty() )
-    {
-        delete tags.back();
-        tags.pop_back();
-    }
+
+    branch_points.clear();
+    all_branch_points.clear();
 }
 
-Repository& Repositories::get( const std::string& fname_ )
+Repository& Repositories::get( std::string_view fname_ )
 {
-    Repository* repo = repos.front();
-    for ( Repos::const_iterator it = repos.begin(); it != repos.end(); ++it )
+    Metrics::Timer timer( Metrics::PHASE_ROUTING );
+
+    int index = repos_patterns.find( fname_ );
+
+    // what was not split anywhere (by the top 2 levels of directories)
+    if ( dry_run && ( index < 0 || index + 1 == static_cast< int >( repos.size() ) ) )
     {
-        repo = (*it);
-        if ( repo->matches( fname_ ) )
-            break;
+        size_t slash = fname_.find( '/' );
+        if ( slash != string_view::npos )
+            slash = fname_.find( '/', slash + 1 );
+        const string_view dir = ( slash == string_view::npos )? fname_.substr( 0, fname_.rfind( '/' ) + 1 ): fname_.substr( 0, slash + 1 );
+
+        map< string, unsigned long, less<> >::iterator it = fallback_dirs.find( dir );
+        if ( it == fallback_dirs.end() )
+            fallback_dirs.insert( make_pair( string( dir ), 1 ) );
+        else
+            ++it->second;
     }
 
     // the last one is the fallback
-    return *repo;
+    if ( index < 0 )
+        return *repos.back();
+
+    return *repos[index];
 }
 
 void Repositories::commit( const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_, const std::vector< int >& merges_ )
 {
-    if ( branches.find( name_ ) == branches.end() )
+    if ( !isBranchInitialized( name_ ) )
         Error::report( "Committing to a branch that hasn't been initialized using Repositories::createBranchOrTag()!" );
 
+    // repositories without changes follow the first parent
+    if ( !merges_.empty() )
+        Revisions::setFirstParent( commit_id_, merges_[0] );
+
     for ( Repos::iterator it = repos.begin(); it != repos.end(); ++it )
         (*it)->commit( committer_, name_, commit_id_, time_, log_, merges_ );
 }
@@ -740,13 +854,35 @@ void Repositories::commit( const Committer& committer_, const std::string& name_
 void Repositories::createBranchOrTag( bool is_branch_, unsigned int from_, const std::string& from_branch_,
         const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_ )
 {
-    for ( Repos::iterator it = repos.begin(); it != repos.end(); ++it )
-        (*it)->createBranch( from_, from_branch_, committer_, name_, commit_id_, time_, log_ );
+    if ( !is_branch_ && name_.compare( 0, strlen( TAG_TEMP_BRANCH ), TAG_TEMP_BRANCH ) != 0 )
+        Error::report( "Cannot guess the branch name for '" + name_ + "'" );
 
-    branches.insert( name_ );
+    // the repositories write the branch when they commit to it for the first
+    // time; a tag without commits points directly to what it was copied from
+    // (a re-created tag is written just once, git fast-import does not like
+    // the same tag twice)
+    BranchPoint point;
+    point.is_tag = !is_branch_;
+    point.created = commit_id_;
+    point.from = from_;
+    point.from_branch = Interned::branch( from_branch_ );
+    point.committer = &committer_;
+    point.time = time_;
+    point.log = log_;
+
+    initializeBranch( name_, point );
+
+    // nothing was committed in this revision, let the next ones see through it
+    if ( commit_id_ > 1 )
+        Revisions::setFirstParent( commit_id_, commit_id_ - 1 );
+}
+
+const BranchPoint* Repositories::branchPoint( BranchId branch_ )
+{
+    if ( branch_ >= branch_points.size() )
+        return NULL;
 
-    if ( !is_branch_ )
-        tags.push_back( new Tag( committer_, name_, time_, log_ ) );
+    return branch_points[branch_];
 }
 
 void Repositories::updateMercurialTag( const std::string& name_, int rev_,
@@ -759,6 +895,15 @@ void Repositories::updateMercurialTag( const std::string& name_, int rev_,
         (*it)->createTag( name_, rev_, true, committer_, time_, log_ );
 }
 
+void Repositories::resetBranch( const std::string& name_, int rev_ )
+{
+    if ( rev_ < 0 )
+        return;
+
+    for ( Repos::iterator it = repos.begin(); it != repos.end(); ++it )
+        (*it)->resetBranch( name_, rev_ );
+}
+
 bool Repositories::ignoreRevision( unsigned int commit_id_ )
 {
     RevisionIgnore::const_iterator it = revision_ignore.find( commit_id_ );
@@ -766,7 +911,7 @@ bool Repositories::ignoreRevision( unsigned int commit_id_ )
     return ( it != revision_ignore.end() );
 }
 
-bool Repositories::ignoreTag( const string& name_ )
+bool Repositories::ignoreTag( std::string_view name_ )
 {
     TagIgnore::const_iterator it = tag_ignore.find( name_ );
 
@@ -9,11 +9,14 @@
 #ifndef _REPOSITORY_HXX_
 #define _REPOSITORY_HXX_
 
+#include <map>
 #include <string>
-#include <fstream>
+#include <string_view>
+#include <ostream>
 #include <vector>
 
-#include <regex.h>
+#include "metrics.hxx"
+#include "revisions.hxx"
 
 #define TAG_TEMP_BRANCH "tag-branches/"
 
@@ -32,58 +35,70 @@ struct Time
     Time( double time_, int timezone_ = 0 );
 };
 
-struct Tag
+/** Where a branch (or a tag) was created from.
+
+    The branches are written to a repository only when somebody commits to
+    them there; most of the branches touch just some of the repositories.
+*/
+struct BranchPoint
 {
-    /// Name of the tag.
-    std::string name;
+    /// Tags do not get the creation commit, and are written at the end.
+    bool is_tag;
+
+    /// Revision that created the branch, 0 for master.
+    unsigned int created;
 
-    /// Name of the branch that tracks commits to /tags/branch/
-    std::string tag_branch;
+    /// Revision it was copied from.
+    unsigned int from;
+
+    /// Branch it was copied from.
+    BranchId from_branch;
 
     /// Committer.
-    const Committer& committer;
+    const Committer* committer;
 
     /// Time.
     Time time;
 
-    /// Log message.
+    /// Log message (already converted).
     std::string log;
 
-    Tag( const Committer& committer_, const std::string& name_, Time time_, const std::string& log_ );
-};
+    /// When the branch was re-created, where it was created from before.
+    const BranchPoint* previous;
 
-typedef unsigned short BranchId;
+    BranchPoint() : is_tag( false ), created( 0 ), from( 0 ), from_branch( 0 ), committer( NULL ), time( static_cast< time_t >( 0 ) ), previous( NULL ) {}
+};
 
 class Repository
 {
     /// Remember what files we changed and how (deletes/modifications).
-    std::string file_changes;
+    ///
+    /// The commands themselves live in Arena::revision().
+    std::vector< std::string_view > file_changes;
 
     /// Counter for the files.
     unsigned int mark;
 
-    /// Regex for matching the fnames.
-    regex_t regex_rule;
-
     /// Let's store to files.
     ///
     /// There can be a wrapping script that sets them up as named pipes that
     /// can feed the git fast-import(s).
-    std::ofstream out;
+    MeteredFile file;
 
-    /// We have to remember our commits
-    ///
-    /// Index - commit number, content - branch id.
-    BranchId* commits;
+    /// Stream to write to the file.
+    std::ostream out;
 
-    /// Remember the chain of parents
-    std::string* parents;
+    /// Our index in the shared table of revisions.
+    unsigned int index;
 
     /// Remember the tags we have already written.
     std::map< std::string, int > written_tags;
 
-    /// Max number of revisions.
-    unsigned int max_revs;
+    /// The branches we have written, indexed by BranchId.
+    ///
+    /// Contains the 'created' of the BranchPoint, so that we notice when the
+    /// branch was re-created.
+    std::vector< unsigned int > written_branches;
 
     /// Name of the repository.
     std::string name;
@@ -92,70 +107,118 @@ class Repository
     /// Makes sense for repository that is an incomplete continuation of another one.
     bool cleanup_first;
 
+    /// Statistics for the dry run: what was written, and the size of the content that was not read.
+    unsigned long commits, tags, files;
+    unsigned long long estimated_bytes;
+
+    /// The branches with at least one commit, indexed by BranchId.
+    std::vector< bool > committed_branches;
+
 public:
-    /// The regex_ is here to decide if the file belongs to this repository.
-    Repository( const std::string& reponame_, const std::string& regex_, unsigned int max_revs_, bool cleanup_first_ );
+    /// Which files belong to this repository is decided by Repositories::get().
+    Repository( const std::string& reponame_, bool cleanup_first_ );
 
     ~Repository();
 
-    /// Does the file belong to this repository (based on the regex we got?)
-    bool matches( const std::string& fname_ ) const;
-
     /// The file should be marked for deletion.
-    void deleteFile( const std::string& fname_ );
+    void deleteFile( std::string_view fname_ );
 
     /// The file should be marked for addition/modification.
-    std::ostream& modifyFile( const std::string& fname_, const char* mode_ );
+    std::ostream& modifyFile( std::string_view fname_, const char* mode_ );
 
-    /// Commit all the changes we did.
-    void commit( const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_, const std::vector< int >& merges_, bool force_ = false );
+    /// Like modifyFile(), but only the size of the content is known (the dry run).
+    void estimateFile( std::string_view fname_, const char* mode_, size_t length_ );
 
-    /// Create a branch.
-    void createBranch( unsigned int from_, const std::string& from_branch_,
-            const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_ );
+    /// Commit all the changes we did; log_ is already converted by CommitMessages::convert().
+    void commit( const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_, const std::vector< int >& merges_ );
 
-    /// Create a tag (based on the 'tag tracking' branch).
-    void createTag( const Tag& tag_ );
+    /// Create a tag (the last commit to its 'tag tracking' branch, or the commit it was copied from).
+    void createTag( BranchId tag_branch_, const BranchPoint& point_ );
 
-    /// Create a tag (just output)
+    /// Create a tag (just output); rev_ is the revision to tag (or the first one to look at when lookup_in_parents_).
     void createTag(  const std::string& name_, int rev_, bool lookup_in_parents_,
             const Committer& committer_, Time time_, const std::string& log_ );
 
     /// Map known commits betwenn Mercurial and Git
     void mapCommit( int rev_, const std::string& git_commit_ );
 
+    /// Point the branch to the revision (or to what this repository sees as the revision).
+    void resetBranch( const std::string& name_, int rev_ );
+
     /// Has this commit at least one parent commit?
     bool hasParent( int parent_ );
 
     /// Name of this repository
     const std::string& getName() const { return name; }
 
+    /// Print the statistics of the dry run.
+    void printEstimate();
+
 private:
     /// Find the most recent commit to the specified branch smaller than the reference one.
-    unsigned int findCommit( unsigned int from_, const std::string& from_branch_ );
+    ///
+    /// When the branch has no commits in this repository (yet), it is the
+    /// commit it was created from.
+    unsigned int findCommit( unsigned int from_, BranchId from_branch_ );
+
+    /// How writeCommit() connects the commit.
+    enum CommitKind
+    {
+        /// Marked as ':<100000 + commit_id>', the first of the merges is the 'from'.
+        COMMIT_NORMAL,
+
+        /// Creation commit of a branch: no mark (the repository may have a
+        /// real commit in the same revision), not in the revision table.
+        COMMIT_CREATION,
+
+        /// The first commit after the creation commit: its parent is the
+        /// branch tip (the creation commit), the first of the merges is skipped.
+        COMMIT_AFTER_CREATION
+    };
+
+    /// Write the branch (reset + the creation commit) if it was not written yet; true if the creation commit was written.
+    bool writeBranch( BranchId branch_, const std::string& name_ );
+
+    /// Write the commit itself.
+    void writeCommit( const Committer& committer_, const std::string& name_, BranchId branch_, unsigned int commit_id_, Time time_, const std::string& log_,
+            const std::vector< int >& merges_, const std::vector< std::string_view >& changes_, CommitKind kind_ );
+
+    /// Write the 'from' or 'merge' line for the parent revision; false when there is no such parent.
+    bool writeParent( const char* command_, unsigned int rev_ );
 };
 
 namespace Repositories
 {
+    /// Do not write the .dump files, just report what would be in them; call before load().
+    void setDryRun();
+
     /// Load the repositories layout from the config file.
-    bool load( const char* fname_, unsigned int max_revs_, int& min_rev_, std::string& trunk_base_, std::string& trunk_, std::string& branches_, std::string& tags_ );
+    bool load( const char* fname_, int& min_rev_, std::string& trunk_base_, std::string& trunk_, std::string& branches_, std::string& tags_ );
 
     /// Close all the repositories.
     void close();
 
-    /// Get the right repository according to the filename.
-    Repository& get( const std::string& fname_ );
+    /// Get the right repository according to the filename (the first regex that matches, the last repository otherwise).
+    Repository& get( std::string_view fname_ );
 
     /// The file should be marked for deletion.
-    inline void deleteFile( const std::string& fname_ ) { get( fname_ ).deleteFile( fname_ ); }
+    inline void deleteFile( std::string_view fname_ ) { get( fname_ ).deleteFile( fname_ ); }
 
     /// The file should be marked for addition/modification.
-    inline std::ostream& modifyFile( const std::string& fname_, const char* mode_ ) { return get( fname_ ).modifyFile( fname_, mode_ ); }
+    inline std::ostream& modifyFile( std::string_view fname_, const char* mode_ ) { return get( fname_ ).modifyFile( fname_, mode_ ); }
+
+    /// The file should be marked for addition/modification, but we know just its size (the dry run).
+    inline void estimateFile( std::string_view fname_, const char* mode_, size_t length_ ) { get( fname_ ).estimateFile( fname_, mode_, length_ ); }
 
     /// Commit to the all repositories that have some changes.
+    ///
+    /// The log_ is expected to be converted already (once per revision) by CommitMessages::convert().
     void commit( const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_, const std::vector< int >& merges_ = std::vector< int >() );
 
-    /// Create a branch or a tag in all the repositories.
+    /// Create a branch or a tag; log_ is already converted.
+    ///
+    /// Just remembers the BranchPoint, the repositories write the branch
+    /// when they commit to it for the first time.
     void createBranchOrTag( bool is_branch_, unsigned int from_, const std::string& from_branch_,
             const Committer& committer_, const std::string& name_, unsigned int commit_id_, Time time_, const std::string& log_ );
 
@@ -163,11 +226,17 @@ namespace Repositories
     void updateMercurialTag( const std::string& name_, int rev_,
             const Committer& committer_, Time time_, const std::string& log_ );
 
+    /// Point the branch to the revision in all the repositories (output at the end of the conversion).
+    void resetBranch( const std::string& name_, int rev_ );
+
+    /// Where was the branch created from (NULL if we do not know the branch).
+    const BranchPoint* branchPoint( BranchId branch_ );
+
     /// Should the revision with this number be ignored?
     bool ignoreRevision( unsigned int commit_id_ );
 
     /// Should the tag with this name be ignored?
-    bool ignoreTag( const std::string& name_ );
+    bool ignoreTag( std::string_view name_ );
 
     /// Has this commit at least one parent commit?
     bool hasParent( int parent_ );
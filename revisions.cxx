@@ -0,0 +1,204 @@
+/*
+ * Remember what revisions we have committed, and to what repositories.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "error.hxx"
+#include "revisions.hxx"
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+typedef map< unsigned int, string > ExternalCommits;
+
+typedef map< pair< unsigned int, unsigned int >, BranchId > BranchExceptions;
+
+static const unsigned int NO_PARENT = ~0U;
+
+/// Number of the repositories (and so of the bits for each revision).
+static unsigned int repos_count = 0;
+
+/// Number of 64bit words per revision in 'committed'.
+static unsigned int words = 0;
+
+/// The revision that corresponds to the index 0.
+static unsigned int base = 0;
+
+/// Revision -> bitset of the repositories that committed it.
+static vector< uint64_t > committed;
+
+/// Revision -> branch id (of the first repository that committed it).
+static vector< BranchId > branches;
+
+/// (revision, repository) -> branch id, when the repository committed the
+/// revision to a different branch than the first one (a commit that belongs
+/// to more branches at once, or a re-used revision number of a branch creation).
+static BranchExceptions branch_exceptions;
+
+/// Revision -> first parent revision.
+static vector< unsigned int > first_parents;
+
+/// Repository -> commits that were mapped from outside (":commit map=").
+static vector< ExternalCommits > external;
+
+/// Make sure the revision fits into the table; returns the index.
+static size_t ensure( unsigned int rev_ )
+{
+    if ( branches.empty() )
+    {
+        words = ( repos_count + 63 ) / 64;
+        base = rev_;
+    }
+    else if ( rev_ < base )
+    {
+        // we have to grow in front; should not happen often
+        const size_t grow = base - rev_;
+        committed.insert( committed.begin(), grow * words, 0 );
+        branches.insert( branches.begin(), grow, 0 );
+        first_parents.insert( first_parents.begin(), grow, NO_PARENT );
+        base = rev_;
+    }
+
+    const size_t index = rev_ - base;
+    if ( index >= branches.size() )
+    {
+        committed.resize( ( index + 1 ) * words, 0 );
+        branches.resize( index + 1, 0 );
+        first_parents.resize( index + 1, NO_PARENT );
+    }
+
+    return index;
+}
+
+static inline bool inTable( unsigned int rev_ )
+{
+    return rev_ >= base && rev_ - base < branches.size();
+}
+
+/// Branch of the revision in the repository (the revision must be committed there).
+static inline BranchId branchOf( unsigned int rev_, unsigned int repo_ )
+{
+    if ( !branch_exceptions.empty() )
+    {
+        BranchExceptions::const_iterator it = branch_exceptions.find( make_pair( rev_, repo_ ) );
+        if ( it != branch_exceptions.end() )
+            return it->second;
+    }
+
+    return branches[rev_ - base];
+}
+
+unsigned int Revisions::addRepository()
+{
+    if ( !branches.empty() )
+        Error::report( "Repository added after the first revision was committed." );
+
+    external.push_back( ExternalCommits() );
+
+    return repos_count++;
+}
+
+void Revisions::setCommitted( unsigned int rev_, unsigned int repo_, BranchId branch_ )
+{
+    const size_t index = ensure( rev_ );
+
+    bool any_committed = false;
+    for ( unsigned int i = 0; i < words; ++i )
+        any_committed = any_committed || committed[index * words + i] != 0;
+
+    if ( !any_committed )
+        branches[index] = branch_;
+    else if ( branches[index] != branch_ )
+        branch_exceptions[make_pair( rev_, repo_ )] = branch_;
+    else if ( !branch_exceptions.empty() )
+        branch_exceptions.erase( make_pair( rev_, repo_ ) );
+
+    committed[index * words + repo_ / 64] |= uint64_t( 1 ) << ( repo_ % 64 );
+}
+
+bool Revisions::isCommitted( unsigned int rev_, unsigned int repo_ )
+{
+    if ( !inTable( rev_ ) )
+        return false;
+
+    return ( committed[( rev_ - base ) * words + repo_ / 64] & ( uint64_t( 1 ) << ( repo_ % 64 ) ) ) != 0;
+}
+
+void Revisions::setFirstParent( unsigned int rev_, unsigned int parent_ )
+{
+    first_parents[ensure( rev_ )] = parent_;
+}
+
+void Revisions::mapCommit( unsigned int rev_, unsigned int repo_, const std::string& git_commit_ )
+{
+    external[repo_][rev_] = git_commit_;
+}
+
+bool Revisions::findParent( unsigned int rev_, unsigned int repo_, unsigned int& mark_, const std::string*& commit_ )
+{
+    // Follow the first parents until we find a revision committed to this
+    // repository.  When there is none, the external commit of the furthest
+    // revision in the chain wins (that's how the chain was set up when
+    // copying the parents revision by revision).
+    const ExternalCommits& ext = external[repo_];
+    commit_ = NULL;
+
+    unsigned int rev = rev_;
+    while ( true )
+    {
+        if ( isCommitted( rev, repo_ ) )
+        {
+            mark_ = 100000 + rev;
+            commit_ = NULL;
+            return true;
+        }
+
+        if ( !ext.empty() )
+        {
+            ExternalCommits::const_iterator it = ext.find( rev );
+            if ( it != ext.end() )
+                commit_ = &it->second;
+        }
+
+        if ( !inTable( rev ) || first_parents[rev - base] == NO_PARENT )
+            break;
+
+        // the chain always goes back in time; be paranoid anyway
+        const unsigned int parent = first_parents[rev - base];
+        if ( parent >= rev )
+            break;
+
+        rev = parent;
+    }
+
+    return commit_ != NULL;
+}
+
+unsigned int Revisions::findCommit( unsigned int from_, unsigned int repo_, BranchId branch_ )
+{
+    if ( branches.empty() || from_ < base )
+        return 0;
+
+    unsigned int commit_no = from_;
+    if ( commit_no - base >= branches.size() )
+        commit_no = base + branches.size() - 1;
+
+    while ( commit_no > 0 && commit_no >= base )
+    {
+        if ( isCommitted( commit_no, repo_ ) && branchOf( commit_no, repo_ ) == branch_ )
+            return commit_no;
+        --commit_no;
+    }
+
+    return 0;
+}
+
+unsigned int Revisions::last()
+{
+    return base + branches.size() - 1;
+}
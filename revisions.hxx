@@ -0,0 +1,61 @@
+/*
+ * Remember what revisions we have committed, and to what repositories.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#ifndef _REVISIONS_HXX_
+#define _REVISIONS_HXX_
+
+#include <string>
+
+#include "interned.hxx"
+
+/** Table of the revisions, shared by all the repositories.
+
+    Stored as a struct of arrays indexed by the revision number; each
+    revision has a bitset of repositories that have committed it, the branch
+    id, and the first parent revision.  Only the range of revisions that were
+    actually committed is allocated.  When the repositories committed the
+    same revision to different branches, the exceptions are kept aside.
+
+    The commit written for a revision 'rev' always has the mark
+    ':<100000 + rev>' so we do not have to store the marks at all.
+*/
+namespace Revisions
+{
+    /// Register a new repository, returns its index in the bitsets.
+    unsigned int addRepository();
+
+    /// Remember that the repository committed the revision to the branch.
+    void setCommitted( unsigned int rev_, unsigned int repo_, BranchId branch_ );
+
+    /// Has the repository committed this revision?
+    bool isCommitted( unsigned int rev_, unsigned int repo_ );
+
+    /// Remember the first parent of the revision (so that repositories without changes can follow the chain).
+    void setFirstParent( unsigned int rev_, unsigned int parent_ );
+
+    /// Map a revision to an external commit (sha1) in the repository.
+    void mapCommit( unsigned int rev_, unsigned int repo_, const std::string& git_commit_ );
+
+    /** Find what the repository sees as the revision.
+
+        Either the revision itself (when committed to the repository), or the
+        nearest committed revision when following the first parents, or an
+        external commit.
+
+        @return false when there is none; otherwise either commit_ is NULL and
+        mark_ contains the mark, or commit_ points to the external sha1.
+    */
+    bool findParent( unsigned int rev_, unsigned int repo_, unsigned int& mark_, const std::string*& commit_ );
+
+    /// Find the most recent commit to the specified branch not greater than the reference one (0 if none).
+    unsigned int findCommit( unsigned int from_, unsigned int repo_, BranchId branch_ );
+
+    /// The most recent revision in the table.
+    unsigned int last();
+}
+
+#endif // _REVISIONS_HXX_
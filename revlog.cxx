@@ -0,0 +1,902 @@
+/*
+ * Read the Mercurial store (revlogs) directly, without Python.
+ *
+ * The format is described in Mercurial's mercurial/help/internals/revlogs.txt
+ * and the store path encoding in mercurial/store.py.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "revlog.hxx"
+
+#include "error.hxx"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+using namespace std;
+
+/// Size of one entry in the index (RevlogNG).
+static const size_t index_entry_size = 64;
+
+/// Flags in the header of the index (the first 4 bytes of the first entry).
+static const unsigned int revlog_inline_data = 1 << 16;
+static const unsigned int revlog_general_delta = 1 << 17;
+static const unsigned int revlog_ng = 1;
+
+/// Longest path in the fncache store before it is hashed.
+static const size_t max_store_path_length = 120;
+
+/// With the hashed paths, how much of each directory is kept, and the length of all of them.
+static const size_t dir_prefix_length = 8;
+static const size_t max_short_dirs_length = 8 * ( dir_prefix_length + 1 ) - 4;
+
+static inline unsigned int readUInt32( const char* data_ )
+{
+    const unsigned char* d = reinterpret_cast< const unsigned char* >( data_ );
+    return ( static_cast< unsigned int >( d[0] ) << 24 ) | ( d[1] << 16 ) | ( d[2] << 8 ) | d[3];
+}
+
+static inline int readInt32( const char* data_ )
+{
+    return static_cast< int >( readUInt32( data_ ) );
+}
+
+static inline int fromHexDigit( char c_ )
+{
+    if ( '0' <= c_ && c_ <= '9' )
+        return c_ - '0';
+    else if ( 'a' <= c_ && c_ <= 'f' )
+        return 10 + ( c_ - 'a' );
+    else if ( 'A' <= c_ && c_ <= 'F' )
+        return 10 + ( c_ - 'A' );
+
+    return -1;
+}
+
+bool HgNode::fromHex( string_view hex_ )
+{
+    if ( hex_.length() < 2 * sizeof( id ) )
+        return false;
+
+    for ( size_t i = 0; i < sizeof( id ); ++i )
+    {
+        const int high = fromHexDigit( hex_[2 * i] );
+        const int low = fromHexDigit( hex_[2 * i + 1] );
+        if ( high < 0 || low < 0 )
+            return false;
+
+        id[i] = ( high << 4 ) | low;
+    }
+
+    return true;
+}
+
+string HgNode::hex() const
+{
+    static const char digits[] = "0123456789abcdef";
+
+    string result( 2 * sizeof( id ), '0' );
+    for ( size_t i = 0; i < sizeof( id ); ++i )
+    {
+        result[2 * i] = digits[id[i] >> 4];
+        result[2 * i + 1] = digits[id[i] & 0xf];
+    }
+
+    return result;
+}
+
+/// Map the entire file; an empty (or missing, when allowed) file gives NULL.
+static bool mapFile( const string& fname_, bool may_be_missing_, const char*& map_, size_t& size_ )
+{
+    map_ = NULL;
+    size_ = 0;
+
+    int fd = open( fname_.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+        if ( may_be_missing_ && errno == ENOENT )
+            return true;
+
+        Error::report( "Cannot open '" + fname_ + "': " + strerror( errno ) );
+        return false;
+    }
+
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 )
+    {
+        Error::report( "Cannot stat '" + fname_ + "': " + strerror( errno ) );
+        close( fd );
+        return false;
+    }
+
+    if ( st.st_size > 0 )
+    {
+        void* mapped = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( mapped == MAP_FAILED )
+        {
+            Error::report( "Cannot mmap '" + fname_ + "': " + strerror( errno ) );
+            close( fd );
+            return false;
+        }
+
+        map_ = static_cast< const char* >( mapped );
+        size_ = st.st_size;
+    }
+
+    close( fd );
+
+    return true;
+}
+
+Revlog::Revlog()
+    : index_map( NULL ),
+      index_size( 0 ),
+      data_map( NULL ),
+      data_size( 0 ),
+      inline_data( false ),
+      general_delta( false ),
+      cached_rev( -1 )
+{
+}
+
+Revlog::~Revlog()
+{
+    close();
+}
+
+void Revlog::close()
+{
+    if ( index_map )
+        munmap( const_cast< char* >( index_map ), index_size );
+    if ( data_map )
+        munmap( const_cast< char* >( data_map ), data_size );
+
+    index_map = data_map = NULL;
+    index_size = data_size = 0;
+
+    entries.clear();
+    revisions.clear();
+    cached_rev = -1;
+    cached_text.clear();
+}
+
+bool Revlog::open( const string& index_fname_, const string& data_fname_ )
+{
+    close();
+    fname = index_fname_;
+
+    if ( !mapFile( index_fname_, false, index_map, index_size ) )
+        return false;
+
+    // empty revlog
+    if ( index_size == 0 )
+        return true;
+
+    if ( index_size < index_entry_size )
+    {
+        Error::report( "Revlog '" + fname + "' is truncated." );
+        return false;
+    }
+
+    const unsigned int header = readUInt32( index_map );
+    if ( ( header & 0xffff ) != revlog_ng )
+    {
+        Error::report( "Revlog '" + fname + "' has an unsupported version." );
+        return false;
+    }
+
+    inline_data = header & revlog_inline_data;
+    general_delta = header & revlog_general_delta;
+
+    if ( !inline_data && !mapFile( data_fname_, true, data_map, data_size ) )
+        return false;
+
+    const size_t available = inline_data? index_size: data_size;
+
+    entries.reserve( index_size / index_entry_size );
+    for ( size_t pos = 0; pos + index_entry_size <= index_size; )
+    {
+        const char* e = index_map + pos;
+
+        Entry entry;
+        // the offset is 6 bytes, the 2 bytes that follow are the flags; the
+        // first entry has the header there instead
+        entry.offset = entries.empty()? 0: ( static_cast< unsigned long long >( readUInt32( e ) ) << 16 ) | ( readUInt32( e + 4 ) >> 16 );
+        entry.length = readUInt32( e + 8 );
+        entry.base = readInt32( e + 16 );
+        entry.link = readInt32( e + 20 );
+        entry.p1 = readInt32( e + 24 );
+        entry.p2 = readInt32( e + 28 );
+        memcpy( entry.node.id, e + 32, sizeof( entry.node.id ) );
+
+        pos += index_entry_size;
+        if ( inline_data )
+        {
+            entry.offset = pos;
+            pos += entry.length;
+        }
+
+        if ( entry.offset + entry.length > available )
+        {
+            Error::report( "Revlog '" + fname + "' is truncated." );
+            return false;
+        }
+
+        entries.push_back( entry );
+    }
+
+    return true;
+}
+
+int Revlog::rev( const HgNode& node_ )
+{
+    if ( revisions.empty() )
+    {
+        revisions.reserve( entries.size() );
+        for ( size_t i = 0; i < entries.size(); ++i )
+            revisions[entries[i].node] = i;
+    }
+
+    unordered_map< HgNode, int, HgNodeHash >::const_iterator it = revisions.find( node_ );
+    if ( it == revisions.end() )
+        return -1;
+
+    return it->second;
+}
+
+void Revlog::heads( vector< int >& heads_ ) const
+{
+    vector< bool > has_child( entries.size(), false );
+    for ( size_t i = 0; i < entries.size(); ++i )
+    {
+        if ( entries[i].p1 >= 0 )
+            has_child[entries[i].p1] = true;
+        if ( entries[i].p2 >= 0 )
+            has_child[entries[i].p2] = true;
+    }
+
+    heads_.clear();
+    for ( size_t i = 0; i < entries.size(); ++i )
+        if ( !has_child[i] )
+            heads_.push_back( i );
+}
+
+bool Revlog::chunk( int rev_, string_view& chunk_ )
+{
+    const Entry& entry = entries[rev_];
+    const char* data = ( inline_data? index_map: data_map ) + entry.offset;
+
+    if ( entry.length == 0 )
+    {
+        chunk_ = string_view();
+        return true;
+    }
+
+    switch ( data[0] )
+    {
+        case 'u':
+            chunk_ = string_view( data + 1, entry.length - 1 );
+            return true;
+        case '\0':
+            chunk_ = string_view( data, entry.length );
+            return true;
+        case 'x':
+            break;
+        default:
+            Error::report( "Revlog '" + fname + "' uses an unsupported compression." );
+            return false;
+    }
+
+    // zlib; we do not know the uncompressed size of the deltas, grow as needed
+    z_stream z;
+    memset( &z, 0, sizeof( z ) );
+    if ( inflateInit( &z ) != Z_OK )
+    {
+        Error::report( "Cannot initialize zlib." );
+        return false;
+    }
+
+    z.next_in = reinterpret_cast< Bytef* >( const_cast< char* >( data ) );
+    z.avail_in = entry.length;
+
+    if ( chunk_buffer.size() < 4 * entry.length )
+        chunk_buffer.resize( 4 * entry.length );
+
+    size_t used = 0;
+    int result;
+    do
+    {
+        if ( used == chunk_buffer.size() )
+            chunk_buffer.resize( 2 * chunk_buffer.size() );
+
+        z.next_out = reinterpret_cast< Bytef* >( &chunk_buffer[used] );
+        z.avail_out = chunk_buffer.size() - used;
+
+        result = inflate( &z, Z_NO_FLUSH );
+        used = chunk_buffer.size() - z.avail_out;
+    } while ( result == Z_OK );
+
+    inflateEnd( &z );
+
+    if ( result != Z_STREAM_END )
+    {
+        Error::report( "Cannot decompress revision " + to_string( rev_ ) + " of '" + fname + "'." );
+        return false;
+    }
+
+    chunk_ = string_view( chunk_buffer.data(), used );
+    return true;
+}
+
+/// Apply the binary delta (a list of 'replace start..end with data' hunks) to the text.
+static bool applyDelta( const string& text_, string_view delta_, string& result_ )
+{
+    result_.clear();
+    result_.reserve( text_.length() + delta_.length() );
+
+    size_t last = 0;
+    for ( size_t pos = 0; pos < delta_.length(); )
+    {
+        if ( pos + 12 > delta_.length() )
+            return false;
+
+        const size_t start = readUInt32( delta_.data() + pos );
+        const size_t end = readUInt32( delta_.data() + pos + 4 );
+        const size_t length = readUInt32( delta_.data() + pos + 8 );
+        pos += 12;
+
+        if ( start < last || end < start || end > text_.length() || pos + length > delta_.length() )
+            return false;
+
+        result_.append( text_, last, start - last );
+        result_.append( delta_.data() + pos, length );
+
+        last = end;
+        pos += length;
+    }
+
+    result_.append( text_, last, string::npos );
+
+    return true;
+}
+
+bool Revlog::revision( int rev_, string& text_ )
+{
+    if ( rev_ < 0 || rev_ >= static_cast< int >( entries.size() ) )
+    {
+        Error::report( "Revision " + to_string( rev_ ) + " does not exist in '" + fname + "'." );
+        return false;
+    }
+
+    // walk back the chain until the full text, or the text we have already
+    vector< int > chain;
+    bool from_cache = false;
+    for ( int rev = rev_; ; )
+    {
+        if ( rev == cached_rev )
+        {
+            from_cache = true;
+            break;
+        }
+
+        chain.push_back( rev );
+
+        const int base = entries[rev].base;
+        if ( base == rev || base < 0 )
+            break;
+
+        rev = general_delta? base: rev - 1;
+    }
+
+    string_view data;
+    if ( !from_cache )
+    {
+        if ( !chunk( chain.back(), data ) )
+            return false;
+
+        cached_text.assign( data.data(), data.length() );
+        cached_rev = chain.back();
+        chain.pop_back();
+    }
+
+    string patched;
+    for ( vector< int >::const_reverse_iterator it = chain.rbegin(); it != chain.rend(); ++it )
+    {
+        if ( !chunk( *it, data ) )
+            return false;
+
+        if ( !applyDelta( cached_text, data, patched ) )
+        {
+            Error::report( "Broken delta in revision " + to_string( *it ) + " of '" + fname + "'." );
+            cached_rev = -1;
+            return false;
+        }
+
+        cached_text.swap( patched );
+        cached_rev = *it;
+    }
+
+    text_ = cached_text;
+
+    return true;
+}
+
+const HgManifestEntry* HgManifest::find( string_view path_ ) const
+{
+    vector< HgManifestEntry >::const_iterator it = lower_bound( entries.begin(), entries.end(), path_,
+            []( const HgManifestEntry& entry_, string_view path_ ) { return entry_.path < path_; } );
+
+    if ( it == entries.end() || it->path != path_ )
+        return NULL;
+
+    return &*it;
+}
+
+/// Minimal SHA-1, for the hashed paths in the fncache store.
+static string sha1Hex( const string& data_ )
+{
+    unsigned int h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+    string message( data_ );
+    const unsigned long long bits = static_cast< unsigned long long >( data_.length() ) * 8;
+    message += '\x80';
+    while ( message.length() % 64 != 56 )
+        message += '\0';
+    for ( int i = 7; i >= 0; --i )
+        message += static_cast< char >( bits >> ( 8 * i ) );
+
+    for ( size_t block = 0; block < message.length(); block += 64 )
+    {
+        unsigned int w[80];
+        for ( int i = 0; i < 16; ++i )
+            w[i] = readUInt32( message.data() + block + 4 * i );
+        for ( int i = 16; i < 80; ++i )
+        {
+            const unsigned int x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = ( x << 1 ) | ( x >> 31 );
+        }
+
+        unsigned int a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for ( int i = 0; i < 80; ++i )
+        {
+            unsigned int f, k;
+            if ( i < 20 )
+                f = ( b & c ) | ( ~b & d ), k = 0x5a827999;
+            else if ( i < 40 )
+                f = b ^ c ^ d, k = 0x6ed9eba1;
+            else if ( i < 60 )
+                f = ( b & c ) | ( b & d ) | ( c & d ), k = 0x8f1bbcdc;
+            else
+                f = b ^ c ^ d, k = 0xca62c1d6;
+
+            const unsigned int t = ( ( a << 5 ) | ( a >> 27 ) ) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = ( b << 30 ) | ( b >> 2 );
+            b = a;
+            a = t;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    char hex[41];
+    for ( int i = 0; i < 5; ++i )
+        snprintf( hex + 8 * i, 9, "%08x", h[i] );
+
+    return string( hex, 40 );
+}
+
+/// The '~xx' escape of the character.
+static void appendEscaped( string& result_, char c_ )
+{
+    char escaped[4];
+    snprintf( escaped, sizeof( escaped ), "~%02x", static_cast< unsigned char >( c_ ) );
+    result_ += escaped;
+}
+
+static inline bool isReserved( unsigned char c_ )
+{
+    return c_ < 32 || c_ >= 126 || strchr( "\\:*?\"<>|", c_ ) != NULL;
+}
+
+/// Don't let the directories look like the revlogs ('foo.i/' -> 'foo.i.hg/').
+static string encodeDir( const string& path_ )
+{
+    string result;
+    result.reserve( path_.length() + 8 );
+
+    for ( size_t i = 0; i < path_.length(); ++i )
+    {
+        result += path_[i];
+        if ( path_[i] != '/' )
+            continue;
+
+        const size_t len = result.length();
+        if ( ( len >= 4 && result.compare( len - 4, 4, ".hg/" ) == 0 ) ||
+             ( len >= 3 && ( result.compare( len - 3, 3, ".i/" ) == 0 || result.compare( len - 3, 3, ".d/" ) == 0 ) ) )
+        {
+            result.insert( len - 1, ".hg" );
+        }
+    }
+
+    return result;
+}
+
+/// Case folding for the case-insensitive filesystems ('Foo' -> '_foo', '_' -> '__').
+static string encodeFilename( const string& path_ )
+{
+    string result;
+    result.reserve( path_.length() + 16 );
+
+    for ( size_t i = 0; i < path_.length(); ++i )
+    {
+        const char c = path_[i];
+        if ( isReserved( c ) )
+            appendEscaped( result, c );
+        else if ( 'A' <= c && c <= 'Z' )
+        {
+            result += '_';
+            result += c - 'A' + 'a';
+        }
+        else if ( c == '_' )
+            result += "__";
+        else
+            result += c;
+    }
+
+    return result;
+}
+
+/// Like encodeFilename(), but just lowercases (for the hashed paths).
+static string encodeLower( const string& path_ )
+{
+    string result;
+    result.reserve( path_.length() + 16 );
+
+    for ( size_t i = 0; i < path_.length(); ++i )
+    {
+        const char c = path_[i];
+        if ( isReserved( c ) )
+            appendEscaped( result, c );
+        else if ( 'A' <= c && c <= 'Z' )
+            result += c - 'A' + 'a';
+        else
+            result += c;
+    }
+
+    return result;
+}
+
+/// Split the path to the components.
+static vector< string > splitPath( const string& path_ )
+{
+    vector< string > result;
+
+    size_t start = 0;
+    for ( size_t slash = path_.find( '/' ); slash != string::npos; slash = path_.find( '/', start ) )
+    {
+        result.push_back( path_.substr( start, slash - start ) );
+        start = slash + 1;
+    }
+    result.push_back( path_.substr( start ) );
+
+    return result;
+}
+
+/// Avoid the names that Windows does not like ('aux' -> 'au~78', leading or trailing '.' and ' ').
+static void encodeAux( vector< string >& components_, bool dotencode_ )
+{
+    for ( vector< string >::iterator it = components_.begin(); it != components_.end(); ++it )
+    {
+        string& n = *it;
+        if ( n.empty() )
+            continue;
+
+        if ( dotencode_ && ( n[0] == '.' || n[0] == ' ' ) )
+        {
+            string escaped;
+            appendEscaped( escaped, n[0] );
+            n = escaped + n.substr( 1 );
+        }
+        else
+        {
+            size_t l = n.find( '.' );
+            if ( l == string::npos )
+                l = n.length();
+
+            const string prefix = n.substr( 0, 3 );
+            if ( ( l == 3 && ( prefix == "aux" || prefix == "con" || prefix == "prn" || prefix == "nul" ) ) ||
+                 ( l == 4 && '1' <= n[3] && n[3] <= '9' && ( prefix == "com" || prefix == "lpt" ) ) )
+            {
+                string escaped;
+                appendEscaped( escaped, n[2] );
+                n = n.substr( 0, 2 ) + escaped + n.substr( 3 );
+            }
+        }
+
+        const char last = n[n.length() - 1];
+        if ( last == '.' || last == ' ' )
+        {
+            n.erase( n.length() - 1 );
+            appendEscaped( n, last );
+        }
+    }
+}
+
+static string joinPath( const vector< string >& components_, size_t count_ )
+{
+    string result;
+    for ( size_t i = 0; i < count_; ++i )
+    {
+        if ( i > 0 )
+            result += '/';
+        result += components_[i];
+    }
+
+    return result;
+}
+
+/// The too long paths are shortened, and a hash is added.
+static string encodeHashed( const string& path_, bool dotencode_ )
+{
+    const string digest = sha1Hex( path_ );
+
+    // without the 'data/'
+    vector< string > parts = splitPath( encodeLower( path_.substr( 5 ) ) );
+    encodeAux( parts, dotencode_ );
+
+    const string& basename = parts.back();
+
+    // extension as os.path.splitext() sees it (leading dots do not count)
+    string ext;
+    size_t dot = basename.rfind( '.' );
+    if ( dot != string::npos && basename.find_first_not_of( '.' ) < dot )
+        ext = basename.substr( dot );
+
+    string dirs;
+    for ( size_t i = 0; i + 1 < parts.size(); ++i )
+    {
+        string d = parts[i].substr( 0, dir_prefix_length );
+        if ( d[d.length() - 1] == '.' || d[d.length() - 1] == ' ' )
+            d[d.length() - 1] = '_';
+
+        const size_t length = dirs.empty()? d.length(): dirs.length() + 1 + d.length();
+        if ( !dirs.empty() && length > max_short_dirs_length )
+            break;
+
+        if ( !dirs.empty() )
+            dirs += '/';
+        dirs += d;
+    }
+    if ( !dirs.empty() )
+        dirs += '/';
+
+    string result = "dh/" + dirs + digest + ext;
+    if ( result.length() < max_store_path_length )
+    {
+        const string filler = basename.substr( 0, max_store_path_length - result.length() );
+        result = "dh/" + dirs + filler + digest + ext;
+    }
+
+    return result;
+}
+
+HgRepository::HgRepository()
+    : store( false ),
+      fncache( false ),
+      dotencode( false )
+{
+}
+
+bool HgRepository::open( const string& repos_path_ )
+{
+    const string hg_path = repos_path_ + "/.hg/";
+
+    // with share-safe, part of the requirements is in the store
+    const string requires_files[] = { hg_path + "requires", hg_path + "store/requires" };
+    for ( const string& requires_file : requires_files )
+    {
+        ifstream requires( requires_file.c_str() );
+        string requirement;
+        while ( getline( requires, requirement ) )
+        {
+            if ( requirement == "store" )
+                store = true;
+            else if ( requirement == "fncache" )
+                fncache = true;
+            else if ( requirement == "dotencode" )
+                dotencode = true;
+            else if ( requirement != "revlogv1" && requirement != "generaldelta" && requirement != "sparse-revlog" &&
+                      requirement != "share-safe" && requirement != "persistent-nodemap" && requirement != "dirstate-v2" &&
+                      !requirement.empty() )
+            {
+                fprintf( stderr, "Repository '%s' requires '%s', cannot read it directly.\n", repos_path_.c_str(), requirement.c_str() );
+                return false;
+            }
+        }
+    }
+
+    store_path = store? hg_path + "store/": hg_path;
+
+    return changelog.open( store_path + "00changelog.i", store_path + "00changelog.d" ) &&
+        manifests.open( store_path + "00manifest.i", store_path + "00manifest.d" );
+}
+
+bool HgRepository::changeset( int rev_, HgChangeset& changeset_ )
+{
+    string text;
+    if ( !changelog.revision( rev_, text ) )
+        return false;
+
+    changeset_.rev = rev_;
+    changeset_.node = changelog.node( rev_ );
+    changeset_.p1 = changelog.parent1( rev_ );
+    changeset_.p2 = changelog.parent2( rev_ );
+    changeset_.files.clear();
+
+    // manifest\nuser\ntime tz[ extra]\nfile\nfile\n...\n\ndescription
+    size_t pos = 0;
+    size_t eol = text.find( '\n' );
+    if ( eol == string::npos || !changeset_.manifest.fromHex( string_view( text.data(), eol ) ) )
+    {
+        Error::report( "Changeset " + to_string( rev_ ) + " is broken." );
+        return false;
+    }
+
+    pos = eol + 1;
+    eol = text.find( '\n', pos );
+    if ( eol == string::npos )
+    {
+        Error::report( "Changeset " + to_string( rev_ ) + " is broken." );
+        return false;
+    }
+    changeset_.user = text.substr( pos, eol - pos );
+
+    pos = eol + 1;
+    eol = text.find( '\n', pos );
+    if ( eol == string::npos )
+    {
+        Error::report( "Changeset " + to_string( rev_ ) + " is broken." );
+        return false;
+    }
+    const string date = text.substr( pos, eol - pos );
+    char* end;
+    changeset_.time = strtod( date.c_str(), &end );
+    changeset_.tz = strtol( end, NULL, 10 );
+
+    for ( pos = eol + 1; pos < text.length(); pos = eol + 1 )
+    {
+        eol = text.find( '\n', pos );
+        if ( eol == string::npos )
+            eol = text.length();
+
+        if ( eol == pos )
+        {
+            ++pos;
+            break;
+        }
+
+        changeset_.files.push_back( text.substr( pos, eol - pos ) );
+    }
+
+    changeset_.description = ( pos < text.length() )? text.substr( pos ): string();
+
+    return true;
+}
+
+bool HgRepository::manifest( const HgNode& node_, HgManifest& manifest_ )
+{
+    manifest_.entries.clear();
+
+    const int rev = manifests.rev( node_ );
+    if ( rev < 0 )
+    {
+        Error::report( "Manifest " + node_.hex() + " does not exist." );
+        return false;
+    }
+
+    if ( !manifests.revision( rev, manifest_.text ) )
+        return false;
+
+    // path\0<40 hex digits>[flag]\n
+    const string& text = manifest_.text;
+    for ( size_t pos = 0; pos < text.length(); )
+    {
+        const size_t zero = text.find( '\0', pos );
+        const size_t eol = text.find( '\n', pos );
+        if ( zero == string::npos || eol == string::npos || zero > eol || eol - zero < 41 )
+        {
+            Error::report( "Manifest " + node_.hex() + " is broken." );
+            return false;
+        }
+
+        HgManifestEntry entry;
+        entry.path = string_view( text.data() + pos, zero - pos );
+        if ( !entry.node.fromHex( string_view( text.data() + zero + 1, 40 ) ) )
+        {
+            Error::report( "Manifest " + node_.hex() + " is broken." );
+            return false;
+        }
+        entry.flag = ( eol - zero > 41 )? text[zero + 41]: 0;
+
+        manifest_.entries.push_back( entry );
+
+        pos = eol + 1;
+    }
+
+    return true;
+}
+
+string HgRepository::filelogPath( const string& path_, const char* ext_ ) const
+{
+    const string path = "data/" + path_ + ext_;
+
+    if ( !store )
+        return store_path + encodeDir( path );
+
+    if ( !fncache )
+        return store_path + encodeFilename( encodeDir( path ) );
+
+    const string dir_encoded = encodeDir( path );
+
+    vector< string > components = splitPath( encodeFilename( dir_encoded ) );
+    encodeAux( components, dotencode );
+
+    string result = joinPath( components, components.size() );
+    if ( result.length() > max_store_path_length )
+        result = encodeHashed( dir_encoded, dotencode );
+
+    return store_path + result;
+}
+
+bool HgRepository::fileData( const string& path_, const HgNode& node_, string& data_ )
+{
+    unordered_map< string, unique_ptr< Revlog > >::iterator it = filelogs.find( path_ );
+    if ( it == filelogs.end() )
+    {
+        // do not keep too many files mapped
+        if ( filelogs.size() >= 1024 )
+            filelogs.clear();
+
+        unique_ptr< Revlog > filelog( new Revlog );
+        if ( !filelog->open( filelogPath( path_, ".i" ), filelogPath( path_, ".d" ) ) )
+            return false;
+
+        it = filelogs.emplace( path_, move( filelog ) ).first;
+    }
+
+    Revlog* filelog = it->second.get();
+
+    const int rev = filelog->rev( node_ );
+    if ( rev < 0 )
+    {
+        Error::report( "Revision " + node_.hex() + " of '" + path_ + "' does not exist." );
+        return false;
+    }
+
+    if ( !filelog->revision( rev, data_ ) )
+        return false;
+
+    // copy metadata: \1\n...\1\n
+    if ( data_.length() >= 2 && data_[0] == '\1' && data_[1] == '\n' )
+    {
+        const size_t end = data_.find( "\1\n", 2 );
+        if ( end != string::npos )
+            data_.erase( 0, end + 2 );
+    }
+
+    return true;
+}
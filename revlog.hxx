@@ -0,0 +1,216 @@
+/*
+ * Read the Mercurial store (revlogs) directly, without Python.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#ifndef _REVLOG_HXX_
+#define _REVLOG_HXX_
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Node id (SHA-1) of a changeset, manifest, or file revision.
+struct HgNode
+{
+    unsigned char id[20];
+
+    bool operator==( const HgNode& other_ ) const { return memcmp( id, other_.id, sizeof( id ) ) == 0; }
+    bool operator!=( const HgNode& other_ ) const { return !( *this == other_ ); }
+
+    /// Parse the 40 hex digits; false if they are not valid.
+    bool fromHex( std::string_view hex_ );
+
+    /// The 40 hex digits.
+    std::string hex() const;
+};
+
+/// The node id is a hash already, use a part of it.
+struct HgNodeHash
+{
+    size_t operator()( const HgNode& node_ ) const { size_t result; memcpy( &result, node_.id, sizeof( result ) ); return result; }
+};
+
+/** One revlog - the index (.i) and the data (.d, or inline in the .i).
+
+    Both files are mmap'ed; the revisions are reconstructed from the delta
+    chains, the last reconstructed text is kept, so that reading the
+    revisions one after another applies just one delta each time.
+*/
+class Revlog
+{
+    struct Entry
+    {
+        /// Where the chunk starts (in the .d, or in the .i when inline).
+        unsigned long long offset;
+
+        /// Length of the (compressed) chunk.
+        unsigned int length;
+
+        /// Start of the delta chain (or the delta parent with generaldelta).
+        int base;
+
+        int link;
+        int p1;
+        int p2;
+        HgNode node;
+    };
+
+    std::string fname;
+
+    const char* index_map;
+    size_t index_size;
+
+    const char* data_map;
+    size_t data_size;
+
+    /// The data are in the .i file, after each index entry.
+    bool inline_data;
+
+    /// The deltas are against 'base', not against the previous revision.
+    bool general_delta;
+
+    std::vector< Entry > entries;
+
+    /// Node -> revision, created on the first lookup.
+    std::unordered_map< HgNode, int, HgNodeHash > revisions;
+
+    /// The last reconstructed revision.
+    int cached_rev;
+    std::string cached_text;
+
+    /// Buffer for decompressing the chunks.
+    std::string chunk_buffer;
+
+public:
+    Revlog();
+
+    ~Revlog();
+
+    Revlog( const Revlog& ) = delete;
+    Revlog& operator=( const Revlog& ) = delete;
+
+    /// Open the revlog (index_fname_ is the .i file); reports the error and returns false when it cannot be read.
+    bool open( const std::string& index_fname_, const std::string& data_fname_ );
+
+    int count() const { return entries.size(); }
+
+    const HgNode& node( int rev_ ) const { return entries[rev_].node; }
+
+    int parent1( int rev_ ) const { return entries[rev_].p1; }
+
+    int parent2( int rev_ ) const { return entries[rev_].p2; }
+
+    /// The revision with the node id, -1 if there is none.
+    int rev( const HgNode& node_ );
+
+    /// The revisions that are not parents of any other revision, in the ascending order.
+    void heads( std::vector< int >& heads_ ) const;
+
+    /// The full text of the revision.
+    bool revision( int rev_, std::string& text_ );
+
+private:
+    void close();
+
+    /// The decompressed chunk of the revision (valid till the next call).
+    bool chunk( int rev_, std::string_view& chunk_ );
+};
+
+/// One changeset as stored in the changelog.
+struct HgChangeset
+{
+    int rev;
+    HgNode node;
+
+    /// Parent revisions, -1 when none.
+    int p1;
+    int p2;
+
+    HgNode manifest;
+    std::string user;
+    double time;
+    int tz;
+    std::vector< std::string > files;
+    std::string description;
+};
+
+/// One file in the manifest.
+struct HgManifestEntry
+{
+    std::string_view path;
+    HgNode node;
+
+    /// 'x' for executables, 'l' for symlinks, 0 otherwise.
+    char flag;
+};
+
+/// The manifest of a changeset; the entries are sorted by the path.
+struct HgManifest
+{
+    std::string text;
+    std::vector< HgManifestEntry > entries;
+
+    /// The entry of the path, or NULL when the file does not exist.
+    const HgManifestEntry* find( std::string_view path_ ) const;
+};
+
+/** The store of a Mercurial repository (.hg/store).
+
+    Understands the repository formats with the revlogv1, store, fncache,
+    dotencode and generaldelta requirements (what Mercurial creates by
+    default); open() fails for anything else, so that the caller can fall
+    back to the Mercurial's own Python code.
+*/
+class HgRepository
+{
+    /// Where the revlogs are, including the trailing '/'.
+    std::string store_path;
+
+    bool store;
+    bool fncache;
+    bool dotencode;
+
+    Revlog changelog;
+    Revlog manifests;
+
+    /// The filelogs opened so far (limited, each of them keeps 2 files mapped).
+    std::unordered_map< std::string, std::unique_ptr< Revlog > > filelogs;
+
+public:
+    HgRepository();
+
+    /// Check the requirements and open the changelog and the manifest.
+    bool open( const std::string& repos_path_ );
+
+    int count() const { return changelog.count(); }
+
+    /// Node id of the changeset.
+    const HgNode& node( int rev_ ) const { return changelog.node( rev_ ); }
+
+    /// Read and parse the changeset.
+    bool changeset( int rev_, HgChangeset& changeset_ );
+
+    /// Read and parse the manifest.
+    bool manifest( const HgNode& node_, HgManifest& manifest_ );
+
+    /// Content of the file revision (without the copy metadata).
+    bool fileData( const std::string& path_, const HgNode& node_, std::string& data_ );
+
+    /// The changeset with the node id, -1 if there is none.
+    int rev( const HgNode& node_ ) { return changelog.rev( node_ ); }
+
+    /// The changesets without children.
+    void heads( std::vector< int >& heads_ ) const { changelog.heads( heads_ ); }
+
+private:
+    /// Path of the revlog file of the tracked file in the store (ext_ is ".i" or ".d").
+    std::string filelogPath( const std::string& path_, const char* ext_ ) const;
+};
+
+#endif // _REVLOG_HXX_
@@ -11,16 +11,21 @@
 
 #define _XOPEN_SOURCE
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
 
 #include <ostream>
 
+#include "arena.hxx"
 #include "committers.hxx"
 #include "error.hxx"
 #include "filter.hxx"
+#include "messages.hxx"
+#include "metrics.hxx"
 #include "repository.hxx"
+#include "trace.hxx"
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
@@ -46,7 +51,10 @@ static string trunk = trunk_base + "/";
 static string branches = "/branches/";
 static string tags = "/tags/";
 
-static bool split_into_branch_filename( const char* path_, string& branch_, string& fname_ );
+/// Just walk the metadata, do not read the content of the files.
+static bool dry_run = false;
+
+static bool split_into_branch_filename( const char* path_, string_view& branch_, string_view& fname_ );
 
 static Time get_epoch( const svn_string_t* svndate )
 {
@@ -61,21 +69,27 @@ static Time get_epoch( const svn_string_t* svndate )
     return Time( mktime(&tm) );
 }
 
-static int dump_blob( svn_fs_root_t *root, char *full_path, const string &target_name, apr_pool_t *pool )
+static int dump_blob( svn_fs_root_t *root, char *full_path, string_view target_name, apr_pool_t *pool )
 {
+    Trace::Span span( "dump_blob", target_name );
+
     // create an own pool to avoid overflow of open streams
     apr_pool_t *subpool = svn_pool_create( pool );
 
     // prepare the stream
     svn_string_t *propvalue;
-    SVN_ERR( svn_fs_node_prop( &propvalue, root, full_path, "svn:executable", subpool ) );
     const char* mode = "644";
-    if ( propvalue )
-        mode = "755";
+    {
+        Metrics::Timer timer( Metrics::PHASE_PROPS );
 
-    SVN_ERR( svn_fs_node_prop( &propvalue, root, full_path, "svn:special", subpool ) );
-    if ( propvalue )
-        Error::report( "Got a symlink; we cannot handle symlinks now." );
+        SVN_ERR( svn_fs_node_prop( &propvalue, root, full_path, "svn:executable", subpool ) );
+        if ( propvalue )
+            mode = "755";
+
+        SVN_ERR( svn_fs_node_prop( &propvalue, root, full_path, "svn:special", subpool ) );
+        if ( propvalue )
+            Error::report( "Got a symlink; we cannot handle symlinks now." );
+    }
 
     Filter filter( target_name );
     FilePermission perm = filter.getPermission();
@@ -86,23 +100,68 @@ static int dump_blob( svn_fs_root_t *root, char *full_path, const string &target
         default:                break;
     }
 
-    ostream& out = Repositories::modifyFile( target_name, mode );
+    svn_filesize_t length;
+    {
+        Metrics::Timer timer( Metrics::PHASE_CONTENT );
+        SVN_ERR( svn_fs_file_length( &length, root, full_path, subpool ) );
+    }
 
-    // dump the content of the file
-    svn_stream_t   *stream;
-    SVN_ERR( svn_fs_file_contents( &stream, root, full_path, subpool ) );
+    if ( dry_run )
+    {
+        Repositories::estimateFile( target_name, mode, length );
+        svn_pool_destroy( subpool );
+        return 0;
+    }
+
+    ostream& out = Repositories::modifyFile( target_name, mode );
 
     const size_t buffer_size = 8192;
     char buffer[buffer_size];
 
+    svn_stream_t   *stream;
     apr_size_t len;
-    do {
-        len = buffer_size;
-        SVN_ERR( svn_stream_read( stream, buffer, &len ) );
-        filter.addData( buffer, len );
-    } while ( len > 0 );
 
-    filter.write( out );
+    // the big files that we can filter on the fly once we know the size after filtering
+    if ( filter.wantsCount( length ) )
+    {
+        Trace::Span count_span( "Filter::count", target_name );
+
+        SVN_ERR( svn_fs_file_contents( &stream, root, full_path, subpool ) );
+        do {
+            len = buffer_size;
+            {
+                Metrics::Timer timer( Metrics::PHASE_CONTENT );
+                SVN_ERR( svn_stream_read( stream, buffer, &len ) );
+                timer.addBytes( len );
+            }
+            filter.count( buffer, len );
+        } while ( len > 0 );
+    }
+
+    // when possible, the data go directly to the output
+    filter.stream( out, length );
+
+    // dump the content of the file
+    SVN_ERR( svn_fs_file_contents( &stream, root, full_path, subpool ) );
+
+    {
+        Trace::Span filter_span( "Filter::addData", target_name );
+
+        do {
+            len = buffer_size;
+            {
+                Metrics::Timer timer( Metrics::PHASE_CONTENT );
+                SVN_ERR( svn_stream_read( stream, buffer, &len ) );
+                timer.addBytes( len );
+            }
+            filter.addData( buffer, len );
+        } while ( len > 0 );
+    }
+
+    {
+        Trace::Span write_span( "Filter::write", target_name );
+        filter.write( out );
+    }
 
     svn_pool_destroy( subpool );
 
@@ -115,12 +174,17 @@ static int delete_hierarchy( svn_fs_root_t *fs_root, char *path, apr_pool_t *poo
     // the regexp deciding to what repository does the file belong can be just
     // anything
     svn_boolean_t is_dir;
-    SVN_ERR( svn_fs_is_dir( &is_dir, fs_root, path, pool ) );
+    apr_hash_t *entries = NULL;
+    {
+        Metrics::Timer timer( Metrics::PHASE_PATHS );
+
+        SVN_ERR( svn_fs_is_dir( &is_dir, fs_root, path, pool ) );
+        if ( is_dir )
+            SVN_ERR( svn_fs_dir_entries( &entries, fs_root, path, pool ) );
+    }
 
     if ( is_dir )
     {
-        apr_hash_t *entries;
-        SVN_ERR( svn_fs_dir_entries( &entries, fs_root, path, pool ) );
 
         for ( apr_hash_index_t *i = apr_hash_first( pool, entries ); i; i = apr_hash_next( i ) )
         {
@@ -128,17 +192,19 @@ static int delete_hierarchy( svn_fs_root_t *fs_root, char *path, apr_pool_t *poo
             void       *val;
             apr_hash_this( i, &key, NULL, &val );
 
-            delete_hierarchy( fs_root, (char *)( string( path ) + '/' + (char *)key ).c_str(), pool );
+            delete_hierarchy( fs_root, (char *)Arena::revision().concat( path, "/", (char *)key ).data(), pool );
         }
     }
     else
     {
-        string this_branch, fname;
+        string_view this_branch, fname;
 
         // we don't have to care about the branch name, it cannot change
         if ( split_into_branch_filename( path, this_branch, fname ) )
             Repositories::deleteFile( fname );
     }
+
+    return 0;
 }
 
 static int delete_hierarchy_rev( svn_fs_t *fs, svn_revnum_t rev, char *path, apr_pool_t *pool )
@@ -152,15 +218,20 @@ static int delete_hierarchy_rev( svn_fs_t *fs, svn_revnum_t rev, char *path, apr
 }
 
 static int dump_hierarchy( svn_fs_root_t *fs_root, char *path, int skip,
-        const string &prefix, apr_pool_t *pool )
+        string_view prefix, apr_pool_t *pool )
 {
     svn_boolean_t is_dir;
-    SVN_ERR( svn_fs_is_dir( &is_dir, fs_root, path, pool ) );
+    apr_hash_t *entries = NULL;
+    {
+        Metrics::Timer timer( Metrics::PHASE_PATHS );
+
+        SVN_ERR( svn_fs_is_dir( &is_dir, fs_root, path, pool ) );
+        if ( is_dir )
+            SVN_ERR( svn_fs_dir_entries( &entries, fs_root, path, pool ) );
+    }
 
     if ( is_dir )
     {
-        apr_hash_t *entries;
-        SVN_ERR( svn_fs_dir_entries( &entries, fs_root, path, pool ) );
 
         for ( apr_hash_index_t *i = apr_hash_first( pool, entries ); i; i = apr_hash_next( i ) )
         {
@@ -168,17 +239,19 @@ static int dump_hierarchy( svn_fs_root_t *fs_root, char *path, int skip,
             void       *val;
             apr_hash_this( i, &key, NULL, &val );
 
-            dump_hierarchy( fs_root, (char *)( string( path ) + '/' + (char *)key ).c_str(), skip, prefix, pool );
+            dump_hierarchy( fs_root, (char *)Arena::revision().concat( path, "/", (char *)key ).data(), skip, prefix, pool );
         }
     }
     else
-        dump_blob( fs_root, path, prefix + string( path + skip ), pool );
+        dump_blob( fs_root, path, Arena::revision().concat( prefix, path + skip ), pool );
 
     return 0;
 }
 
-static int copy_hierarchy( svn_fs_t *fs, svn_revnum_t rev, char *path_from, const string &path_to, apr_pool_t *pool )
+static int copy_hierarchy( svn_fs_t *fs, svn_revnum_t rev, char *path_from, string_view path_to, apr_pool_t *pool )
 {
+    Trace::Span span( "copy_hierarchy", path_from );
+
     svn_fs_root_t *fs_root;
     SVN_ERR( svn_fs_revision_root( &fs_root, fs, rev, pool ) );
 
@@ -203,7 +276,13 @@ static bool is_tag( const char* path_ )
     return tags.compare( 0, len, path_, 0, len ) == 0;
 }
 
-static bool split_into_branch_filename( const char* path_, string& branch_, string& fname_ )
+/** Split the path into the branch name and the file name.
+
+    Does not allocate (apart from the tag branch names that go to the
+    Arena::revision()); fname_ is always the tail of path_, so it is
+    \0-terminated.
+*/
+static bool split_into_branch_filename( const char* path_, string_view& branch_, string_view& fname_ )
 {
     if ( is_trunk( path_ ) )
     {
@@ -213,18 +292,18 @@ static bool split_into_branch_filename( const char* path_, string& branch_, stri
     else if ( trunk_base == path_ )
     {
         branch_ = "master";
-        fname_  = string();
+        fname_  = string_view();
     }
     else
     {
-        string tmp;
-        string prefix;
+        string_view tmp;
+        bool tag = false;
         if ( is_branch( path_ ) )
             tmp = path_ + branches.length();
         else if ( is_tag( path_ ) )
         {
             tmp = path_ + tags.length();
-            prefix = TAG_TEMP_BRANCH;
+            tag = true;
         }
         else
             return false;
@@ -232,16 +311,18 @@ static bool split_into_branch_filename( const char* path_, string& branch_, stri
         size_t slash = tmp.find( '/' );
         if ( slash == 0 )
             return false;
-        else if ( slash == string::npos )
-        {
-            branch_ = prefix + tmp;
-            fname_  = string();
-        }
+        else if ( slash == string_view::npos )
+            fname_  = string_view();
         else
         {
-            branch_ = prefix + tmp.substr( 0, slash );
             fname_  = tmp.substr( slash + 1 );
+            tmp = tmp.substr( 0, slash );
         }
+
+        if ( tag )
+            branch_ = Arena::revision().concat( TAG_TEMP_BRANCH, tmp );
+        else
+            branch_ = tmp;
     }
 
     return true;
@@ -268,9 +349,15 @@ int export_revision(svn_revnum_t rev, svn_fs_t *fs, apr_pool_t *pool)
         return 0;
     }
 
-    SVN_ERR(svn_fs_revision_root(&fs_root, fs, rev, pool));
-    SVN_ERR(svn_fs_paths_changed(&changes, fs_root, pool));
-    SVN_ERR(svn_fs_revision_proplist(&props, fs, rev, pool));
+    {
+        Metrics::Timer timer( Metrics::PHASE_PATHS );
+        SVN_ERR(svn_fs_revision_root(&fs_root, fs, rev, pool));
+        SVN_ERR(svn_fs_paths_changed(&changes, fs_root, pool));
+    }
+    {
+        Metrics::Timer timer( Metrics::PHASE_PROPS );
+        SVN_ERR(svn_fs_revision_proplist(&props, fs, rev, pool));
+    }
 
     revpool = svn_pool_create(pool);
 
@@ -282,6 +369,13 @@ int export_revision(svn_revnum_t rev, svn_fs_t *fs, apr_pool_t *pool)
 
     svnlog = static_cast<svn_string_t*>( apr_hash_get(props, "svn:log", APR_HASH_KEY_STRING) );
 
+    // convert the message just once, even if we commit more times
+    static string log;
+    {
+        Metrics::Timer timer( Metrics::PHASE_MESSAGES, svnlog->len );
+        CommitMessages::convert( svnlog->data, svnlog->len, log );
+    }
+
     string branch;
     bool no_changes = true;
     bool debug_once = true;
@@ -302,7 +396,7 @@ int export_revision(svn_revnum_t rev, svn_fs_t *fs, apr_pool_t *pool)
         if ( path[0] != '/' || strchr( path + 1, '/' ) == NULL )
             continue;
 
-        string this_branch, fname;
+        string_view this_branch, fname;
 
         // skip if we cannot find the branch
         if ( !split_into_branch_filename( path, this_branch, fname ) )
@@ -312,7 +406,10 @@ int export_revision(svn_revnum_t rev, svn_fs_t *fs, apr_pool_t *pool)
         if ( is_tag( path ) && Repositories::ignoreTag( this_branch ) )
             continue;
 
-        SVN_ERR(svn_fs_is_dir(&is_dir, fs_root, path, revpool));
+        {
+            Metrics::Timer timer( Metrics::PHASE_PATHS );
+            SVN_ERR(svn_fs_is_dir(&is_dir, fs_root, path, revpool));
+        }
 
         // detect creation of branch/tag
         if ( is_dir && change->change_kind == svn_fs_path_change_add )
@@ -329,17 +426,17 @@ int export_revision(svn_revnum_t rev, svn_fs_t *fs, apr_pool_t *pool)
                     const char* path_from;
                     SVN_ERR( svn_fs_copied_from( &rev_from, &path_from, fs_root, path, revpool ) );
 
-                    string from_branch, from_fname;
+                    string_view from_branch, from_fname;
                     if ( path_from != NULL &&
                          split_into_branch_filename( path_from, from_branch, from_fname ) &&
                          from_fname.empty() )
                     {
                         Repositories::createBranchOrTag( branching,
-                                rev_from, from_branch,
+                                rev_from, string( from_branch ),
                                 Committers::getAuthor( author->data ),
-                                this_branch, rev,
+                                string( this_branch ), rev,
                                 epoch,
-                                string( svnlog->data, svnlog->len ) );
+                                log );
 
                         tagged_or_branched = true;
                     }
@@ -359,7 +456,7 @@ int export_revision(svn_revnum_t rev, svn_fs_t *fs, apr_pool_t *pool)
             Repositories::commit( Committers::getAuthor( author->data ),
                     branch, rev,
                     epoch,
-                    string( svnlog->data, svnlog->len ) );
+                    log );
             branch = this_branch;
         }
 
@@ -387,6 +484,7 @@ int export_revision(svn_revnum_t rev, svn_fs_t *fs, apr_pool_t *pool)
     {
         fprintf( stderr, "%s.\n", tagged_or_branched? "created": "skipping" );
         svn_pool_destroy( revpool );
+        Arena::revision().reset();
         return 0;
     }
 
@@ -399,11 +497,14 @@ int export_revision(svn_revnum_t rev, svn_fs_t *fs, apr_pool_t *pool)
     Repositories::commit( Committers::getAuthor( author->data ),
             branch, rev,
             epoch,
-            string( svnlog->data, svnlog->len ),
+            log,
             parents );
 
     svn_pool_destroy( revpool );
 
+    // everything from this revision is written now
+    Arena::revision().reset();
+
     fprintf( stderr, "done!\n" );
 
     return 0;
@@ -428,7 +529,7 @@ int crawl_revisions( char *repos_path, const char* repos_config )
     max_rev = youngest_rev;
 
     int dummy = -1;
-    if ( !Repositories::load( repos_config, max_rev, dummy, trunk_base, trunk, branches, tags ) )
+    if ( !Repositories::load( repos_config, dummy, trunk_base, trunk, branches, tags ) )
     {
         Error::report( "Must have at least one valid repository definition." );
         return 1;
@@ -439,7 +540,10 @@ int crawl_revisions( char *repos_path, const char* repos_config )
     subpool = svn_pool_create(pool);
     for (rev = min_rev; rev <= max_rev; rev++) {
         svn_pool_clear(subpool);
+        Trace::beginRevision( "export_revision", rev );
         export_revision(rev, fs, subpool);
+        Trace::endRevision();
+        Metrics::revisionDone( rev );
     }
 
     svn_pool_destroy(pool);
@@ -449,8 +553,33 @@ int crawl_revisions( char *repos_path, const char* repos_config )
 
 int main(int argc, char *argv[])
 {
-    if (argc != 4) {
-        Error::report( string( "usage: " ) + argv[0] + " REPOS_PATH committers.txt reposlayout.txt\n" );
+    // options
+    int arg = 1;
+    for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; ++arg )
+    {
+        if ( strcmp( argv[arg], "--dry-run" ) == 0 )
+        {
+            dry_run = true;
+            Repositories::setDryRun();
+        }
+        else if ( strncmp( argv[arg], "--metrics=", 10 ) == 0 )
+            Metrics::setInterval( atoi( argv[arg] + 10 ) );
+        else if ( strncmp( argv[arg], "--trace=", 8 ) == 0 )
+        {
+            if ( !Trace::open( argv[arg] + 8 ) )
+                return Error::returnValue();
+        }
+        else if ( strncmp( argv[arg], "--trace-sample=", 15 ) == 0 )
+            Trace::setSample( atoi( argv[arg] + 15 ) );
+        else
+        {
+            Error::report( string( "Unknown option '" ) + argv[arg] + "'." );
+            return Error::returnValue();
+        }
+    }
+
+    if (argc - arg != 3) {
+        Error::report( string( "usage: " ) + argv[0] + " [--dry-run] [--metrics=SECONDS] [--trace=FILE.json [--trace-sample=N]] REPOS_PATH committers.txt reposlayout.txt\n" );
         return Error::returnValue();
     }
 
@@ -459,13 +588,17 @@ int main(int argc, char *argv[])
         return Error::returnValue();
     }
 
-    Committers::load( argv[2] );
+    Committers::load( argv[arg + 1] );
 
-    crawl_revisions( argv[1], argv[3] );
+    crawl_revisions( argv[arg], argv[arg + 2] );
 
     apr_terminate();
 
     Repositories::close();
 
+    Metrics::finish();
+
+    Trace::close();
+
     return Error::returnValue();
 }
@@ -0,0 +1,799 @@
+/*
+ * Verify the converted git repositories against the Subversion repository.
+ *
+ * For the sampled revisions, computes the SHA-1 of the git tree that each
+ * target repository should have, directly from the svn revision root - with
+ * the same routing and filtering as svn-fast-export - and compares it with
+ * the tree of the commit that git fast-import created for the revision (as
+ * found in the <repo>.marks file written by 'git fast-import
+ * --export-marks').  The files are read, filtered and hashed in a pool of
+ * threads; the files that did not change since the last verified revision
+ * are not read again.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "error.hxx"
+#include "filter.hxx"
+#include "repository.hxx"
+
+#include <apr_general.h>
+
+#include <svn_checksum.h>
+#include <svn_fs.h>
+#include <svn_pools.h>
+#include <svn_repos.h>
+#include <svn_types.h>
+
+using namespace std;
+
+static string trunk_base = "/trunk";
+static string trunk = trunk_base + "/";
+static string branches = "/branches/";
+static string tags = "/tags/";
+
+/// Binary SHA-1.
+struct Sha1
+{
+    unsigned char digest[20];
+
+    string hex() const
+    {
+        static const char digits[] = "0123456789abcdef";
+        string result( 40, '0' );
+        for ( int i = 0; i < 20; ++i )
+        {
+            result[2 * i] = digits[digest[i] >> 4];
+            result[2 * i + 1] = digits[digest[i] & 0xf];
+        }
+        return result;
+    }
+};
+
+/// A file in the expected tree.
+struct Entry
+{
+    string fname;
+    const char* mode;
+    Sha1 sha;
+};
+
+/// A converted repository we compare with.
+struct Target
+{
+    string name;
+
+    /// Git commits by the svn revision (from the marks).
+    map< long, string > commits;
+
+    /// Git trees of the commits we verify.
+    map< long, string > git_trees;
+
+    /// The files of the current revision.
+    vector< Entry > entries;
+
+    /// The expected tree of the current revision.
+    Sha1 tree;
+
+    Target( const string& name_ ) : name( name_ ) {}
+};
+
+static vector< Target > targets;
+
+/// Index to the targets by the Repository that Repositories::get() returns.
+static map< const Repository*, size_t > target_index;
+
+/// A file to read & hash.
+struct BlobJob
+{
+    string path;
+    string fname;
+    string key;
+    size_t target;
+    size_t entry;
+
+    const char* mode;
+    Sha1 sha;
+    string error;
+};
+
+/// Per-thread access to the repository.
+struct Worker
+{
+    apr_pool_t* pool;
+    apr_pool_t* root_pool;
+    apr_pool_t* file_pool;
+
+    svn_fs_t* fs;
+    svn_fs_root_t* root;
+    svn_revnum_t root_rev;
+
+    Worker() : pool( NULL ), root_pool( NULL ), file_pool( NULL ), fs( NULL ), root( NULL ), root_rev( SVN_INVALID_REVNUM ) {}
+};
+
+static vector< Worker > workers;
+
+/// Filter's constructor matches the rules in a shared PatternSet.
+static mutex filter_mutex;
+
+/// Hashes of the files that we have seen in the last revision, by the node id & file name.
+typedef unordered_map< string, pair< const char*, Sha1 > > BlobCache;
+static BlobCache blob_cache;
+
+/** Computes the git SHA-1 of the blob that the Filter writes.
+
+    Filter::write() produces 'data <size>\n<content>\n'; we turn the header
+    into the git object header 'blob <size>\0', and hash it with the content.
+*/
+class BlobHasher : public std::streambuf
+{
+    svn_checksum_ctx_t* ctx;
+    apr_pool_t* pool;
+
+    string header;
+    bool in_header;
+    unsigned long long remaining;
+
+public:
+    BlobHasher( apr_pool_t* pool_ )
+        : ctx( svn_checksum_ctx_create( svn_checksum_sha1, pool_ ) ), pool( pool_ ), in_header( true ), remaining( 0 ) {}
+
+    svn_error_t* finish( Sha1& sha_ )
+    {
+        svn_checksum_t* checksum;
+        SVN_ERR( svn_checksum_final( &checksum, ctx, pool ) );
+        memcpy( sha_.digest, checksum->digest, sizeof( sha_.digest ) );
+
+        return SVN_NO_ERROR;
+    }
+
+protected:
+    virtual int overflow( int c_ )
+    {
+        if ( c_ != traits_type::eof() )
+        {
+            const char c = c_;
+            xsputn( &c, 1 );
+        }
+        return traits_type::not_eof( c_ );
+    }
+
+    virtual std::streamsize xsputn( const char* data_, std::streamsize len_ )
+    {
+        const char* data = data_;
+        const char* end = data_ + len_;
+
+        while ( in_header && data < end )
+        {
+            if ( *data != '\n' )
+                header += *data++;
+            else
+            {
+                ++data;
+                in_header = false;
+                remaining = strtoull( header.c_str() + 5, NULL, 10 );
+
+                char blob_header[32];
+                const int len = snprintf( blob_header, sizeof( blob_header ), "blob %llu", remaining );
+                svn_checksum_update( ctx, blob_header, len + 1 );
+            }
+        }
+
+        // the rest (the trailing \n) is not part of the blob
+        const size_t len = min( static_cast< unsigned long long >( end - data ), remaining );
+        if ( len > 0 )
+        {
+            svn_checksum_update( ctx, data, len );
+            remaining -= len;
+        }
+
+        return len_;
+    }
+};
+
+/// Run fn_( worker, index ) for all the indexes in [0, count_), in all the threads.
+static void runParallel( size_t count_, const function< void( Worker&, size_t ) >& fn_ )
+{
+    atomic< size_t > next( 0 );
+
+    vector< thread > threads;
+    for ( size_t t = 0; t < workers.size(); ++t )
+    {
+        threads.push_back( thread( [&, t]()
+            {
+                for ( size_t i = next++; i < count_; i = next++ )
+                    fn_( workers[t], i );
+            } ) );
+    }
+
+    for ( size_t t = 0; t < threads.size(); ++t )
+        threads[t].join();
+}
+
+/// Read, filter and hash the file, the same way svn-fast-export's dump_blob() does.
+static svn_error_t* hashBlob( Worker& worker_, svn_revnum_t rev_, BlobJob& job_ )
+{
+    if ( worker_.root_rev != rev_ )
+    {
+        svn_pool_clear( worker_.root_pool );
+        SVN_ERR( svn_fs_revision_root( &worker_.root, worker_.fs, rev_, worker_.root_pool ) );
+        worker_.root_rev = rev_;
+    }
+    svn_pool_clear( worker_.file_pool );
+
+    const char* full_path = job_.path.c_str();
+
+    svn_string_t* propvalue;
+    SVN_ERR( svn_fs_node_prop( &propvalue, worker_.root, full_path, "svn:executable", worker_.file_pool ) );
+    job_.mode = propvalue? "100755": "100644";
+
+    unique_ptr< Filter > filter;
+    {
+        lock_guard< mutex > lock( filter_mutex );
+        filter.reset( new Filter( job_.fname ) );
+    }
+
+    switch ( filter->getPermission() )
+    {
+        case PERMISSION_EXEC:   job_.mode = "100755"; break;
+        case PERMISSION_NOEXEC: job_.mode = "100644"; break;
+        default:                break;
+    }
+
+    svn_filesize_t length;
+    SVN_ERR( svn_fs_file_length( &length, worker_.root, full_path, worker_.file_pool ) );
+
+    const size_t buffer_size = 65536;
+    char buffer[buffer_size];
+    svn_stream_t* stream;
+    apr_size_t len;
+
+    if ( filter->wantsCount( length ) )
+    {
+        SVN_ERR( svn_fs_file_contents( &stream, worker_.root, full_path, worker_.file_pool ) );
+        do {
+            len = buffer_size;
+            SVN_ERR( svn_stream_read( stream, buffer, &len ) );
+            filter->count( buffer, len );
+        } while ( len > 0 );
+    }
+
+    BlobHasher hasher( worker_.file_pool );
+    ostream out( &hasher );
+
+    filter->stream( out, length );
+
+    SVN_ERR( svn_fs_file_contents( &stream, worker_.root, full_path, worker_.file_pool ) );
+    do {
+        len = buffer_size;
+        SVN_ERR( svn_stream_read( stream, buffer, &len ) );
+        filter->addData( buffer, len );
+    } while ( len > 0 );
+
+    filter->write( out );
+    out.flush();
+
+    return hasher.finish( job_.sha );
+}
+
+/// Order of the entries in a git tree: the directories compare as if they ended with '/'.
+struct TreeChild
+{
+    string_view name;
+    bool is_dir;
+    const char* mode;
+    Sha1 sha;
+
+    bool operator<( const TreeChild& other_ ) const
+    {
+        const size_t len = min( name.length(), other_.name.length() );
+        const int result = name.compare( 0, len, other_.name.substr( 0, len ) );
+        if ( result != 0 )
+            return result < 0;
+
+        const unsigned char c1 = ( name.length() > len )? name[len]: ( is_dir? '/': 0 );
+        const unsigned char c2 = ( other_.name.length() > len )? other_.name[len]: ( other_.is_dir? '/': 0 );
+
+        return c1 < c2;
+    }
+};
+
+/// Hash the git tree of the entries [begin_, end_) that are all under the same prefix_len_ long directory; sorted by fname.
+static svn_error_t* hashTree( vector< Entry >::const_iterator begin_, vector< Entry >::const_iterator end_, size_t prefix_len_, Sha1& sha_, apr_pool_t* pool_ )
+{
+    vector< TreeChild > children;
+
+    for ( vector< Entry >::const_iterator it = begin_; it != end_; )
+    {
+        const string_view name = string_view( it->fname ).substr( prefix_len_ );
+        const size_t slash = name.find( '/' );
+
+        TreeChild child;
+        if ( slash == string_view::npos )
+        {
+            child.name = name;
+            child.is_dir = false;
+            child.mode = it->mode;
+            child.sha = it->sha;
+            ++it;
+        }
+        else
+        {
+            // all the entries of the subdirectory
+            child.name = name.substr( 0, slash );
+            child.is_dir = true;
+            child.mode = "40000";
+
+            const size_t dir_len = prefix_len_ + slash + 1;
+            vector< Entry >::const_iterator dir_end = it;
+            while ( dir_end != end_ && dir_end->fname.length() > dir_len &&
+                    dir_end->fname.compare( 0, dir_len, it->fname, 0, dir_len ) == 0 )
+                ++dir_end;
+
+            SVN_ERR( hashTree( it, dir_end, dir_len, child.sha, pool_ ) );
+            it = dir_end;
+        }
+        children.push_back( child );
+    }
+
+    sort( children.begin(), children.end() );
+
+    string content;
+    for ( vector< TreeChild >::const_iterator it = children.begin(); it != children.end(); ++it )
+    {
+        content += it->mode;
+        content += ' ';
+        content += it->name;
+        content += '\0';
+        content.append( reinterpret_cast< const char* >( it->sha.digest ), sizeof( it->sha.digest ) );
+    }
+
+    const string header = "tree " + to_string( content.length() );
+
+    svn_checksum_ctx_t* ctx = svn_checksum_ctx_create( svn_checksum_sha1, pool_ );
+    SVN_ERR( svn_checksum_update( ctx, header.c_str(), header.length() + 1 ) );
+    SVN_ERR( svn_checksum_update( ctx, content.data(), content.length() ) );
+
+    svn_checksum_t* checksum;
+    SVN_ERR( svn_checksum_final( &checksum, ctx, pool_ ) );
+    memcpy( sha_.digest, checksum->digest, sizeof( sha_.digest ) );
+
+    return SVN_NO_ERROR;
+}
+
+/// Collect the files of the branch (recursively), and the jobs for those we have not hashed yet.
+static svn_error_t* walkTree( svn_fs_root_t* root_, const string& path_, size_t branch_len_, vector< BlobJob >& jobs_, BlobCache& new_cache_, apr_pool_t* pool_ )
+{
+    apr_hash_t* entries;
+    SVN_ERR( svn_fs_dir_entries( &entries, root_, path_.c_str(), pool_ ) );
+
+    for ( apr_hash_index_t* i = apr_hash_first( pool_, entries ); i; i = apr_hash_next( i ) )
+    {
+        const void* key;
+        void* val;
+        apr_hash_this( i, &key, NULL, &val );
+        const svn_fs_dirent_t* dirent = static_cast< const svn_fs_dirent_t* >( val );
+
+        const string path = path_ + "/" + dirent->name;
+
+        if ( dirent->kind == svn_node_dir )
+        {
+            SVN_ERR( walkTree( root_, path, branch_len_, jobs_, new_cache_, pool_ ) );
+            continue;
+        }
+
+        const string fname = path.substr( branch_len_ + 1 );
+
+        map< const Repository*, size_t >::const_iterator target = target_index.find( &Repositories::get( fname ) );
+        if ( target == target_index.end() )
+            continue;
+
+        vector< Entry >& target_entries = targets[target->second].entries;
+        target_entries.push_back( Entry() );
+        target_entries.back().fname = fname;
+
+        // the node id changes with every change of the content or the properties
+        const svn_string_t* id = svn_fs_unparse_id( dirent->id, pool_ );
+        string cache_key( id->data, id->len );
+        cache_key += '\0';
+        cache_key += fname;
+
+        BlobCache::const_iterator cached = blob_cache.find( cache_key );
+        if ( cached != blob_cache.end() )
+        {
+            target_entries.back().mode = cached->second.first;
+            target_entries.back().sha = cached->second.second;
+            new_cache_.insert( *cached );
+            continue;
+        }
+
+        BlobJob job;
+        job.mode = "100644";
+        memset( job.sha.digest, 0, sizeof( job.sha.digest ) );
+        job.path = path;
+        job.fname = fname;
+        job.key = cache_key;
+        job.target = target->second;
+        job.entry = target_entries.size() - 1;
+        jobs_.push_back( job );
+    }
+
+    return SVN_NO_ERROR;
+}
+
+/// The branch (its path in svn) the path belongs to, empty if none (or an ignored tag).
+static string branchRoot( const char* path_ )
+{
+    const string path( path_ );
+
+    if ( path.compare( 0, trunk.length(), trunk ) == 0 || path == trunk_base )
+        return trunk_base;
+
+    string prefix;
+    if ( path.compare( 0, branches.length(), branches ) == 0 )
+        prefix = branches;
+    else if ( path.compare( 0, tags.length(), tags ) == 0 )
+        prefix = tags;
+    else
+        return string();
+
+    const size_t slash = path.find( '/', prefix.length() );
+    const string name = path.substr( prefix.length(), ( slash == string::npos )? string::npos: slash - prefix.length() );
+    if ( name.empty() )
+        return string();
+
+    if ( prefix == tags && Repositories::ignoreTag( TAG_TEMP_BRANCH + name ) )
+        return string();
+
+    return prefix + name;
+}
+
+/// Compute the expected trees for the revision, and compare them with git.
+static svn_error_t* verifyRevision( svn_fs_t* fs_, svn_revnum_t rev_, unsigned long& verified_, unsigned long& differ_, unsigned long& skipped_, apr_pool_t* pool_ )
+{
+    svn_fs_root_t* root;
+    SVN_ERR( svn_fs_revision_root( &root, fs_, rev_, pool_ ) );
+
+    // the branch of the commit
+    apr_hash_t* changes;
+    SVN_ERR( svn_fs_paths_changed( &changes, root, pool_ ) );
+
+    set< string > roots;
+    for ( apr_hash_index_t* i = apr_hash_first( pool_, changes ); i; i = apr_hash_next( i ) )
+    {
+        const void* key;
+        apr_hash_this( i, &key, NULL, NULL );
+        const char* path = static_cast< const char* >( key );
+
+        // svn-fast-export does not care about anything in the toplevel
+        if ( path[0] != '/' || strchr( path + 1, '/' ) == NULL )
+            continue;
+
+        const string branch = branchRoot( path );
+        if ( !branch.empty() )
+            roots.insert( branch );
+    }
+
+    if ( roots.size() != 1 )
+    {
+        // more commits with the same mark, we cannot tell which one is in the marks
+        fprintf( stderr, "r%ld: changes %lu branches, skipped.\n", rev_, static_cast< unsigned long >( roots.size() ) );
+        ++skipped_;
+        return SVN_NO_ERROR;
+    }
+
+    const string& branch = *roots.begin();
+
+    // the files & their hashes
+    for ( size_t t = 0; t < targets.size(); ++t )
+        targets[t].entries.clear();
+
+    vector< BlobJob > jobs;
+    BlobCache new_cache;
+    SVN_ERR( walkTree( root, branch, branch.length(), jobs, new_cache, pool_ ) );
+
+    runParallel( jobs.size(), [rev_, &jobs]( Worker& worker_, size_t i_ )
+        {
+            svn_error_t* err = hashBlob( worker_, rev_, jobs[i_] );
+            if ( err )
+            {
+                jobs[i_].error = err->message? err->message: "unknown error";
+                svn_error_clear( err );
+            }
+        } );
+
+    for ( vector< BlobJob >::const_iterator it = jobs.begin(); it != jobs.end(); ++it )
+    {
+        if ( !it->error.empty() )
+            Error::report( "Cannot hash '" + it->path + "': " + it->error );
+
+        Entry& entry = targets[it->target].entries[it->entry];
+        entry.mode = it->mode;
+        entry.sha = it->sha;
+        new_cache.insert( make_pair( it->key, make_pair( it->mode, it->sha ) ) );
+    }
+
+    // only what is in this revision, so that the cache does not grow
+    blob_cache.swap( new_cache );
+
+    // the trees of the repositories that have a commit in this revision
+    vector< size_t > to_verify;
+    for ( size_t t = 0; t < targets.size(); ++t )
+        if ( targets[t].git_trees.count( rev_ ) )
+            to_verify.push_back( t );
+
+    runParallel( to_verify.size(), [&to_verify]( Worker& worker_, size_t i_ )
+        {
+            Target& target = targets[to_verify[i_]];
+            sort( target.entries.begin(), target.entries.end(), []( const Entry& a_, const Entry& b_ ) { return a_.fname < b_.fname; } );
+
+            svn_pool_clear( worker_.file_pool );
+            svn_error_t* err = hashTree( target.entries.begin(), target.entries.end(), 0, target.tree, worker_.file_pool );
+            if ( err )
+            {
+                memset( target.tree.digest, 0, sizeof( target.tree.digest ) );
+                svn_error_clear( err );
+            }
+        } );
+
+    for ( vector< size_t >::const_iterator it = to_verify.begin(); it != to_verify.end(); ++it )
+    {
+        const Target& target = targets[*it];
+        const string expected = target.tree.hex();
+        const string& git_tree = target.git_trees.find( rev_ )->second;
+
+        ++verified_;
+        if ( expected != git_tree )
+        {
+            ++differ_;
+            Error::report( "r" + to_string( rev_ ) + " " + target.name + " (" + branch + "): commit " + target.commits.find( rev_ )->second +
+                    " has tree " + git_tree + ", expected " + expected + " (" + to_string( target.entries.size() ) + " files)" );
+        }
+    }
+
+    fprintf( stderr, "r%ld: verified %lu repositories, %lu files read.\n", rev_,
+            static_cast< unsigned long >( to_verify.size() ), static_cast< unsigned long >( jobs.size() ) );
+
+    return SVN_NO_ERROR;
+}
+
+/// Names of the repositories of the layout (the same as to-git.sh creates).
+static vector< string > repositoryNames( const char* layout_ )
+{
+    vector< string > result;
+
+    ifstream input( layout_ );
+    string line;
+    while ( getline( input, line ) )
+    {
+        if ( line.empty() || line[0] == '#' || line[0] == ':' )
+            continue;
+
+        const size_t end = line.find_first_of( "=:" );
+        if ( end == string::npos )
+            continue;
+
+        const string name = line.substr( 0, end );
+        if ( name.compare( 0, 7, "ignore-" ) != 0 )
+            result.push_back( name );
+    }
+
+    return result;
+}
+
+/// Read the git commits of the revisions from the marks file (':<100000 + revision> <sha1>').
+static bool readMarks( Target& target_ )
+{
+    ifstream input( ( target_.name + ".marks" ).c_str() );
+    if ( !input )
+        return false;
+
+    string line;
+    while ( getline( input, line ) )
+    {
+        const size_t space = line.find( ' ' );
+        if ( line.empty() || line[0] != ':' || space == string::npos )
+            continue;
+
+        const long mark = atol( line.c_str() + 1 );
+        if ( mark > 100000 )
+            target_.commits[mark - 100000] = line.substr( space + 1 );
+    }
+
+    return true;
+}
+
+/// Ask git for the trees of the commits, in batches.
+static void readGitTrees( Target& target_, const string& git_dir_, const set< long >& revisions_ )
+{
+    const size_t batch = 256;
+
+    vector< long > revs;
+    for ( set< long >::const_iterator it = revisions_.begin(); it != revisions_.end(); ++it )
+        if ( target_.commits.count( *it ) )
+            revs.push_back( *it );
+
+    for ( size_t first = 0; first < revs.size(); first += batch )
+    {
+        string command = "git -C '" + git_dir_ + "' rev-parse";
+        const size_t last = min( first + batch, revs.size() );
+        for ( size_t i = first; i < last; ++i )
+            command += " " + target_.commits[revs[i]] + "^{tree}";
+
+        FILE* git = popen( command.c_str(), "r" );
+        if ( !git )
+        {
+            Error::report( "Cannot run '" + command + "'." );
+            return;
+        }
+
+        char tree[64];
+        for ( size_t i = first; i < last && fgets( tree, sizeof( tree ), git ); ++i )
+            target_.git_trees[revs[i]] = string( tree, strcspn( tree, "\n" ) );
+
+        if ( pclose( git ) != 0 )
+            Error::report( "Cannot find some of the commits in '" + git_dir_ + "'." );
+    }
+}
+
+/// Open the repository for every worker thread.
+static svn_error_t* openWorkers( const char* repos_path_, unsigned int threads_ )
+{
+    workers.resize( threads_ );
+    for ( vector< Worker >::iterator it = workers.begin(); it != workers.end(); ++it )
+    {
+        it->pool = svn_pool_create( NULL );
+        it->root_pool = svn_pool_create( it->pool );
+        it->file_pool = svn_pool_create( it->pool );
+
+        svn_repos_t* repos;
+        SVN_ERR( svn_repos_open( &repos, repos_path_, it->pool ) );
+        it->fs = svn_repos_fs( repos );
+    }
+
+    return SVN_NO_ERROR;
+}
+
+static svn_error_t* verify( const char* repos_path_, const char* layout_, const string& git_base_, unsigned int threads_, unsigned int sample_ )
+{
+    apr_pool_t* pool = svn_pool_create( NULL );
+
+    SVN_ERR( svn_fs_initialize( pool ) );
+
+    svn_repos_t* repos;
+    SVN_ERR( svn_repos_open( &repos, repos_path_, pool ) );
+    svn_fs_t* fs = svn_repos_fs( repos );
+
+    // we need just the routing, not the output
+    Repositories::setDryRun();
+
+    int min_rev = -1;
+    if ( !Repositories::load( layout_, min_rev, trunk_base, trunk, branches, tags ) )
+    {
+        Error::report( "Must have at least one valid repository definition." );
+        return SVN_NO_ERROR;
+    }
+
+    vector< string > names = repositoryNames( layout_ );
+    for ( vector< string >::const_iterator it = names.begin(); it != names.end(); ++it )
+    {
+        Target target( *it );
+        if ( !readMarks( target ) )
+        {
+            fprintf( stderr, "No '%s.marks', not verifying '%s'.\n", it->c_str(), it->c_str() );
+            continue;
+        }
+
+        Repository* repository = Repositories::find( *it );
+        if ( !repository )
+            continue;
+
+        target_index[repository] = targets.size();
+        targets.push_back( target );
+    }
+
+    // every sample_-th revision that has a commit, and the last one
+    set< long > all;
+    for ( vector< Target >::const_iterator it = targets.begin(); it != targets.end(); ++it )
+        for ( map< long, string >::const_iterator commit = it->commits.begin(); commit != it->commits.end(); ++commit )
+            if ( !Repositories::ignoreRevision( commit->first ) )
+                all.insert( commit->first );
+
+    set< long > revisions;
+    size_t index = 0;
+    for ( set< long >::const_iterator it = all.begin(); it != all.end(); ++it, ++index )
+        if ( index % sample_ == 0 || index + 1 == all.size() )
+            revisions.insert( *it );
+
+    for ( vector< Target >::iterator it = targets.begin(); it != targets.end(); ++it )
+        readGitTrees( *it, git_base_ + "/" + it->name, revisions );
+
+    SVN_ERR( openWorkers( repos_path_, threads_ ) );
+
+    unsigned long verified = 0, differ = 0, skipped = 0;
+
+    apr_pool_t* subpool = svn_pool_create( pool );
+    for ( set< long >::const_iterator it = revisions.begin(); it != revisions.end(); ++it )
+    {
+        svn_pool_clear( subpool );
+        SVN_ERR( verifyRevision( fs, *it, verified, differ, skipped, subpool ) );
+    }
+
+    fprintf( stderr, "Verified %lu commits in %lu revisions (%lu skipped): %lu differ.\n",
+            verified, static_cast< unsigned long >( revisions.size() ), skipped, differ );
+
+    for ( vector< Worker >::iterator it = workers.begin(); it != workers.end(); ++it )
+        svn_pool_destroy( it->pool );
+    svn_pool_destroy( pool );
+
+    return SVN_NO_ERROR;
+}
+
+int main( int argc, char *argv[] )
+{
+    unsigned int threads = thread::hardware_concurrency();
+    unsigned int sample = 1;
+
+    int arg = 1;
+    for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; ++arg )
+    {
+        if ( strncmp( argv[arg], "--threads=", 10 ) == 0 )
+            threads = atoi( argv[arg] + 10 );
+        else if ( strncmp( argv[arg], "--sample=", 9 ) == 0 )
+            sample = atoi( argv[arg] + 9 );
+        else
+        {
+            Error::report( string( "Unknown option '" ) + argv[arg] + "'." );
+            return Error::returnValue();
+        }
+    }
+
+    if ( argc - arg != 3 )
+    {
+        Error::report( string( "usage: " ) + argv[0] + " [--threads=N] [--sample=N] REPOS_PATH reposlayout.txt GIT_BASE\n\n"
+                "Compares the trees of the commits in GIT_BASE/<repo> (found via <repo>.marks\n"
+                "of 'git fast-import --export-marks') with the svn revisions.\n" );
+        return Error::returnValue();
+    }
+
+    if ( threads < 1 )
+        threads = 1;
+    if ( sample < 1 )
+        sample = 1;
+
+    if ( apr_initialize() != APR_SUCCESS )
+    {
+        Error::report( "You lose at apr_initialize()." );
+        return Error::returnValue();
+    }
+
+    svn_error_t* err = verify( argv[arg], argv[arg + 1], argv[arg + 2], threads, sample );
+    if ( err )
+    {
+        Error::report( string( "Subversion error: " ) + ( err->message? err->message: "unknown error" ) );
+        svn_error_clear( err );
+    }
+
+    apr_terminate();
+
+    return Error::returnValue();
+}
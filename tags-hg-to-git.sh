@@ -1,23 +1,15 @@
 #!/bin/bash
 #
 # To create a mapping between Hg and Git tags
-# Just a quick hack ;-)
 #
 # Use like:
-# cd ooo-build/src/clone
-# for I in * ; do [ -d $I ] && ( cd $I ; echo -n ":commit map=$I," ; /local/projects/svn-to-git/tags-hg-to-git.sh ) ; done > repositories.txt
+# tags-hg-to-git.sh /local/projects/mercurial/OOO320 ooo-build/src/clone/* > repositories.txt
+#
+# (joins the output of 'hg tags' with the 'ooo/' tags of the git
+# repositories, see hg-fast-export --commit-map)
 #
 
-( cd /local/projects/mercurial/OOO320 ; hg tags ) > /tmp/tags
+HG="$1"
+shift
 
-for T in `git tag` 
-do
-    N=`echo $T | sed 's#^ooo/##'`
-    ( grep -m 1 "$N" /tmp/tags &&
-      git show $T | grep -m 1 '^commit ' | sed 's/commit //' ) | tr ':\n' '  '
-    echo
-done | while read TAG COMMIT HG GIT
-do
-    [ -n "$COMMIT" ] && echo -n "$COMMIT:$GIT "
-done
-echo
+exec `dirname $0`/hg-fast-export --commit-map "$HG" "$@"
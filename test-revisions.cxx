@@ -0,0 +1,57 @@
+/*
+ * Tests of the table of the committed revisions.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "revisions.hxx"
+
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check( unsigned int result_, unsigned int expected_, const char* what_ )
+{
+    if ( result_ == expected_ )
+        return;
+
+    fprintf( stderr, "FAILED: %s is %u, expected %u\n", what_, result_, expected_ );
+    ++failures;
+}
+
+int main( int argc, char *argv[] )
+{
+    const unsigned int a = Revisions::addRepository();
+    const unsigned int b = Revisions::addRepository();
+
+    // revision 5 belongs to different branches in a and b
+    Revisions::setCommitted( 3, a, 1 );
+    Revisions::setCommitted( 5, a, 1 );
+    Revisions::setCommitted( 5, b, 2 );
+
+    check( Revisions::findCommit( 5, a, 1 ), 5, "findCommit( 5, a, 1 )" );
+    check( Revisions::findCommit( 5, b, 2 ), 5, "findCommit( 5, b, 2 )" );
+    check( Revisions::findCommit( 5, b, 1 ), 0, "findCommit( 5, b, 1 )" );
+    check( Revisions::findCommit( 5, a, 2 ), 0, "findCommit( 5, a, 2 )" );
+    check( Revisions::findCommit( 4, a, 1 ), 3, "findCommit( 4, a, 1 )" );
+
+    // the same revision committed again (a branch creation re-using the number)
+    Revisions::setCommitted( 7, b, 2 );
+    Revisions::setCommitted( 7, b, 3 );
+
+    check( Revisions::findCommit( 7, b, 3 ), 7, "findCommit( 7, b, 3 )" );
+    check( Revisions::findCommit( 7, b, 2 ), 5, "findCommit( 7, b, 2 )" );
+
+    // and back to the branch of the first commit
+    Revisions::setCommitted( 5, b, 1 );
+
+    check( Revisions::findCommit( 5, b, 1 ), 5, "findCommit( 5, b, 1 ) after re-commit" );
+    check( Revisions::findCommit( 5, b, 2 ), 0, "findCommit( 5, b, 2 ) after re-commit" );
+    check( Revisions::findCommit( 5, a, 1 ), 5, "findCommit( 5, a, 1 ) after re-commit" );
+
+    if ( failures == 0 )
+        fprintf( stderr, "All tests passed.\n" );
+
+    return failures? 1: 0;
+}
@@ -0,0 +1,345 @@
+/*
+ * Tests of reading the Mercurial store directly.
+ *
+ * The expected store paths follow mercurial/store.py (_hybridencode with
+ * and without dotencode); the revlogs are written here, in the layout
+ * described in mercurial/help/internals/revlogs.txt.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "revlog.hxx"
+
+#include <cstdlib>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+using namespace std;
+
+static int failures = 0;
+
+static void check( int result_, int expected_, const string& what_ )
+{
+    if ( result_ == expected_ )
+        return;
+
+    fprintf( stderr, "FAILED: %s is %d, expected %d\n", what_.c_str(), result_, expected_ );
+    ++failures;
+}
+
+static void check( const string& result_, const string& expected_, const string& what_ )
+{
+    if ( result_ == expected_ )
+        return;
+
+    fprintf( stderr, "FAILED: %s is '%s', expected '%s'\n", what_.c_str(), result_.c_str(), expected_.c_str() );
+    ++failures;
+}
+
+/// Write the file, creating the directories on the way.
+static void writeFile( const string& fname_, const string& content_ )
+{
+    for ( size_t slash = fname_.find( '/', 1 ); slash != string::npos; slash = fname_.find( '/', slash + 1 ) )
+        mkdir( fname_.substr( 0, slash ).c_str(), 0755 );
+
+    FILE* file = fopen( fname_.c_str(), "wb" );
+    if ( !file )
+    {
+        fprintf( stderr, "FAILED: cannot write '%s'\n", fname_.c_str() );
+        ++failures;
+        return;
+    }
+
+    fwrite( content_.data(), 1, content_.size(), file );
+    fclose( file );
+}
+
+static void appendUInt32( string& out_, unsigned int value_ )
+{
+    out_ += static_cast< char >( value_ >> 24 );
+    out_ += static_cast< char >( value_ >> 16 );
+    out_ += static_cast< char >( value_ >> 8 );
+    out_ += static_cast< char >( value_ );
+}
+
+/// Node of the test revision.
+static HgNode testNode( int rev_ )
+{
+    HgNode node;
+    for ( size_t i = 0; i < sizeof( node.id ); ++i )
+        node.id[i] = 0x10 * ( rev_ + 1 ) + i;
+
+    return node;
+}
+
+/// Replace text_[start_..end_) with data_.
+static string delta( unsigned int start_, unsigned int end_, const string& data_ )
+{
+    string result;
+    appendUInt32( result, start_ );
+    appendUInt32( result, end_ );
+    appendUInt32( result, data_.length() );
+
+    return result + data_;
+}
+
+/// The chunk stored as it is (the deltas start with '\0').
+static string uncompressed( const string& data_ )
+{
+    return ( !data_.empty() && data_[0] == '\0' )? data_: "u" + data_;
+}
+
+static string compressed( const string& data_ )
+{
+    uLongf length = compressBound( data_.length() );
+    string result( length, '\0' );
+    compress( reinterpret_cast< Bytef* >( &result[0] ), &length, reinterpret_cast< const Bytef* >( data_.data() ), data_.length() );
+    result.resize( length );
+
+    return result;
+}
+
+struct TestRevision
+{
+    /// The stored (compressed or marked) chunk.
+    string chunk;
+
+    /// Start of the delta chain, or the delta parent with generaldelta.
+    int base;
+
+    int p1;
+    int p2;
+};
+
+/// Write the revlog; inline_ puts the data to the .i file.
+static void writeRevlog( const string& fname_, const vector< TestRevision >& revisions_, bool inline_, bool general_delta_ )
+{
+    string index;
+    string data;
+
+    unsigned long long offset = 0;
+    for ( size_t rev = 0; rev < revisions_.size(); ++rev )
+    {
+        const TestRevision& revision = revisions_[rev];
+
+        string entry;
+        if ( rev == 0 )
+            appendUInt32( entry, 1 | ( inline_? 1 << 16: 0 ) | ( general_delta_? 1 << 17: 0 ) );
+        else
+            appendUInt32( entry, offset >> 16 );
+        appendUInt32( entry, ( offset & 0xffff ) << 16 );
+        appendUInt32( entry, revision.chunk.length() );
+        appendUInt32( entry, 0 ); // uncompressed length, not used
+        appendUInt32( entry, revision.base );
+        appendUInt32( entry, rev );
+        appendUInt32( entry, revision.p1 );
+        appendUInt32( entry, revision.p2 );
+
+        const HgNode node = testNode( rev );
+        entry.append( reinterpret_cast< const char* >( node.id ), sizeof( node.id ) );
+        entry.append( 12, '\0' );
+
+        index += entry;
+        if ( inline_ )
+            index += revision.chunk;
+        else
+            data += revision.chunk;
+
+        offset += revision.chunk.length();
+    }
+
+    writeFile( fname_ + ".i", index );
+    if ( !inline_ )
+        writeFile( fname_ + ".d", data );
+}
+
+static const char* const text0 = "line 1\nline 2\nline 3\n";
+static const char* const text1 = "line 1\nline two\nline 3\n";
+
+/** Revlog with delta chains: 0 <- 1 <- 2 <- 3 without generaldelta, and
+    0 <- 1 <- 3, 0 <- 2 with it; 4 is a full text again, 5 a merge of 3 and 4.
+*/
+static void testRevlog( const string& dir_, bool inline_, bool general_delta_ )
+{
+    const string what = string( inline_? "inline": "split" ) + ( general_delta_? " generaldelta": "" ) + " revlog";
+
+    vector< string > texts;
+    vector< TestRevision > revisions;
+
+    texts.push_back( text0 );
+    revisions.push_back( { uncompressed( text0 ), 0, -1, -1 } );
+
+    texts.push_back( text1 );
+    revisions.push_back( { uncompressed( delta( 7, 14, "line two\n" ) ), 0, 0, -1 } );
+
+    if ( general_delta_ )
+    {
+        // against 0, the wrong base would give a broken text
+        texts.push_back( string( text0 ) + "line 4\n" );
+        revisions.push_back( { compressed( delta( 21, 21, "line 4\n" ) ), 0, 1, -1 } );
+
+        // against 1
+        texts.push_back( "line 0\n" + string( text1 ) );
+        revisions.push_back( { uncompressed( delta( 0, 0, "line 0\n" ) ), 1, 2, -1 } );
+    }
+    else
+    {
+        texts.push_back( string( text1 ) + "line 4\n" );
+        revisions.push_back( { compressed( delta( 23, 23, "line 4\n" ) ), 0, 1, -1 } );
+
+        texts.push_back( "line 0\n" + texts.back() );
+        revisions.push_back( { uncompressed( delta( 0, 0, "line 0\n" ) ), 0, 2, -1 } );
+    }
+
+    texts.push_back( "another\nfull text\n" );
+    revisions.push_back( { compressed( texts.back() ), 4, 1, -1 } );
+
+    texts.push_back( "merged\n" + texts.back() );
+    revisions.push_back( { uncompressed( delta( 0, 0, "merged\n" ) ), 4, 3, 4 } );
+
+    const string fname = dir_ + "/" + ( inline_? "inline": "split" ) + ( general_delta_? "-gd": "" );
+    writeRevlog( fname, revisions, inline_, general_delta_ );
+
+    Revlog revlog;
+    if ( !revlog.open( fname + ".i", fname + ".d" ) )
+    {
+        fprintf( stderr, "FAILED: cannot open the %s\n", what.c_str() );
+        ++failures;
+        return;
+    }
+
+    check( revlog.count(), texts.size(), what + " count" );
+    check( revlog.parent1( 3 ), 2, what + " parent1( 3 )" );
+    check( revlog.parent2( 5 ), 4, what + " parent2( 5 )" );
+    check( revlog.rev( testNode( 4 ) ), 4, what + " rev( node 4 )" );
+    check( revlog.node( 2 ) == testNode( 2 ), true, what + " node( 2 )" );
+
+    vector< int > heads;
+    revlog.heads( heads );
+    check( heads.size(), 1, what + " heads" );
+    check( heads.empty()? -1: heads[0], 5, what + " head" );
+
+    // out of order, so that the cached text is both used and not
+    const int order[] = { 3, 1, 2, 0, 5, 3, 3, 4 };
+    for ( int rev : order )
+    {
+        string text;
+        if ( !revlog.revision( rev, text ) )
+            text = "<error>";
+
+        check( text, texts[rev], what + " revision " + to_string( rev ) );
+    }
+}
+
+/// The path of the file, and where the store with fncache has its revlog.
+struct StorePath
+{
+    const char* path;
+    const char* encoded;
+};
+
+static const StorePath store_paths[] =
+{
+    { "aux.c", "data/au~78.c.i" },
+    { "com1/Makefile", "data/co~6d1/_makefile.i" },
+    { "lpt9.txt/con", "data/lp~749.txt/co~6e.i" },
+    { "trail./space /f", "data/trail~2e/space~20/f.i" },
+    { "Upper_Case/README", "data/_upper___case/_r_e_a_d_m_e.i" },
+    { "foo.i/bar.d/baz.hg/x", "data/foo.i.hg/bar.d.hg/baz.hg.hg/x.i" },
+    { "a:b?", "data/a~3ab~3f.i" },
+    { "some/quite/long/directory/names/that/make/the/whole/path/exceed/the/limit/of/the/fncache/store/so/that/it/gets/Hashed_File.cxx",
+      "dh/some/quite/long/director/names/that/make/the/whole/path/exceed/the/hashed_fda308b072bba2709f31ff25735b4e38e818a35ea.i" },
+    { "aaaaaaaaaa/bbbbbbbbbb/cccccccccc/dddddddddd/eeeeeeeeee/ffffffffff/gggggggggg/hhhhhhhhhh/iiiiiiiiii/jjjjjjjjjj/kkkkkkkkkk/f",
+      "dh/aaaaaaaa/bbbbbbbb/cccccccc/dddddddd/eeeeeeee/ffffffff/gggggggg/f.i684040d4e96481e512ed4f7d1fe08fd6627142d8.i" },
+};
+
+/// Paths that are encoded differently with and without dotencode.
+struct DotencodePath
+{
+    const char* path;
+    const char* dotencode;
+    const char* plain;
+};
+
+static const DotencodePath dotencode_paths[] =
+{
+    { ".hidden/.x", "data/~2ehidden/~2ex.i", "data/.hidden/.x.i" },
+    { "AUX/com1.d/..trailing./x Directory With Spaces/and.a.very.long.basename.that.keeps.going.and.going.and.going.and.going.Ext",
+      "dh/au~78/co~6d1.d/~2e.trai/x direct/and.a.very.long.basename.that.keeps.going.d0f3071975c053c9e8e7212901d1558417551ba5.i",
+      "dh/au~78/co~6d1.d/..traili/x direct/and.a.very.long.basename.that.keeps.going.d0f3071975c053c9e8e7212901d1558417551ba5.i" },
+};
+
+/// Write the filelog where Mercurial has it, and read it through HgRepository.
+static void testStorePaths( const string& dir_, bool dotencode_ )
+{
+    const string repo = dir_ + ( dotencode_? "/repo-dotencode": "/repo" );
+    const string store = repo + "/.hg/store/";
+
+    writeFile( repo + "/.hg/requires", string( "revlogv1\nstore\nfncache\n" ) + ( dotencode_? "dotencode\n": "" ) );
+    writeFile( store + "00changelog.i", "" );
+    writeFile( store + "00manifest.i", "" );
+
+    vector< pair< string, string > > paths;
+    for ( const StorePath& path : store_paths )
+        paths.push_back( make_pair( path.path, path.encoded ) );
+    for ( const DotencodePath& path : dotencode_paths )
+        paths.push_back( make_pair( path.path, dotencode_? path.dotencode: path.plain ) );
+
+    for ( const pair< string, string >& path : paths )
+    {
+        // the copy metadata is not part of the content
+        const string content = "content of " + path.first + "\n";
+        const vector< TestRevision > revisions = { { uncompressed( "\1\ncopy: old\n\1\n" + content ), 0, -1, -1 } };
+        writeRevlog( store + path.second.substr( 0, path.second.length() - 2 ), revisions, true, true );
+    }
+
+    HgRepository repository;
+    if ( !repository.open( repo ) )
+    {
+        fprintf( stderr, "FAILED: cannot open '%s'\n", repo.c_str() );
+        ++failures;
+        return;
+    }
+
+    for ( const pair< string, string >& path : paths )
+    {
+        string data;
+        if ( !repository.fileData( path.first, testNode( 0 ), data ) )
+            data = "<error>";
+
+        check( data, "content of " + path.first + "\n", string( "fileData( '" ) + path.first + "' )" + ( dotencode_? " with dotencode": "" ) );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    char dir[] = "/tmp/test-revlog-XXXXXX";
+    if ( !mkdtemp( dir ) )
+    {
+        fprintf( stderr, "FAILED: cannot create a temporary directory\n" );
+        return 1;
+    }
+
+    testRevlog( dir, true, false );
+    testRevlog( dir, true, true );
+    testRevlog( dir, false, false );
+    testRevlog( dir, false, true );
+
+    testStorePaths( dir, true );
+    testStorePaths( dir, false );
+
+    if ( system( ( string( "rm -rf " ) + dir ).c_str() ) != 0 )
+        fprintf( stderr, "Cannot remove '%s'.\n", dir );
+
+    if ( failures == 0 )
+        fprintf( stderr, "All tests passed.\n" );
+
+    return failures? 1: 0;
+}
@@ -55,10 +55,10 @@ for I in `sed -e 's/^[#:].*//' -e 's/^ignore-.*//' -e 's/=.*//' "$LAYOUT" | grep
         mkdir "$TARGET/$NAME"
         mkfifo $NAME.dump
         if [ -z "$COMMIT" -o -z "$FROM" ] ; then
-            ( cd "$TARGET/$NAME" ; git init ; git fast-import < "$WD"/$NAME.dump ) &
+            ( cd "$TARGET/$NAME" ; git init ; git fast-import --export-marks="$WD"/$NAME.marks < "$WD"/$NAME.dump ) &
         else
             ( cd "$TARGET" ; git clone -n "$FROM/$NAME" "$NAME" ; \
-              cd "$NAME" ; git reset -q --hard "$COMMIT" ; git fast-import < "$WD"/$NAME.dump ; \
+              cd "$NAME" ; git reset -q --hard "$COMMIT" ; git fast-import --export-marks="$WD"/$NAME.marks < "$WD"/$NAME.dump ; \
               git checkout -f ) &
         fi
     )
@@ -0,0 +1,231 @@
+/*
+ * Record what happens when, in the Chrome trace-event format.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#include "error.hxx"
+#include "trace.hxx"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/// The details of a revision that took at least this long are always written.
+static const double slow_revision = 1.0;
+
+/// At most so many spans are kept per revision; the rest is just counted.
+static const size_t max_pending = 100000;
+
+bool Trace::enabled = false;
+
+static FILE* trace_file = NULL;
+
+static int sample = 1;
+
+/// Time 0 of the trace.
+static double trace_start = 0;
+
+/// Revision we are in, -1 if none.
+static long revision = -1;
+static const char* revision_name = NULL;
+static double revision_start = 0;
+
+/// Span as recorded, formatted only when it is written.
+struct PendingEvent
+{
+    const char* name;
+    double start;
+    double end;
+    string path;
+    string repo;
+};
+
+/// The spans of the current revision, waiting for the decision whether to
+/// write them; the entries are reused (with their strings) between revisions.
+static vector< PendingEvent > pending;
+static size_t pending_count = 0;
+
+/// Spans that did not fit to the pending ones.
+static size_t dropped = 0;
+
+/// Was anything written already (the events are separated by commas)?
+static bool first_event = true;
+
+/// Append the string as a JSON string.
+static void appendJson( string& out_, string_view str_ )
+{
+    out_ += '"';
+    for ( string_view::const_iterator it = str_.begin(); it != str_.end(); ++it )
+    {
+        const unsigned char c = *it;
+        if ( c == '"' || c == '\\' )
+        {
+            out_ += '\\';
+            out_ += c;
+        }
+        else if ( c < 0x20 )
+        {
+            char buf[8];
+            snprintf( buf, sizeof( buf ), "\\u%04x", c );
+            out_ += buf;
+        }
+        else
+            out_ += c;
+    }
+    out_ += '"';
+}
+
+/// Append one complete ('X') event.
+static void appendEvent( string& out_, const char* name_, double start_, double end_, string_view path_, string_view repo_, size_t dropped_ = 0 )
+{
+    char buf[200];
+    snprintf( buf, sizeof( buf ), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"rev\":%ld",
+            name_, ( start_ - trace_start ) * 1e6, ( end_ - start_ ) * 1e6, revision );
+    out_ += buf;
+
+    if ( dropped_ > 0 )
+    {
+        snprintf( buf, sizeof( buf ), ",\"dropped\":%zu", dropped_ );
+        out_ += buf;
+    }
+
+    if ( !path_.empty() )
+    {
+        out_ += ",\"path\":";
+        appendJson( out_, path_ );
+    }
+    if ( !repo_.empty() )
+    {
+        out_ += ",\"repo\":";
+        appendJson( out_, repo_ );
+    }
+    out_ += "}},\n";
+}
+
+/// Write the formatted events to the file.
+static void writeOut( const string& out_ )
+{
+    if ( first_event )
+    {
+        fputs( "[\n", trace_file );
+        first_event = false;
+    }
+    fwrite( out_.data(), 1, out_.size(), trace_file );
+}
+
+/// Format the pending events to out_, and forget them.
+static void formatPending( string& out_ )
+{
+    for ( size_t i = 0; i < pending_count; ++i )
+    {
+        const PendingEvent& event = pending[i];
+        appendEvent( out_, event.name, event.start, event.end, event.path, event.repo );
+    }
+    pending_count = 0;
+}
+
+bool Trace::open( const char* fname_ )
+{
+    trace_file = fopen( fname_, "w" );
+    if ( !trace_file )
+    {
+        Error::report( string( "Cannot open the trace file '" ) + fname_ + "'." );
+        return false;
+    }
+
+    trace_start = Metrics::now();
+    enabled = true;
+
+    return true;
+}
+
+void Trace::setSample( int every_ )
+{
+    sample = ( every_ > 0 )? every_: 1;
+}
+
+void Trace::beginRevision( const char* name_, long rev_ )
+{
+    if ( !enabled )
+        return;
+
+    revision = rev_;
+    revision_name = name_;
+    revision_start = Metrics::now();
+}
+
+void Trace::endRevision()
+{
+    if ( !enabled )
+        return;
+
+    const double end = Metrics::now();
+
+    string out;
+
+    // the details only for the sampled (or slow) revisions
+    if ( revision % sample == 0 || end - revision_start >= slow_revision )
+        formatPending( out );
+    else
+        pending_count = 0;
+
+    appendEvent( out, revision_name, revision_start, end, string_view(), string_view(), dropped );
+    writeOut( out );
+
+    revision = -1;
+    dropped = 0;
+}
+
+void Trace::close()
+{
+    if ( !enabled )
+        return;
+
+    if ( pending_count > 0 )
+    {
+        string out;
+        formatPending( out );
+        writeOut( out );
+    }
+
+    // the last event has a trailing comma, the metadata event is a valid end
+    if ( first_event )
+        fputs( "[\n", trace_file );
+    fputs( "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"fast-export\"}}\n]\n", trace_file );
+
+    fclose( trace_file );
+    trace_file = NULL;
+    enabled = false;
+}
+
+void Trace::event( const char* name_, double start_, double end_, std::string_view path_, std::string_view repo_ )
+{
+    // outside of the revisions, nothing to decide
+    if ( revision < 0 )
+    {
+        string out;
+        appendEvent( out, name_, start_, end_, path_, repo_ );
+        writeOut( out );
+        return;
+    }
+
+    if ( pending_count >= max_pending )
+    {
+        ++dropped;
+        return;
+    }
+
+    if ( pending_count == pending.size() )
+        pending.emplace_back();
+
+    PendingEvent& event = pending[pending_count++];
+    event.name = name_;
+    event.start = start_;
+    event.end = end_;
+    event.path.assign( path_.data(), path_.size() );
+    event.repo.assign( repo_.data(), repo_.size() );
+}
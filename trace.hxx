@@ -0,0 +1,66 @@
+/*
+ * Record what happens when, in the Chrome trace-event format.
+ *
+ * Author: Jan Holesovsky <kendy@suse.cz>
+ * License: MIT <http://www.opensource.org/licenses/mit-license.php>
+ */
+
+#ifndef _TRACE_HXX_
+#define _TRACE_HXX_
+
+#include <string_view>
+
+#include "metrics.hxx"
+
+/** Spans of the work (export of a revision, dump of a file, commit to a
+    repository, ...) for chrome://tracing or Perfetto.
+
+    Every revision gets its span; the spans inside it are written only for
+    every n-th revision (see setSample()), and for the revisions that took
+    long, so that the trace of the entire history stays small, but the
+    stalls are still explained.
+*/
+namespace Trace
+{
+    /// Is the trace on?
+    extern bool enabled;
+
+    /// Start writing the trace to the file.
+    bool open( const char* fname_ );
+
+    /// Record the details of every every_-th revision only.
+    void setSample( int every_ );
+
+    /// Start of the revision; the spans till endRevision() belong to it.
+    void beginRevision( const char* name_, long rev_ );
+
+    /// End of the revision; writes its span (and the inner ones when wanted).
+    void endRevision();
+
+    /// Finish the trace file.
+    void close();
+
+    /// Record a span; path_ and repo_ can be empty.
+    void event( const char* name_, double start_, double end_, std::string_view path_, std::string_view repo_ );
+
+    /// Records its scope (when the trace is on).
+    class Span
+    {
+        const char* name;
+        std::string_view path;
+        std::string_view repo;
+        double start;
+
+    public:
+        Span( const char* name_, std::string_view path_ = std::string_view(), std::string_view repo_ = std::string_view() )
+            : name( name_ ), path( path_ ), repo( repo_ ), start( enabled? Metrics::now(): 0 ) {}
+
+        ~Span() { if ( enabled ) event( name, start, Metrics::now(), path, repo ); }
+
+    private:
+        Span( const Span& );
+        Span& operator=( const Span& );
+    };
+}
+
+#endif // _TRACE_HXX_